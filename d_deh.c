@@ -63,14 +63,14 @@ char* dehfgets(char* buf, size_t n, DEHFILE* fp)
 {
     if (!fp->lump)                                     // If this is a real file,
         return fgets(buf, n, (FILE*)fp->inp);        // return regular fgets
-    if (!n || !*fp->inp || fp->size <= 0)                // If no more characters
+    if (!n || fp->size <= 0 || !*fp->inp)                // If no more characters
         return NULL;
     if (n == 1)
         fp->size--, * buf = *fp->inp++;
     else
     {                                                // copy buffer
         char* p = buf;
-        while (n > 1 && *fp->inp && fp->size &&
+        while (n > 1 && fp->size && *fp->inp &&
             (n--, fp->size--, *p++ = *fp->inp++) != '\n')
             ;
         *p = 0;
@@ -80,7 +80,7 @@ char* dehfgets(char* buf, size_t n, DEHFILE* fp)
 
 int dehfeof(DEHFILE* fp)
 {
-    return !fp->lump ? feof((FILE*)fp->inp) : !*fp->inp || fp->size <= 0;
+    return !fp->lump ? feof((FILE*)fp->inp) : fp->size <= 0 || !*fp->inp;
 }
 
 int dehfgetc(DEHFILE* fp)
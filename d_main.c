@@ -1139,29 +1139,21 @@ static void D_ProcessDehPreincludes(void)
 // a wad (more portable than reading/writing info.c data directly in a wad).
 //
 // If there are multiple instances of "DEHACKED", we process each, in first
-// to last order (we must reverse the order since they will be stored in
-// last to first order in the chain). Passing NULL as first argument to
-// ProcessDehFile() indicates that the data comes from the lump number
-// indicated by the third argument, instead of from a file.
+// to last order. The lump hash only keeps the last one, so scan the
+// directory for them. Passing NULL as first argument to ProcessDehFile()
+// indicates that the data comes from the lump number indicated by the
+// third argument, instead of from a file.
 
-static void D_ProcessDehInWad(int i)
+static void D_ProcessDehInWads(void)
 {
-    if (i >= 0)
-    {
-        D_ProcessDehInWad(lumpinfo[i].next);
-#ifdef WINDOWS
-        if (!_strnicmp(lumpinfo[i].name, "dehacked", 8) &&
-#else
-        if (!strncasecmp(lumpinfo[i].name, "dehacked", 8) &&
-#endif
-            lumpinfo[i].namespace == ns_global)
+    uint64_t id = W_LumpNameId("dehacked");
+    int i;
+
+    for (i = 0; i < numlumps; i++)
+        if (lumpinfo[i].id == id && lumpinfo[i].namespace == ns_global)
             ProcessDehFile(NULL, D_dehout(), i);
-    }
 }
 
-#define D_ProcessDehInWads() D_ProcessDehInWad(lumpinfo[W_LumpNameHash \
-                                                       ("dehacked") % (unsigned) numlumps].index);
-
 // 
 // Called at exit to display the ENDOOM screen (ENDTEXT in Heretic)
 //
@@ -1170,11 +1162,108 @@ void D_Endoom(void)
 {
     byte* endoom;
 
+    if (!numlumps)      // dedicated server, or quitting before W_Init
+        return;
+
     endoom = W_CacheLumpName("ENDBOOM", PU_STATIC);
 
     I_EndDoom(endoom);
 }
 
+//
+// Startup profile
+//
+// Each phase of startup is timed. Phases on the main thread follow one
+// another through D_StartupPhase; D_BeginPhase and D_EndPhase time the
+// parts of one, and tasks on worker threads, which is why they lock.
+// The total is printed once the game is about to start; -devparm and
+// -startupstats also print each phase, and -startupstats writes them
+// as JSON to the file named after it, if any.
+//
+
+#define MAXPHASES 64
+
+static struct {
+    const char *name;
+    Long64 start, end;
+} phases[MAXPHASES];
+
+static int numphases, mainphase = -1;
+static i_mutex_t *phaselock;
+
+int D_BeginPhase(const char *name)
+{
+    int phase;
+
+    if (!phaselock)             // the first call is on the main thread
+        phaselock = I_CreateMutex();
+
+    I_LockMutex(phaselock);
+    if ((phase = numphases) < MAXPHASES)
+    {
+        phases[phase].name = name;
+        phases[phase].start = phases[phase].end = I_GetTimeUS();
+        numphases++;
+    }
+    I_UnlockMutex(phaselock);
+
+    return phase < MAXPHASES ? phase : -1;
+}
+
+void D_EndPhase(int phase)
+{
+    if (phase >= 0)
+        phases[phase].end = I_GetTimeUS();
+}
+
+void D_StartupPhase(const char *name)
+{
+    D_EndPhase(mainphase);
+    mainphase = name ? D_BeginPhase(name) : -1;
+}
+
+//
+// D_ReportStartup
+// Ends the last phase, and reports them all.
+//
+
+static void D_ReportStartup(void)
+{
+    int p = M_CheckParm("-startupstats"), i;
+    Long64 total = 0;
+
+    D_StartupPhase(NULL);
+
+    for (i = 0; i < numphases; i++)
+        if (phases[i].end > total)
+            total = phases[i].end;
+
+    printf("D_DoomMain: started up in %.1f ms\n", total / 1000.0);
+
+    if (!p && !devparm)
+        return;
+
+    for (i = 0; i < numphases; i++)
+        printf("  %-24s %8.1f %8.1f ms\n", phases[i].name,
+               phases[i].start / 1000.0,
+               (phases[i].end - phases[i].start) / 1000.0);
+
+    if (p && p < myargc - 1 && *myargv[p + 1] != '-')
+    {
+        FILE *f = fopen(myargv[p + 1], "w");
+
+        if (!f)
+            return;
+        fprintf(f, "{\n  \"total_ms\": %.3f,\n  \"phases\": [", total / 1000.0);
+        for (i = 0; i < numphases; i++)
+            fprintf(f, "%s\n    { \"name\": \"%s\", \"start_ms\": %.3f, \"ms\": %.3f }",
+                    i ? "," : "", phases[i].name, phases[i].start / 1000.0,
+                    (phases[i].end - phases[i].start) / 1000.0);
+        fputs("\n  ]\n}\n", f);
+        fclose(f);
+    }
+}
+
 //
 // D_DoomMain
 //
@@ -1186,6 +1275,8 @@ void D_DoomMain(void)
 
     setbuf(stdout, NULL);
 
+    D_StartupPhase("D_DoomMain");
+
     FindResponseFile();         // Append response file arguments to command-line
 
     // killough 10/98: set default savename based on executable's name
@@ -1419,17 +1510,25 @@ void D_DoomMain(void)
     G_ReloadDefaults();    // killough 3/4/98: set defaults just loaded.
     // jff 3/24/98 this sets startskill if it was -1
 
+    // A dedicated server only relays ticcmds, so it stops here, before
+    // any wads, video or sound are touched.
+    if (M_CheckParm("-dedicated"))
+        D_RunServer();
+
     // 1/18/98 killough: Z_Init call moved to i_main.c
 
     // init subsystems
+    D_StartupPhase("V_Init");
     puts("V_Init: allocate screens.");    // killough 11/98: moved down to here
     V_Init();
 
+    D_StartupPhase("W_Init");
     puts("W_Init: Init WADfiles.");
     W_InitMultipleFiles(wadfiles, wadfilesource);
 
     putchar('\n');     // killough 3/6/98: add a newline, by popular demand :)
 
+    D_StartupPhase("D_ProcessDeh");
     D_ProcessDehInWads();      // killough 10/98: now process all deh in wads
 
     D_ProcessDehPreincludes(); // killough 10/98: process preincluded .deh files
@@ -1457,6 +1556,7 @@ void D_DoomMain(void)
                     I_Error("\nThis is not the registered version.");
     }
 
+    D_StartupPhase("V_InitColorTranslation");
     V_InitColorTranslation(); //jff 4/24/98 load color translation lumps
 
     // killough 2/22/98: copyright / "modified game" / SPA banners removed
@@ -1470,30 +1570,42 @@ void D_DoomMain(void)
     if (*startup5) puts(startup5);
     // End new startup strings
 
+    D_StartupPhase("M_Init");
     puts("M_Init: Init miscellaneous info.");
     M_Init();
 
+    D_StartupPhase("R_Init");
     printf("R_Init: Init DOOM refresh daemon - ");
     R_Init();
 
+    D_StartupPhase("P_Init");
     puts("\nP_Init: Init Playloop state.");
     P_Init();
 
+    D_StartupPhase("I_Init");
     puts("I_Init: Setting up machine state.");
     I_Init();
 
+    D_StartupPhase("D_CheckNetGame");
     puts("D_CheckNetGame: Checking network game status.");
     D_CheckNetGame();
 
+    D_StartupPhase("S_Init");
     puts("S_Init: Setting up sound.");
     S_Init(snd_SfxVolume /* *8 */, snd_MusicVolume /* *8*/);
 
+    D_StartupPhase("HU_Init");
     puts("HU_Init: Setting up heads up display.");
     HU_Init();
 
+    D_StartupPhase("ST_Init");
     puts("ST_Init: Init status bar.");
     ST_Init();
 
+    // wait for what R_Init and P_Init left running in the background
+    D_StartupPhase("R_FinishInit");
+    R_FinishInit();
+
     idmusnum = -1; //jff 3/17/98 insure idmus number is blank
 
     // check for a driver that wants intermission stats
@@ -1510,6 +1622,7 @@ void D_DoomMain(void)
     }
 
     // start the apropriate game based on parms
+    D_StartupPhase("G_StartGame");
 
     // killough 12/98: 
     // Support -loadgame with -record and reimplement -recordfrom.
@@ -1575,8 +1688,11 @@ void D_DoomMain(void)
         debugfile = fopen(filename, "w");
     }
 
+    D_StartupPhase("I_InitGraphics");
     I_InitGraphics();
 
+    D_ReportStartup();
+
     atexit(D_QuitNetGame);       // killough
 
     for (;;)
@@ -1609,6 +1725,9 @@ void D_DoomMain(void)
         // Sound mixing for the buffer is snychronous.
         I_UpdateSound();
 
+        // Adopt lumps read in the background.
+        W_UpdatePrefetch();
+
         // Synchronous sound output is explicitly called.
         // Update sound output.
         I_SubmitSound();
@@ -71,4 +71,10 @@ void D_StartTitle(void);
 void D_Endoom(void);
 void D_DoomMain(void);
 
+// Startup profile: D_StartupPhase ends the current phase on the main
+// thread and starts the next; the others time parts of one, or tasks.
+void D_StartupPhase(const char *name);
+int D_BeginPhase(const char *name);
+void D_EndPhase(int phase);
+
 #endif
@@ -36,12 +36,7 @@
 #include "i_video.h"
 #include "i_net.h"
 #include "g_game.h"
-
-#define NCMD_EXIT               0x80000000
-#define NCMD_RETRANSMIT         0x40000000
-#define NCMD_SETUP              0x20000000
-#define NCMD_KILL               0x10000000      /* kill game */
-#define NCMD_CHECKSUM           0x0fffffff
+#include "m_argv.h"
 
 doomcom_t*      doomcom;        
 doomdata_t*     netbuffer;             // points inside doomcom
@@ -55,17 +50,13 @@ doomdata_t*     netbuffer;             // points inside doomcom
 //
 // a gametic cannot be run until nettics[] > gametic for all players
 //
-#define RESENDCOUNT     10
-#define PL_DRONE        0x80    /* bit flag in doomdata->player */
-
 ticcmd_t localcmds[BACKUPTICS];
 
 ticcmd_t netcmds[MAXPLAYERS][BACKUPTICS];
 int      nettics[MAXNETNODES];
 boolean  nodeingame[MAXNETNODES];      // set false as nodes leave game
 boolean  remoteresend[MAXNETNODES];    // set when local needs tics
-int      resendto[MAXNETNODES];        // set when remote needs tics
-int      resendcount[MAXNETNODES];
+int      resendto[MAXNETNODES];        // oldest tic remote has not acked
 
 int      nodeforplayer[MAXPLAYERS];
 
@@ -85,13 +76,27 @@ doomdata_t      reboundstore;
 
 extern int  key_escape;                // phares
 
+netstats_t  netstats;
+static boolean shownetstats;           // -netstats
+
+
+//
+// NetbufferCmds
+// Number of ticcmds in the packet; relay packets hold one per player
+//
+int NetbufferCmds (void)
+{
+  if (netbuffer->player & PL_RELAY && !(netbuffer->checksum & NCMD_SETUP))
+    return netbuffer->numtics * (netbuffer->player & PL_PLAYERS);
+  return netbuffer->numtics;
+}
 
 //
 //
 //
 int NetbufferSize (void)
 {
-  return (intptr_t)&(((doomdata_t *)0)->cmds[netbuffer->numtics]);
+  return (intptr_t)&(((doomdata_t *)0)->cmds[NetbufferCmds()]);
 }
 
 //
@@ -145,6 +150,8 @@ void HSendPacket
 (int   node,
  int   flags)
 {
+  // flags first: they decide how many ticcmds the packet holds
+  netbuffer->checksum = flags;
   netbuffer->checksum = NetbufferChecksum () | flags;
 
   if (!node)
@@ -289,9 +296,18 @@ void GetPackets (void)
     // check for exiting the game
     if (netbuffer->checksum & NCMD_EXIT)
     {
-      if (!nodeingame[netnode])
-        continue;
-      nodeingame[netnode] = false;
+      // a relay server reports departures for its players and stays
+      if (doomcom->relay)
+      {
+        if (netconsole >= MAXPLAYERS || !playeringame[netconsole])
+          continue;
+      }
+      else
+      {
+        if (!nodeingame[netnode])
+          continue;
+        nodeingame[netnode] = false;
+      }
       playeringame[netconsole] = false;
       strcpy (exitmsg, "Player 1 left the game");
       exitmsg[7] += netconsole;
@@ -305,19 +321,24 @@ void GetPackets (void)
     if (netbuffer->checksum & NCMD_KILL)
       I_Error ("Killed by network driver");
 
-    nodeforplayer[netconsole] = netnode;
+    if (!(netbuffer->player & PL_RELAY))
+      nodeforplayer[netconsole] = netnode;
 
-    // check for retransmit request
-    if ( resendcount[netnode] <= 0 
-         && (netbuffer->checksum & NCMD_RETRANSMIT) )
+    // Every packet acknowledges the tics its sender has received from
+    // us, so the next packet to that node starts at the oldest tic it
+    // still lacks. Acks only move forward; stale or reordered packets
+    // cannot rewind the window, and a retransmit request is just an
+    // ack sent while the remote is stalled.
     {
-      resendto[netnode] = ExpandTics(netbuffer->retransmitfrom);
-      if (debugfile)
-        fprintf(debugfile,"retransmit from %i\n", resendto[netnode]);
-      resendcount[netnode] = RESENDCOUNT;
+      int acked = ExpandTics(netbuffer->retransmitfrom);
+
+      if (acked > resendto[netnode] && acked <= maketic)
+      {
+        resendto[netnode] = acked;
+        if (debugfile && netbuffer->checksum & NCMD_RETRANSMIT)
+          fprintf(debugfile,"retransmit from %i\n", acked);
+      }
     }
-    else
-      resendcount[netnode]--;
 
     // check for out of order / duplicated packet           
     if (realend == nettics[netnode])
@@ -351,6 +372,26 @@ void GetPackets (void)
       remoteresend[netnode] = false;
       
       start = nettics[netnode] - realstart;               
+
+      if (netbuffer->player & PL_RELAY)
+      {
+        // one ticcmd per player per tic; our own come back via node 0
+        int numplayers = netbuffer->player & PL_PLAYERS;
+
+        src = &netbuffer->cmds[start * numplayers];
+
+        while (nettics[netnode] < realend)
+        {
+          int p;
+
+          for (p=0 ; p<numplayers ; p++, src++)
+            if (p != consoleplayer && p < MAXPLAYERS)
+              netcmds[p][nettics[netnode]%BACKUPTICS] = *src;
+          nettics[netnode]++;
+        }
+        continue;
+      }
+
       src = &netbuffer->cmds[start];
 
       while (nettics[netnode] < realend)
@@ -422,26 +463,27 @@ void NetUpdate (void)
   for (i=0 ; i<doomcom->numnodes ; i++)
     if (nodeingame[i])
     {
-      netbuffer->starttic = realstart = resendto[i];
+      // Resend every tic the node has not acknowledged yet, so a lost
+      // packet is covered by the next one instead of stalling the game
+      // for a retransmit round trip. -extratic still forces at least
+      // one old tic along even when everything has been acked.
+      realstart = resendto[i];
+      if (realstart > maketic - doomcom->extratics)
+        realstart = maketic - doomcom->extratics;
+      if (realstart < maketic - BACKUPTICS)
+        realstart = maketic - BACKUPTICS;   // older tics left the buffer
+      if (realstart < 0)
+        realstart = 0;
+
+      netbuffer->starttic = realstart;
       netbuffer->numtics = maketic - realstart;
-      if (netbuffer->numtics > BACKUPTICS)
-        I_Error ("NetUpdate: netbuffer->numtics > BACKUPTICS");
-
-      resendto[i] = maketic - doomcom->extratics;
 
       for (j=0 ; j< netbuffer->numtics ; j++)
         netbuffer->cmds[j] = localcmds[(realstart+j)%BACKUPTICS];
-                                  
-      if (remoteresend[i])
-      {
-        netbuffer->retransmitfrom = nettics[i];
-        HSendPacket (i, NCMD_RETRANSMIT);
-      }
-      else
-      {
-        netbuffer->retransmitfrom = 0;
-        HSendPacket (i, 0);
-      }
+
+      // always acknowledge what we have from this node
+      netbuffer->retransmitfrom = nettics[i];
+      HSendPacket (i, remoteresend[i] ? NCMD_RETRANSMIT : 0);
     }
   
   // listen for other packets
@@ -473,6 +515,69 @@ void CheckAbort (void)
 }
 
 
+//
+// D_WriteSetupPacket
+// Fills netbuffer with the game settings. A relay server also tells
+// each client which player it is and how many players there are, in
+// the last two bytes of the ticcmd area behind the game options.
+//
+#define SETUP_PLAYER     (sizeof netbuffer->cmds - 2)
+#define SETUP_NUMPLAYERS (sizeof netbuffer->cmds - 1)
+
+void D_WriteSetupPacket (int player, int numplayers)
+{
+  netbuffer->retransmitfrom = startskill;
+  if (deathmatch)
+    netbuffer->retransmitfrom |= (deathmatch<<6);
+  if (nomonsters)
+    netbuffer->retransmitfrom |= 0x20;
+  if (respawnparm)
+    netbuffer->retransmitfrom |= 0x10;
+  netbuffer->starttic = (startepisode-1) * 64 + startmap;
+  netbuffer->player = VERSION;
+
+  // killough 5/2/98: Make sure we have enough room for options
+  // If not, either GAME_OPTION_SIZE needs to be reduced, or
+  // BACKUPTICS needs to increased, or we need to send several
+  // packets instead of one.
+
+  if (GAME_OPTION_SIZE > SETUP_PLAYER)
+    I_Error("D_WriteSetupPacket: GAME_OPTION_SIZE"
+            " too large w.r.t. BACKUPTICS");
+
+  G_WriteOptions((byte *) netbuffer->cmds);    // killough 12/98
+
+  ((byte *) netbuffer->cmds)[SETUP_PLAYER] = player;
+  ((byte *) netbuffer->cmds)[SETUP_NUMPLAYERS] = numplayers;
+
+  // killough 5/2/98: Always write the maximum number of tics.
+  netbuffer->numtics = BACKUPTICS;
+}
+
+static void D_ReadSetupPacket (void)
+{
+  printf("Received %d %d\n",
+         netbuffer->retransmitfrom,netbuffer->starttic);
+  startskill = netbuffer->retransmitfrom & 15;
+  deathmatch = (netbuffer->retransmitfrom & 0xc0) >> 6;
+  nomonsters = (netbuffer->retransmitfrom & 0x20) > 0;
+  respawnparm = (netbuffer->retransmitfrom & 0x10) > 0;
+  startmap = netbuffer->starttic & 0x3f;
+  startepisode = 1 + (netbuffer->starttic >> 6);
+
+  // killough 5/2/98: Read the options
+  //
+  // killough 11/98: NOTE: this code produces no inconsistency errors.
+  // However, TeamTNT's code =does= produce inconsistencies. Go figur.
+
+  G_ReadOptions((byte *) netbuffer->cmds);
+
+  // killough 12/98: removed obsolete compatibility flag and
+  // removed printf()'s, since there are too many options to
+  // make it manageable. It will be understood that the main
+  // player controls the sync-critical options.
+}
+
 //
 // D_ArbitrateNetStart
 //
@@ -483,6 +588,37 @@ void D_ArbitrateNetStart (void)
 
   autostart = true;
   memset (gotinfo,0,sizeof(gotinfo));
+
+  if (doomcom->relay)
+  {
+    // announce ourselves to the server until it assigns us a player
+    printf("joining relay server...\n");
+    while (1)
+    {
+      CheckAbort ();
+      netbuffer->player = PL_PLAYERS;
+      netbuffer->numtics = 0;
+      HSendPacket (1, NCMD_SETUP);
+
+      while (HGetPacket ())
+        if (doomcom->remotenode == 1 && netbuffer->checksum & NCMD_SETUP)
+        {
+          D_ReadSetupPacket ();
+          doomcom->consoleplayer = ((byte *) netbuffer->cmds)[SETUP_PLAYER];
+          doomcom->numplayers = ((byte *) netbuffer->cmds)[SETUP_NUMPLAYERS];
+          if (doomcom->consoleplayer >= doomcom->numplayers ||
+              doomcom->numplayers > MAXPLAYERS)
+            I_Error("D_ArbitrateNetStart: bad player %d of %d from server",
+                    doomcom->consoleplayer + 1, doomcom->numplayers);
+          consoleplayer = displayplayer = doomcom->consoleplayer;
+
+          // everyone else's ticcmds arrive through the server
+          for (i=0 ; i<MAXPLAYERS ; i++)
+            nodeforplayer[i] = i != consoleplayer;
+          return;
+        }
+    }
+  }
       
   if (doomcom->consoleplayer)
   {
@@ -495,27 +631,7 @@ void D_ArbitrateNetStart (void)
           continue;
       if (netbuffer->checksum & NCMD_SETUP)
       {
-        printf("Received %d %d\n",
-	       netbuffer->retransmitfrom,netbuffer->starttic);
-        startskill = netbuffer->retransmitfrom & 15;
-        deathmatch = (netbuffer->retransmitfrom & 0xc0) >> 6;
-        nomonsters = (netbuffer->retransmitfrom & 0x20) > 0;
-        respawnparm = (netbuffer->retransmitfrom & 0x10) > 0;
-        startmap = netbuffer->starttic & 0x3f;
-        startepisode = 1 + (netbuffer->starttic >> 6);
-
-        // killough 5/2/98: Read the options
-	//
-	// killough 11/98: NOTE: this code produces no inconsistency errors.
-	// However, TeamTNT's code =does= produce inconsistencies. Go figur.
-
-        G_ReadOptions((char *) netbuffer->cmds);
-
-	// killough 12/98: removed obsolete compatibility flag and
-	// removed printf()'s, since there are too many options to
-	// make it manageable. It will be understood that the main
-	// player controls the sync-critical options.
-
+        D_ReadSetupPacket ();
         return;
       }
     }
@@ -530,30 +646,7 @@ void D_ArbitrateNetStart (void)
       CheckAbort ();
       for (i=0 ; i<doomcom->numnodes ; i++)
       {
-        netbuffer->retransmitfrom = startskill;
-        if (deathmatch)
-          netbuffer->retransmitfrom |= (deathmatch<<6);
-        if (nomonsters)
-          netbuffer->retransmitfrom |= 0x20;
-        if (respawnparm)
-          netbuffer->retransmitfrom |= 0x10;
-        netbuffer->starttic = (startepisode-1) * 64 + startmap;
-        netbuffer->player = VERSION;
-
-        // killough 5/2/98: Make sure we have enough room for options
-        // If not, either GAME_OPTION_SIZE needs to be reduced, or
-        // BACKUPTICS needs to increased, or we need to send several
-        // packets instead of one.
-
-        if (GAME_OPTION_SIZE > sizeof netbuffer->cmds)
-          I_Error("D_ArbitrateNetStart: GAME_OPTION_SIZE"
-                  " too large w.r.t. BACKUPTICS");
-
-        G_WriteOptions((char *) netbuffer->cmds);    // killough 12/98
-
-        // killough 5/2/98: Always write the maximum number of tics.
-        netbuffer->numtics = BACKUPTICS;
-
+        D_WriteSetupPacket (0, doomcom->numplayers);
         HSendPacket (i, NCMD_SETUP);
       }
 
@@ -621,6 +714,24 @@ void D_CheckNetGame (void)
       
   printf ("player %i of %i (%i nodes)\n",
            consoleplayer+1, doomcom->numplayers, doomcom->numnodes);
+
+  shownetstats = netgame && M_CheckParm ("-netstats");
+}
+
+//
+// D_PrintNetStats
+//
+void D_PrintNetStats (void)
+{
+  printf ("netstats: sent %i packets (%i bytes), received %i (%i bytes),"
+          " %i dropped\n",
+          netstats.packetssent, netstats.bytessent,
+          netstats.packetsreceived, netstats.bytesreceived,
+          netstats.packetsdropped);
+  printf ("netstats: %i tics run, %i stalls (%i tics waiting),"
+          " %i slowdowns, %i skips\n",
+          gametic, netstats.stalls, netstats.stalltics,
+          netstats.slowdowns, netstats.skips);
 }
 
 
@@ -635,6 +746,9 @@ void D_QuitNetGame (void)
       
   if (debugfile)
       fclose (debugfile);
+
+  if (shownetstats)
+      D_PrintNetStats ();
               
   if (!netgame || !usergame || consoleplayer == -1 || demoplayback)
       return;
@@ -671,6 +785,7 @@ void TryRunTics (void)
   int         availabletics;
   int         counts;
   int         numplaying;
+  boolean     stalled;
   
   // get real tics            
   entertic = I_GetTime ()/ticdup;
@@ -727,6 +842,7 @@ void TryRunTics (void)
       if (nettics[0] <= nettics[nodeforplayer[i]])
       {
         gametime--;
+        netstats.slowdowns++;
         // printf ("-");
       }
       frameskip[frameon&3] = (oldnettics > nettics[nodeforplayer[i]]);
@@ -734,12 +850,17 @@ void TryRunTics (void)
       if (frameskip[0] && frameskip[1] && frameskip[2] && frameskip[3])
       {
         skiptics = 1;
+        netstats.skips++;
         // printf ("+");
       }
     }
   }// demoplayback
       
   // wait for new tics if needed
+  stalled = lowtic < gametic/ticdup + counts;
+  if (stalled)
+    netstats.stalls++;
+
   while (lowtic < gametic/ticdup + counts)    
   {
     NetUpdate ();   
@@ -755,10 +876,14 @@ void TryRunTics (void)
     // don't stay in here forever -- give the menu a chance to work
     if (I_GetTime ()/ticdup - entertic >= 20)
     {
+      netstats.stalltics += I_GetTime ()/ticdup - entertic;
       M_Ticker ();
       return;
     } 
   }
+
+  if (stalled)
+    netstats.stalltics += I_GetTime ()/ticdup - entertic;
   
   // run the count * ticdup dics
   while (counts--)
@@ -72,6 +72,21 @@ typedef struct
     ticcmd_t            cmds[BACKUPTICS];
 } doomdata_t;
 
+// doomdata_t.checksum flags
+#define NCMD_EXIT               0x80000000
+#define NCMD_RETRANSMIT         0x40000000
+#define NCMD_SETUP              0x20000000
+#define NCMD_KILL               0x10000000      /* kill game */
+#define NCMD_CHECKSUM           0x0fffffff
+
+// doomdata_t.player flags
+#define PL_DRONE                0x80
+#define PL_RELAY                0x40    /* sent by a dedicated server */
+#define PL_PLAYERS              0x0f
+
+// A relay packet (PL_RELAY) carries the ticcmds of every player for
+// each tic, (player & PL_PLAYERS) of them per tic in player order.
+
 //
 // Startup packet difference
 // SG: 4/12/98
@@ -159,11 +174,30 @@ typedef struct
     // 1 = drone
     short               drone;          
 
+    // 1 = node 1 is a dedicated relay server rather than a player
+    short               relay;
+
     // The packet data to be sent.
     doomdata_t          data;
     
 } doomcom_t;
 
+// Netcode counters, printed on exit with -netstats
+typedef struct
+{
+    int packetssent, packetsreceived;
+    int bytessent, bytesreceived;       // payload only, no UDP/IP headers
+    int packetsdropped;                 // lost on purpose by -netsim
+    int stalls;                         // TryRunTics waited for tics
+    int stalltics;                      // realtime tics spent waiting
+    int slowdowns;                      // gametime held back a tic
+    int skips;                          // skiptics set to catch up
+} netstats_t;
+
+extern netstats_t netstats;
+
+void D_PrintNetStats (void);
+
 // Create any new ticcmds and broadcast to other players.
 void NetUpdate (void);
 
@@ -174,4 +208,15 @@ void D_QuitNetGame (void);
 //? how many ticks to run?
 void TryRunTics (void);
 
+// Packet primitives, shared with the dedicated server
+int NetbufferCmds (void);
+int NetbufferSize (void);
+int ExpandTics (int low);
+void HSendPacket (int node, int flags);
+boolean HGetPacket (void);
+void D_WriteSetupPacket (int player, int numplayers);
+
+// Runs the headless relay server (-dedicated); never returns
+void D_RunServer (void);
+
 #endif
@@ -0,0 +1,263 @@
+// Emacs style mode select   -*- C++ -*-
+//-----------------------------------------------------------------------------
+//
+//  This program is free software; you can redistribute it and/or
+//  modify it under the terms of the GNU General Public License
+//  as published by the Free Software Foundation; either version 2
+//  of the License, or (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+//  02111-1307, USA.
+//
+// DESCRIPTION:
+//      Headless relay server for netgames (-dedicated <players>).
+//
+// In a peer game every node sends its ticcmds to every other node.
+// Clients started with -connect <server> talk to the server only: it
+// collects each player's ticcmds, and once all players' commands for a
+// tic are in, sends every client one relay packet (PL_RELAY) holding
+// the whole tic. Each packet repeats the most recent tics the client
+// has not acknowledged, the same way d_net.c does for peers.
+//
+// The server runs no game, renderer or sound. It only needs the
+// command line and config to hand out the game settings.
+//
+//-----------------------------------------------------------------------------
+
+#include "doomstat.h"
+#include "m_argv.h"
+#include "i_system.h"
+#include "i_net.h"
+#include "d_net.h"
+
+// Node n plays player n-1; node 0 is the server itself.
+
+#define RELAYTICS       64      /* ticcmds kept per player */
+#define EXITNOTIFY      4       /* departure packets sent per client */
+#define SETUPRESEND     4       /* tics between setup packets */
+
+extern int      nettics[MAXNETNODES];
+extern boolean  nodeingame[MAXNETNODES];
+extern int      resendto[MAXNETNODES];
+extern int      maketic;
+
+static ticcmd_t relaycmds[MAXPLAYERS][RELAYTICS];
+static boolean  started[MAXNETNODES];   // node has sent its first ticcmds
+static boolean  stalled[MAXNETNODES];   // node asked for a retransmit
+static int      sentto[MAXNETNODES];    // first tic never sent to node
+static int      exitnotify[MAXPLAYERS];
+static int      numplayers;
+static int      servertic;              // tics complete for all players
+static int      oldesttic;              // oldest tic a client may still need
+
+//
+// D_ServerGetPackets
+// Stores incoming ticcmds and acks, and notes departures.
+//
+static void D_ServerGetPackets(void)
+{
+  while (HGetPacket())
+  {
+    int node = doomcom->remotenode, player = node - 1;
+    int realstart, realend, acked, tic;
+
+    if (node < 1 || node > numplayers)
+      continue;
+
+    if (netbuffer->checksum & NCMD_SETUP)
+      continue;           // join request, I_NetCmd registered the node
+
+    if ((netbuffer->player & ~PL_DRONE) != player)
+      continue;
+
+    if (netbuffer->checksum & NCMD_EXIT)
+    {
+      if (nodeingame[node])
+      {
+        nodeingame[node] = false;
+        exitnotify[player] = EXITNOTIFY;
+        printf("D_RunServer: player %i left\n", node);
+      }
+      continue;
+    }
+
+    if (!started[node])
+    {
+      started[node] = nodeingame[node] = true;
+      printf("D_RunServer: player %i of %i in the game\n", node, numplayers);
+    }
+
+    if (!nodeingame[node])
+      continue;
+
+    // a stalled client has lost more than the redundant tics cover
+    acked = ExpandTics(netbuffer->retransmitfrom);
+    if (acked > resendto[node] && acked <= servertic)
+      resendto[node] = acked;
+    stalled[node] = (netbuffer->checksum & NCMD_RETRANSMIT) != 0;
+    if (stalled[node] && sentto[node] > resendto[node])
+      sentto[node] = resendto[node];
+
+    realstart = ExpandTics(netbuffer->starttic);
+    realend = realstart + netbuffer->numtics;
+
+    // missed tics are resent from our ack; also never overwrite
+    // ticcmds that a lagging client may still need
+    if (realstart > nettics[node] || realend <= nettics[node] ||
+        realend > oldesttic + RELAYTICS)
+      continue;
+
+    for (tic = nettics[node]; tic < realend; tic++)
+      relaycmds[player][tic % RELAYTICS] = netbuffer->cmds[tic - realstart];
+    nettics[node] = realend;
+  }
+}
+
+//
+// D_ServerSend
+// Sends node the newest complete tics, plus as many older ones it has
+// not acknowledged as fit into one packet.
+//
+static void D_ServerSend(int node)
+{
+  int maxtics = BACKUPTICS / numplayers;
+  int start, end, tic, p;
+  ticcmd_t *cmd = netbuffer->cmds;
+
+  end = servertic;
+  start = end - maxtics;
+  if (start < resendto[node])
+    start = resendto[node];
+  if (start > sentto[node])       // never skip tics not sent yet
+  {
+    start = sentto[node];
+    end = start + maxtics;
+  }
+  if (sentto[node] < end)
+    sentto[node] = end;
+
+  netbuffer->player = PL_RELAY | numplayers;
+  netbuffer->starttic = start;
+  netbuffer->numtics = end - start;
+  netbuffer->retransmitfrom = nettics[node];
+
+  for (tic = start; tic < end; tic++)
+    for (p = 0; p < numplayers; p++)
+    {
+      static const ticcmd_t emptycmd;
+      *cmd++ = nodeingame[p + 1] ? relaycmds[p][tic % RELAYTICS] : emptycmd;
+    }
+
+  HSendPacket(node, 0);
+}
+
+//
+// D_ServerUpdate
+// Works out how far all players have got. Returns false once every
+// player has joined and left again.
+//
+static boolean D_ServerUpdate(void)
+{
+  int node, lowtic = D_MAXINT, oldest = D_MAXINT, playing = 0;
+
+  for (node = 1; node <= numplayers; node++)
+    if (!started[node])
+      lowtic = oldest = 0;
+    else
+      if (nodeingame[node])
+      {
+        playing++;
+        if (nettics[node] < lowtic)
+          lowtic = nettics[node];
+        if (resendto[node] < oldest)
+          oldest = resendto[node];
+      }
+
+  if (!playing)
+    return lowtic != D_MAXINT;
+
+  servertic = lowtic;
+  oldesttic = oldest;
+  return true;
+}
+
+//
+// D_RunServer
+//
+void D_RunServer(void)
+{
+  int p = M_CheckParm("-dedicated");
+  int lasttime = -1, lastservertic = -1;
+
+  numplayers = p < myargc-1 && myargv[p+1][0] != '-' ?
+    atoi(myargv[p+1]) : MAXPLAYERS;
+  if (numplayers < 1 || numplayers > MAXPLAYERS ||
+      numplayers > MAXNETNODES-1)
+    I_Error("D_RunServer: -dedicated takes 1 to %i players", MAXPLAYERS);
+
+  I_InitNetServer();
+  netbuffer = &doomcom->data;
+  I_NetAcceptNodes(numplayers + 1);
+
+  printf("D_RunServer: waiting for %i players\n", numplayers);
+
+  while (D_ServerUpdate())
+  {
+    int now = I_GetTime_RealTime();
+    int node;
+
+    // keep ExpandTics centered on the tics in flight
+    maketic = servertic;
+
+    D_ServerGetPackets();
+    if (doomcom->numnodes > numplayers)
+      I_NetAcceptNodes(0);
+
+    if (now == lasttime && servertic == lastservertic)
+    {
+      I_Sleep(1);
+      continue;
+    }
+    lasttime = now;
+    lastservertic = servertic;
+
+    for (node = 1; node < doomcom->numnodes; node++)
+      if (!started[node])
+      {
+        // everyone is here; hand out player numbers and settings
+        if (doomcom->numnodes > numplayers && !(now % SETUPRESEND))
+        {
+          D_WriteSetupPacket(node - 1, numplayers);
+          HSendPacket(node, NCMD_SETUP);
+        }
+      }
+      else
+        if (nodeingame[node])
+        {
+          for (p = 0; p < numplayers; p++)
+            if (exitnotify[p])
+            {
+              netbuffer->player = p;
+              netbuffer->numtics = 0;
+              HSendPacket(node, NCMD_EXIT);
+            }
+          D_ServerSend(node);
+        }
+
+    for (p = 0; p < numplayers; p++)
+      if (exitnotify[p])
+        exitnotify[p]--;
+  }
+
+  puts("D_RunServer: all players have left");
+  if (M_CheckParm("-netstats"))
+    D_PrintNetStats();
+  exit(0);
+}
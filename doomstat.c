@@ -67,3 +67,6 @@ int default_player_bobbing;  // killough 3/1/98: make local to each game
 
 int monsters_remember;          // killough 3/1/98
 int default_monsters_remember;
+
+int monster_dormancy;           // park idle monsters far from players
+int default_monster_dormancy;
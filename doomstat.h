@@ -283,6 +283,9 @@ extern int default_variable_friction;
 extern int monsters_remember;                          // killough 3/1/98
 extern int default_monsters_remember;
 
+extern int monster_dormancy;      // park idle monsters far from players
+extern int default_monster_dormancy;
+
 extern int weapon_recoil;          // weapon recoil    // phares
 extern int default_weapon_recoil;
 
@@ -38,6 +38,9 @@
 #include "m_misc.h"
 #include "m_menu.h"
 #include "m_random.h"
+#include "m_lz.h"
+#include "i_system.h"
+#include "i_video.h"
 #include "p_setup.h"
 #include "p_saveg.h"
 #include "p_tick.h"
@@ -173,6 +176,7 @@ int     key_weapon8;                                                //    |
 int     key_weapon9;                                                // phares
 
 int     key_screenshot;             // killough 2/22/98: screenshot key
+int     key_rewind;                 // steps back through the rewind ring
 int     key_setup;                  // killough 10/98: shortcut to setup menu
 
 int     mousebfire;
@@ -489,6 +493,9 @@ void G_BuildTiccmd(ticcmd_t* cmd)
     }
 }
 
+static boolean G_RewindAllowed(void);
+static void G_ClearRewind(void);
+
 //
 // G_DoLoadLevel
 //
@@ -582,6 +589,8 @@ static void G_DoLoadLevel(void)
    }
 
   P_SetupLevel (gameepisode, gamemap, 0, gameskill);
+  G_ClearRewind();                  // snapshots belong to the old level
+  WI_Prefetch(gameepisode-1);       // read while the level is played
   displayplayer = consoleplayer;    // view the guy you are playing
   gameaction = ga_nothing;
 
@@ -690,8 +699,14 @@ boolean G_Responder(event_t* ev)
       if (ev->data1 == key_pause)           // phares
 	sendpause = true;
       else
-	if (ev->data1 <NUMKEYS)
-	  gamekeydown[ev->data1] = true;
+	if (ev->data1 == key_rewind && G_RewindAllowed())
+	  {
+	    if (gameaction == ga_nothing)   // rewind on the next tic
+	      gameaction = ga_rewind;
+	  }
+	else
+	  if (ev->data1 <NUMKEYS)
+	    gamekeydown[ev->data1] = true;
       return true;    // eat key down events
 
     case ev_keyup:
@@ -1067,7 +1082,10 @@ static void G_DoPlayDemo(void)
 #define VERSIONSIZE   16
 
 // killough 2/22/98: version id string format for savegames
-#define VERSIONID "BoomVer %d"
+// SAVEVERSION goes up whenever an archived structure changes its layout
+// while VERSION stays the same, as mobj_t did for monster_dormancy.
+#define VERSIONID "BoomVer %d.%d"
+#define SAVEVERSION 1
 
 static char savename[PATH_MAX+1];
 
@@ -1122,14 +1140,218 @@ void G_SaveGame(int slot, char *description)
   sendsave = true;
 }
 
-// Check for overrun and realloc if necessary -- Lee Killough 1/22/98
+//
+// Background savegame writer
+//
+// Savegames are serialized on the game thread into a buffer sized up front
+// by G_SaveGameSize(), then handed to a worker thread which compresses and
+// writes them while the game keeps running. Compressed files keep the
+// description uncompressed at the front, so that M_ReadSaveStrings() still
+// works, followed by SAVEGAME_MAGIC, the uncompressed length of the rest of
+// the savegame, and a run of blocks, each prefixed by its compressed and
+// uncompressed sizes. A block of zero length ends the stream.
+//
+
+#define SAVEGAME_MAGIC "\x1aRBZ"
+#define SAVEGAME_BLOCK (256*1024)
+
+static struct {
+  i_thread_t *thread;         // worker, NULL when no write is in flight
+  i_mutex_t  *lock;           // protects done, ok and err
+  boolean    done, ok;
+  int        err;             // errno of a failed write
+  byte       *buffer;         // serialized game, owned by the worker
+  size_t     length;
+  char       name[PATH_MAX+1];
+} savewriter;
+
+static void G_PutLong(byte *p, unsigned v)
+{
+  p[0] = v, p[1] = v >> 8, p[2] = v >> 16, p[3] = v >> 24;
+}
+
+static unsigned G_GetLong(const byte *p)
+{
+  return p[0] | p[1] << 8 | p[2] << 16 | (unsigned) p[3] << 24;
+}
+
+// Writes the compressed savegame, using block to compress into.
+
+static boolean G_WriteSaveGame(FILE *fp, void *data)
+{
+  byte *block = data;
+  const byte *src = savewriter.buffer + SAVESTRINGSIZE;
+  size_t left = savewriter.length - SAVESTRINGSIZE;
+  byte header[8];
+  boolean ok;
+
+  memcpy(header, SAVEGAME_MAGIC, 4);
+  G_PutLong(header+4, left);
+  ok = fwrite(savewriter.buffer, 1, SAVESTRINGSIZE, fp) == SAVESTRINGSIZE
+    && fwrite(header, 1, sizeof header, fp) == sizeof header;
+
+  while (ok)
+    {
+      size_t raw = left < SAVEGAME_BLOCK ? left : SAVEGAME_BLOCK;
+      size_t packed = raw ? M_LZCompress(src, raw, block+8) : 0;
+
+      G_PutLong(block, packed);
+      G_PutLong(block+4, raw);
+      ok = fwrite(block, 1, 8+packed, fp) == 8+packed;
+      if (!raw)
+        break;
+      src += raw;
+      left -= raw;
+    }
+
+  return ok;
+}
+
+// Worker thread body. Must not touch the zone heap or game state.
+// The old savegame is only replaced once the new one is complete.
+
+static int G_SaveGameWriter(void *unused)
+{
+  byte *block = (malloc)(8 + M_LZBound(SAVEGAME_BLOCK));
+  boolean ok;
+  int err;
+
+  errno = 0;
+  ok = block && M_WriteFileAtomic(savewriter.name, G_WriteSaveGame, block);
+  err = errno;
+  (free)(block);
+
+  I_LockMutex(savewriter.lock);
+  savewriter.ok = ok;
+  savewriter.err = err;
+  savewriter.done = true;
+  I_UnlockMutex(savewriter.lock);
+  return 0;
+}
+
+// Reaps a finished background write and reports its result. If wait is
+// true, blocks until the write in flight (if any) completes.
+
+static void G_FinishSaveGame(boolean wait)
+{
+  boolean done;
+
+  if (!savewriter.thread)
+    return;
+
+  I_LockMutex(savewriter.lock);
+  done = savewriter.done;
+  I_UnlockMutex(savewriter.lock);
+
+  if (!done && !wait)
+    return;
+
+  I_WaitThread(savewriter.thread);
+  savewriter.thread = NULL;
+  Z_Free(savewriter.buffer);
+  savewriter.buffer = NULL;
+
+  if (savewriter.ok)
+    players[consoleplayer].message = s_GGSAVED;  // Ty 03/27/98 - externalized
+  else
+    doom_printf("%s", savewriter.err ? strerror(savewriter.err) :
+                "Could not save game: Error unknown");
+}
+
+// Called before exiting, or before anything that reads savegames back
+
+void G_WaitSaveGame(void)
+{
+  G_FinishSaveGame(true);
+}
+
+//
+// G_ReadSaveGame
+//
+// Reads a savegame into savebuffer and returns its length. Compressed
+// savegames are decompressed block by block as they are read, so only
+// one compressed block is ever held in memory. Uncompressed savegames
+// from older versions are read as they are.
+//
+
+static int G_ReadSaveGame(const char *name)
+{
+  byte header[SAVESTRINGSIZE+8], *p, *block;
+  size_t raw, left;
+  boolean ok = false;
+  long filesize;
+  FILE *fp;
+
+  G_WaitSaveGame();       // may be the very file still being written
+
+  if (!(fp = fopen(name, "rb")))
+    return M_ReadFile(name, &savebuffer);     // reports the error
+
+  if (fread(header, 1, sizeof header, fp) != sizeof header ||
+      memcmp(header+SAVESTRINGSIZE, SAVEGAME_MAGIC, 4))
+    {
+      fclose(fp);
+      return M_ReadFile(name, &savebuffer);
+    }
+
+  // A block never expands more than 255 times, so a longer stated
+  // length is a damaged header, and not worth allocating for
+  raw = left = G_GetLong(header+SAVESTRINGSIZE+4);
+  if (fseek(fp, 0, SEEK_END) || (filesize = ftell(fp)) < 0 ||
+      fseek(fp, sizeof header, SEEK_SET) || raw / 256 > (size_t) filesize)
+    {
+      fclose(fp);
+      I_Error("Corrupt savegame %s", name);
+    }
+
+  savebuffer = Z_Malloc(SAVESTRINGSIZE + raw, PU_STATIC, 0);
+  memcpy(savebuffer, header, SAVESTRINGSIZE);
+  p = savebuffer + SAVESTRINGSIZE;
+  block = Z_Malloc(M_LZBound(SAVEGAME_BLOCK), PU_STATIC, 0);
+
+  I_BeginRead();
+  for (;;)
+    {
+      byte sizes[8];
+      size_t packed, n;
+
+      if (fread(sizes, 1, sizeof sizes, fp) != sizeof sizes)
+        break;
+      packed = G_GetLong(sizes);
+      n = G_GetLong(sizes+4);
+      if (!n)
+        {
+          ok = !left;
+          break;
+        }
+      if (n > left || n > SAVEGAME_BLOCK ||
+          packed > M_LZBound(SAVEGAME_BLOCK) ||
+          fread(block, 1, packed, fp) != packed ||
+          M_LZDecompress(block, packed, p, n) != n)
+        break;
+      p += n;
+      left -= n;
+    }
+  I_EndRead();
+
+  fclose(fp);
+  Z_Free(block);
+
+  if (!ok)
+    I_Error("Corrupt savegame %s", name);
+
+  return SAVESTRINGSIZE + raw;
+}
+
+// Check for overrun -- Lee Killough 1/22/98
+//
+// Savegame buffers are sized up front, by G_SaveGameSize() or the rewind
+// ring, so this no longer grows the buffer; it only verifies the estimate.
+
 void CheckSaveGame(size_t size)
 {
-  size_t pos = save_p - savebuffer;
-  size += 1024;  // breathing room
-  if (pos+size > savegamesize)
-    save_p = (savebuffer = realloc(savebuffer,
-           savegamesize += (size+1023) & ~1023)) + pos;
+  if ((size_t)(save_p - savebuffer) + size > savegamesize)
+    I_Error("CheckSaveGame: savegame buffer overrun");
 }
 
 // killough 3/22/98: form savegame name in one location
@@ -1179,17 +1401,35 @@ ULong64 G_Signature(void)
   return s;
 }
 
+// Upper bound on the bytes needed to serialize the current game, plus
+// some slack, so the savegame buffer never has to grow.
+
+static size_t G_SaveGameSize(void)
+{
+  size_t size = SAVESTRINGSIZE + VERSIONSIZE + 4 + sizeof(ULong64) + 1 +
+    MIN_MAXPLAYERS + 1 + GAME_OPTION_SIZE + sizeof leveltime + 2;
+  char **w;
+
+  for (w = wadfiles; *w; w++)
+    size += strlen(*w) + 1;
+
+  return size + P_SaveGameSize() + 1024;
+}
+
 static void G_DoSaveGame(void)
 {
   char name[PATH_MAX+1];
   char name2[VERSIONSIZE];
   char *description;
-  int  length, i;
+  int  i;
+
+  G_FinishSaveGame(true);     // only one write in flight at a time
 
   G_SaveGameName(name,savegameslot);
 
   description = savedescription;
 
+  savegamesize = G_SaveGameSize();
   save_p = savebuffer = malloc(savegamesize);
 
   CheckSaveGame(SAVESTRINGSIZE+VERSIONSIZE+sizeof(unsigned long));
@@ -1198,7 +1438,7 @@ static void G_DoSaveGame(void)
   memset (name2,0,sizeof(name2));
 
   // killough 2/22/98: "proprietary" version string :-)
-  sprintf (name2,VERSIONID,VERSION);
+  sprintf (name2,VERSIONID,VERSION,SAVEVERSION);
 
   memcpy (save_p, name2, VERSIONSIZE);
   save_p += VERSIONSIZE;
@@ -1256,14 +1496,15 @@ static void G_DoSaveGame(void)
 
   *save_p++ = 0xe6;   // consistancy marker
 
-  length = save_p - savebuffer;
+  // Compress and write in the background; G_Ticker() reports the result
+  if (!savewriter.lock)
+    savewriter.lock = I_CreateMutex();
+  savewriter.buffer = savebuffer;
+  savewriter.length = save_p - savebuffer;
+  savewriter.done = false;
+  strcpy(savewriter.name, name);
+  savewriter.thread = I_CreateThread(G_SaveGameWriter, NULL);
 
-  if (!M_WriteFile(name, savebuffer, length))
-    doom_printf("%s", errno ? strerror(errno) : "Could not save game: Error unknown");
-  else
-    players[consoleplayer].message = s_GGSAVED;  // Ty 03/27/98 - externalized
-
-  free(savebuffer);  // killough
   savebuffer = save_p = NULL;
 
   gameaction = ga_nothing;
@@ -1278,13 +1519,13 @@ static void G_DoLoadGame(void)
 
   gameaction = ga_nothing;
 
-  length = M_ReadFile(savename, &savebuffer);
+  length = G_ReadSaveGame(savename);
   save_p = savebuffer + SAVESTRINGSIZE;
 
   // skip the description field
 
   // killough 2/22/98: "proprietary" version string :-)
-  sprintf (vcheck,VERSIONID,VERSION);
+  sprintf (vcheck,VERSIONID,VERSION,SAVEVERSION);
 
   // killough 2/22/98: Friendly savegame version difference message
   if (!forced_loadgame && strncmp(save_p, vcheck, VERSIONSIZE))
@@ -1380,6 +1621,121 @@ static void G_DoLoadGame(void)
 	G_BeginRecording();// Start the -recordfrom, since the game was loaded.
 }
 
+//
+// Rewind ring
+//
+// For practice sessions, the game state is captured every rewind_interval
+// tics into a ring of rewind_depth buffers, using the savegame archive
+// routines but no disk I/O. Each press of key_rewind steps back to the
+// previous snapshot, rebuilding the level in place instead of reloading it.
+// Slot buffers are kept across snapshots and only grow, so capturing is a
+// straight copy of the game state. Not available in netgames or demos.
+//
+
+int rewind_depth;       // snapshots kept, 0 disables rewinding
+int rewind_interval;    // tics between snapshots
+
+typedef struct {
+  byte   *data;
+  size_t size;          // allocated size of data
+} rewindslot_t;
+
+static rewindslot_t *rewindring;
+static int rewindslots;         // number of slots in rewindring
+static int rewindhead;          // slot the next snapshot goes into
+static int rewindcount;         // number of valid snapshots
+static int rewindtime = -1;     // leveltime of the last capture or restore
+
+static boolean G_RewindAllowed(void)
+{
+  return rewind_depth > 0 && gamestate == GS_LEVEL &&
+    !netgame && !demoplayback && !demorecording;
+}
+
+static void G_ClearRewind(void)
+{
+  rewindhead = rewindcount = 0;
+  rewindtime = -1;
+}
+
+static void G_RewindSnapshot(void)
+{
+  rewindslot_t *slot;
+  size_t size;
+
+  if (rewindslots != rewind_depth)     // depth changed, rebuild the ring
+    {
+      while (rewindslots)
+        Z_Free(rewindring[--rewindslots].data);
+      free(rewindring);
+      rewindring = calloc(rewindslots = rewind_depth, sizeof *rewindring);
+      G_ClearRewind();
+    }
+
+  rewindtime = leveltime;
+  slot = &rewindring[rewindhead];
+  size = sizeof leveltime + 1 + P_SaveGameSize();
+  if (size > slot->size)
+    {
+      Z_Free(slot->data);
+      slot->size = size + size/4;      // headroom for a growing level
+      slot->data = Z_Malloc(slot->size, PU_STATIC, 0);
+    }
+
+  save_p = savebuffer = slot->data;
+  savegamesize = slot->size;
+
+  memcpy(save_p, &leveltime, sizeof leveltime);
+  save_p += sizeof leveltime;
+  *save_p++ = (gametic-basetic) & 255;
+
+  P_ArchivePlayers();
+  P_ArchiveWorld();
+  P_ArchiveThinkers();
+  P_ArchiveSpecials();
+  P_ArchiveRNG();
+  P_ArchiveMap();
+
+  savebuffer = save_p = NULL;
+
+  rewindhead = (rewindhead+1) % rewindslots;
+  if (rewindcount < rewindslots)
+    rewindcount++;
+}
+
+static void G_DoRewind(void)
+{
+  gameaction = ga_nothing;
+
+  if (!rewindcount)
+    {
+      doom_printf("Nothing to rewind");
+      return;
+    }
+
+  rewindhead = (rewindhead + rewindslots - 1) % rewindslots;
+  rewindcount--;
+  save_p = rewindring[rewindhead].data;
+
+  memcpy(&leveltime, save_p, sizeof leveltime);
+  save_p += sizeof leveltime;
+  basetic = gametic - (int) *save_p++;
+  rewindtime = leveltime;
+
+  P_ResetLevelState();
+  P_UnArchivePlayers();
+  P_UnArchiveWorld();
+  P_UnArchiveThinkers();
+  P_UnArchiveSpecials();
+  P_UnArchiveRNG();
+  P_UnArchiveMap();
+
+  save_p = NULL;
+
+  doom_printf("Rewound to %d:%02d", leveltime/TICRATE/60,
+              leveltime/TICRATE%60);
+}
+
 //
 // G_Ticker
 // Make ticcmd_ts for the players.
@@ -1389,6 +1745,12 @@ void G_Ticker(void)
 {
   int i;
 
+  G_FinishSaveGame(false);   // report a finished background save
+
+#ifdef INSTRUMENTED
+  Z_Ticker();                // dump the zone accounting now and then
+#endif
+
   // do player reborns if needed
   for (i=0 ; i<MAXPLAYERS ; i++)
     if (playeringame[i] && players[i].playerstate == PST_REBORN)
@@ -1426,6 +1788,9 @@ void G_Ticker(void)
 	M_ScreenShot();
 	gameaction = ga_nothing;
 	break;
+      case ga_rewind:
+	G_DoRewind();
+	break;
       default:  // killough 9/29/98
 	gameaction = ga_nothing;
 	break;
@@ -1528,6 +1893,12 @@ void G_Ticker(void)
       gamestate == GS_INTERMISSION ? WI_Ticker() :
 	gamestate == GS_FINALE ? F_Ticker() :
 	  gamestate == GS_DEMOSCREEN ? D_PageTicker() : (void) 0;
+
+  // capture a rewind snapshot once per rewind_interval tics of play
+  if (G_RewindAllowed() && gameaction == ga_nothing &&
+      leveltime != rewindtime &&
+      !(leveltime % (rewind_interval > 0 ? rewind_interval : TICRATE)))
+    G_RewindSnapshot();
 }
 
 //
@@ -1811,6 +2182,8 @@ void G_ReloadDefaults(void)
 
   monsters_remember = default_monsters_remember;   // remember former enemies
 
+  monster_dormancy = default_monster_dormancy;     // park distant idle monsters
+
   // jff 1/24/98 reset play mode to command line spec'd version
   // killough 3/1/98: moved to here
   respawnparm = clrespawnparm;
@@ -2011,6 +2384,8 @@ byte *G_WriteOptions(byte *demo_p)
   *demo_p++ = (byte)((rngseed >>  8) & 0xff);
   *demo_p++ = (byte) (rngseed        & 0xff);
 
+  *demo_p++ = monster_dormancy;      // parks distant idle monsters
+
   //----------------
   // Padding at end
   //----------------
@@ -2062,6 +2437,8 @@ byte *G_ReadOptions(byte *demo_p)
   rngseed <<= 8;
   rngseed += *demo_p++ & 0xff;
 
+  monster_dormancy = *demo_p++;
+
   return target;
 }
 
@@ -48,6 +48,7 @@ void G_DeferedPlayDemo(char *demo);
 void G_LoadGame(char *name, int slot, boolean is_command); // killough 5/15/98
 void G_ForcedLoadGame(void);           // killough 5/15/98: forced loadgames
 void G_SaveGame(int slot, char *description); // Called by M_Responder.
+void G_WaitSaveGame(void);             // finish any background savegame write
 void G_RecordDemo(char *name);              // Only called by startup code.
 void G_BeginRecording(void);
 void G_PlayDemo(char *name);
@@ -140,6 +141,7 @@ extern int  key_map_mark;                                           //    ^
 extern int  key_map_clear;                                          //    |
 extern int  key_map_grid;                                           // phares
 extern int  key_screenshot;    // killough 2/22/98 -- add key for screenshot
+extern int  key_rewind;        // step back through the rewind ring
 extern int  key_setup;         // killough 10/98: shortcut to setup menu
 extern int  autorun;           // always running?                   // phares
 
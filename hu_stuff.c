@@ -167,6 +167,14 @@ static hu_stext_t     w_message;
 static hu_itext_t     w_chat;
 static hu_itext_t     w_inputbuffer[MAXPLAYERS];
 static hu_textline_t  w_coordx; //jff 2/16/98 new coord widget for automap
+
+#ifdef INSTRUMENTED
+// zone memory by allocation site, toggled by the "memsites" cheat
+#define HU_SITELINES 12
+#define HU_SITEWIDTH 56
+int hud_memsites;
+static hu_textline_t w_sites[HU_SITELINES+1];
+#endif
 static hu_textline_t  w_coordy; //jff 3/3/98 split coord widgets automap
 static hu_textline_t  w_coordz; //jff 3/3/98 split coord widgets automap
 static hu_textline_t  w_ammo;   //jff 2/16/98 new ammo widget for hud
@@ -514,6 +522,15 @@ void HU_Start(void)
     HUlib_initTextLine(&w_coordz, HU_COORDX, HU_COORDZ_Y, hu_font,
         HU_FONTSTART, colrngs[hudcolor_xyco]);
 
+#ifdef INSTRUMENTED
+    for (i = 0; i <= HU_SITELINES; i++)
+        HUlib_initTextLine(&w_sites[i], HU_MSGX,
+            HU_INPUTY + i * (SHORT(hu_font[0]->height) + 1), hu_font,
+            HU_FONTSTART, colrngs[i ? hudcolor_list : hudcolor_titl]);
+    for (s = "TAG     SITE                     NOW    PEAK  BLKS"; *s; s++)
+        HUlib_addCharToTextLine(&w_sites[0], *s);
+#endif
+
     // initialize the automaps coordinate widget
     //jff 3/3/98 split coordstr widget into 3 parts
     sprintf(hud_coordstrx, "X: %-5d", 0); //jff 2/22/98 added z
@@ -1185,6 +1202,27 @@ void HU_Drawer(void)
         }
     }
 
+#ifdef INSTRUMENTED
+    if (hud_memsites)
+    {
+        if (!(gametic % TICRATE) || !w_sites[1].len)  // once a second
+        {
+            char lines[HU_SITELINES][HU_SITEWIDTH];
+            int n = Z_DescribeSites(lines[0], HU_SITELINES, HU_SITEWIDTH);
+
+            for (i = 1; i <= HU_SITELINES; i++)
+            {
+                HUlib_clearTextLine(&w_sites[i]);
+                if (i <= n)
+                    for (s = lines[i - 1]; *s; s++)
+                        HUlib_addCharToTextLine(&w_sites[i], *s);
+            }
+        }
+        for (i = 0; i <= HU_SITELINES; i++)
+            HUlib_drawTextLine(&w_sites[i], false);
+    }
+#endif
+
     //jff 3/4/98 display last to give priority
     HU_Erase(); // jff 4/24/98 Erase current lines before drawing current
                 // needed when screen not fullsize
@@ -1408,13 +1446,15 @@ boolean HU_Responder(event_t* ev)
     {
         if (ev->data1 == key_enter)                                 // phares
         {
-#ifndef INSTRUMENTED  // never turn on message review if INSTRUMENTED defined
+#ifdef INSTRUMENTED  // never turn on message review while zone stats are shown
+            if (hud_msg_lines > 1 && !zone_instrument)
+#else
             if (hud_msg_lines > 1)  // it posts multi-line messages that will trash
+#endif
             {
                 if (message_list) HU_Erase(); //jff 4/28/98 erase behind messages
                 message_list = !message_list; //jff 2/26/98 toggle list of messages
             }
-#endif
             if (!message_list)              // if not message list, refresh message
             {
                 message_on = true;
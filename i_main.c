@@ -55,8 +55,11 @@ int main(int argc, char **argv)
   myargc = argc;
   myargv = argv;
 
+  Z_Init();
+
    // haleyjd: init SDL
-   if(SDL_Init(INIT_FLAGS) == -1)
+   // a dedicated server has no display, and needs none
+   if(SDL_Init(M_CheckParm("-dedicated") ? 0 : INIT_FLAGS) == -1)
    {
       puts("Failed to initialize SDL library.\n");
       return -1;
@@ -55,6 +55,7 @@ static UDPsocket udpsocket;
 static UDPpacket *packet;
 
 static IPaddress sendaddress[MAXNETNODES];
+static int acceptnodes;         // dedicated server: grow numnodes up to this
 
 void    (*netget) (void);
 void    (*netsend) (void);
@@ -100,46 +101,117 @@ unsigned long long net_to_host32(unsigned int value)
 }
 
 //
-// PacketSend
+// Wire format
+//
+// Packets are not a memory image of doomdata_t. After an 8 byte header
+// (checksum, player, retransmitfrom, starttic, numtics) each ticcmd is
+// sent as a byte of TC_* flags naming the fields that differ from the
+// previous ticcmd in the packet (the first one is compared against an
+// all-zero ticcmd), followed by just those fields in network order.
+// Consecutive tics rarely differ in more than angleturn and
+// consistancy, so the redundant tics d_net.c now resends in every
+// packet cost a few bytes each.
 //
-void PacketSend(void)
-{
-	int c;
-	doomdata_t *sw;
 
-	sw = (doomdata_t *)packet->data;
+#define TC_FORWARD      0x01
+#define TC_SIDE         0x02
+#define TC_ANGLE        0x04
+#define TC_CONSISTANCY  0x08
+#define TC_CHATCHAR     0x10
+#define TC_BUTTONS      0x20
 
-	sw->checksum = host_to_net32(netbuffer->checksum);
-	sw->player = netbuffer->player;
-	sw->retransmitfrom = netbuffer->retransmitfrom;
-	sw->starttic = netbuffer->starttic;
-	sw->numtics = netbuffer->numtics;
+#define NET_HEADERSIZE  8
 
-	for (c = 0; c < netbuffer->numtics; ++c)
+//
+// PacketEncode
+// Builds the wire image of netbuffer in packet
+//
+static void PacketEncode(void)
+{
+	int c, numcmds = NetbufferCmds();
+	byte *p = packet->data;
+	static const ticcmd_t zerocmd;
+	const ticcmd_t *prev = &zerocmd;
+
+	SDLNet_Write32(netbuffer->checksum, p);
+	p[4] = netbuffer->player;
+	p[5] = netbuffer->retransmitfrom;
+	p[6] = netbuffer->starttic;
+	p[7] = netbuffer->numtics;
+	p += NET_HEADERSIZE;
+
+	for (c = 0; c < numcmds; ++c)
 	{
-		sw->cmds[c].forwardmove = netbuffer->cmds[c].forwardmove;
-		sw->cmds[c].sidemove = netbuffer->cmds[c].sidemove;
-		sw->cmds[c].angleturn = host_to_net16(netbuffer->cmds[c].angleturn);
-		sw->cmds[c].consistancy = host_to_net16(netbuffer->cmds[c].consistancy);
-		sw->cmds[c].chatchar = netbuffer->cmds[c].chatchar;
-		sw->cmds[c].buttons = netbuffer->cmds[c].buttons;
+		const ticcmd_t *cmd = &netbuffer->cmds[c];
+		byte *flags = p++;
+
+		*flags = 0;
+		if (cmd->forwardmove != prev->forwardmove)
+		{
+			*flags |= TC_FORWARD;
+			*p++ = cmd->forwardmove;
+		}
+		if (cmd->sidemove != prev->sidemove)
+		{
+			*flags |= TC_SIDE;
+			*p++ = cmd->sidemove;
+		}
+		if (cmd->angleturn != prev->angleturn)
+		{
+			*flags |= TC_ANGLE;
+			SDLNet_Write16(cmd->angleturn, p);
+			p += 2;
+		}
+		if (cmd->consistancy != prev->consistancy)
+		{
+			*flags |= TC_CONSISTANCY;
+			SDLNet_Write16(cmd->consistancy, p);
+			p += 2;
+		}
+		if (cmd->chatchar != prev->chatchar)
+		{
+			*flags |= TC_CHATCHAR;
+			*p++ = cmd->chatchar;
+		}
+		if (cmd->buttons != prev->buttons)
+		{
+			*flags |= TC_BUTTONS;
+			*p++ = cmd->buttons;
+		}
+		prev = cmd;
 	}
 
-	packet->len = doomcom->datalength;
+	packet->len = p - packet->data;
 	packet->address = sendaddress[doomcom->remotenode];
+}
+
+static void PacketTransmit(void)
+{
+	netstats.packetssent++;
+	netstats.bytessent += packet->len;
 
 	if (!SDLNet_UDP_Send(udpsocket, -1, packet))
 		I_Error("Error sending packet: %s", SDLNet_GetError());
 }
 
+//
+// PacketSend
+//
+void PacketSend(void)
+{
+	PacketEncode();
+	PacketTransmit();
+}
+
 
 //
 // PacketGet
 //
 void PacketGet (void)
 {
-	int i, c, packets_read;
-	doomdata_t *sw;
+	int i, c, numcmds, packets_read;
+	const byte *p, *end;
+	ticcmd_t prev;
 
 	packets_read = SDLNet_UDP_Recv(udpsocket, packet);
 
@@ -157,36 +229,209 @@ void PacketGet (void)
 			&& packet->address.port == sendaddress[i].port)
 			break;
 
-	if (i == doomcom->numnodes)
+	if ((i == doomcom->numnodes && i >= acceptnodes)
+		|| packet->len < NET_HEADERSIZE)
+	{
+		doomcom->remotenode = -1;
+		return;
+	}
+
+	p = packet->data;
+	end = p + packet->len;
+
+	netbuffer->checksum = SDLNet_Read32(p);
+	netbuffer->player = p[4];
+	netbuffer->retransmitfrom = p[5];
+	netbuffer->starttic = p[6];
+	netbuffer->numtics = p[7];
+	p += NET_HEADERSIZE;
+
+	numcmds = NetbufferCmds();
+	if (numcmds > BACKUPTICS)
 	{
 		doomcom->remotenode = -1;
 		return;
 	}
 
+	memset(&prev, 0, sizeof prev);
+
+	for (c = 0; c < numcmds; ++c)
+	{
+		int flags, size;
+
+		if (p >= end)
+		{
+			doomcom->remotenode = -1;
+			return;
+		}
+
+		// every field the flags name must be present
+		flags = *p++;
+		size = !!(flags & TC_FORWARD) + !!(flags & TC_SIDE)
+			+ 2 * !!(flags & TC_ANGLE) + 2 * !!(flags & TC_CONSISTANCY)
+			+ !!(flags & TC_CHATCHAR) + !!(flags & TC_BUTTONS);
+		if (end - p < size)
+		{
+			doomcom->remotenode = -1;
+			return;
+		}
+
+		if (flags & TC_FORWARD)
+			prev.forwardmove = *p++;
+		if (flags & TC_SIDE)
+			prev.sidemove = *p++;
+		if (flags & TC_ANGLE)
+		{
+			prev.angleturn = SDLNet_Read16(p);
+			p += 2;
+		}
+		if (flags & TC_CONSISTANCY)
+		{
+			prev.consistancy = SDLNet_Read16(p);
+			p += 2;
+		}
+		if (flags & TC_CHATCHAR)
+			prev.chatchar = *p++;
+		if (flags & TC_BUTTONS)
+			prev.buttons = *p++;
+
+		netbuffer->cmds[c] = prev;
+	}
+
+	// a dedicated server learns its clients' addresses as they join
+	if (i == doomcom->numnodes)
+	{
+		sendaddress[i] = packet->address;
+		doomcom->numnodes++;
+	}
+
 	doomcom->remotenode = i;
-	doomcom->datalength = packet->len;
 
-	sw = (doomdata_t *)packet->data;
+	netstats.packetsreceived++;
+	netstats.bytesreceived += packet->len;
 
-	netbuffer->checksum = net_to_host32(sw->checksum);
-	netbuffer->player = sw->player;
-	netbuffer->retransmitfrom = sw->retransmitfrom;
-	netbuffer->starttic = sw->starttic;
-	netbuffer->numtics = sw->numtics;
+	// d_net.c validates the length of the decoded doomdata_t
+	doomcom->datalength = p == end ? NetbufferSize() : -1;
+}
 
-	for (c = 0; c < netbuffer->numtics; ++c)
+//
+// Network simulation
+//
+// -netsim <latency> [jitter] [loss] [reorder] puts a lossy link in
+// front of the UDP socket: outgoing packets are held back latency
+// ms, plus or minus up to jitter ms, loss percent of them vanish and
+// reorder percent are held back long enough to arrive behind their
+// successors. Start several nodes on one machine with -port and
+// host:port peers to benchmark the netcode without a real network.
+// The dice come from their own generator, so game sync is unaffected.
+//
+
+typedef struct simpacket_s
+{
+	struct simpacket_s *next;
+	Uint32 due;                 // SDL_GetTicks() time to transmit
+	IPaddress address;
+	int len;
+	byte data[];
+} simpacket_t;
+
+static simpacket_t *simqueue;   // sorted by due time
+static int simlatency, simjitter, simloss, simreorder;
+static unsigned simseed;
+
+static int SimRandom(int range)
+{
+	simseed = simseed * 1664525 + 1013904223;
+	return range > 0 ? (int)((simseed >> 16) % range) : 0;
+}
+
+// Transmit every held back packet that is due
+static void SimFlush(void)
+{
+	Uint32 now = SDL_GetTicks();
+
+	while (simqueue && (Sint32)(now - simqueue->due) >= 0)
 	{
-		netbuffer->cmds[c].forwardmove = sw->cmds[c].forwardmove;
-		netbuffer->cmds[c].sidemove = sw->cmds[c].sidemove;
-		netbuffer->cmds[c].angleturn = net_to_host16(sw->cmds[c].angleturn);
-		netbuffer->cmds[c].consistancy = net_to_host16(sw->cmds[c].consistancy);
-		netbuffer->cmds[c].chatchar = sw->cmds[c].chatchar;
-		netbuffer->cmds[c].buttons = sw->cmds[c].buttons;
+		simpacket_t *sp = simqueue;
+
+		simqueue = sp->next;
+		memcpy(packet->data, sp->data, sp->len);
+		packet->len = sp->len;
+		packet->address = sp->address;
+		PacketTransmit();
+		free(sp);
 	}
 }
 
+static void SimPacketSend(void)
+{
+	simpacket_t *sp, **link;
+	int delay;
+
+	SimFlush();
+
+	if (SimRandom(100) < simloss)
+	{
+		netstats.packetsdropped++;
+		return;
+	}
+
+	delay = simlatency + SimRandom(2 * simjitter + 1) - simjitter;
+	if (SimRandom(100) < simreorder)
+		delay += simlatency + 2 * simjitter + 1;
+	if (delay < 0)
+		delay = 0;
+
+	PacketEncode();
+
+	sp = malloc(sizeof *sp + packet->len);
+	sp->due = SDL_GetTicks() + delay;
+	sp->address = packet->address;
+	sp->len = packet->len;
+	memcpy(sp->data, packet->data, packet->len);
+
+	for (link = &simqueue; *link && (Sint32)((*link)->due - sp->due) <= 0;
+		link = &(*link)->next)
+		;
+	sp->next = *link;
+	*link = sp;
+}
+
+static void SimPacketGet(void)
+{
+	SimFlush();
+	PacketGet();
+}
+
+static void I_InitNetSim(void)
+{
+	int p = M_CheckParm ("-netsim");
+	int *parms[] = {&simlatency, &simjitter, &simloss, &simreorder};
+	int i;
+
+	if (!p || !netgame)
+		return;
+
+	for (i = 0; i < 4 && ++p < myargc && myargv[p][0] != '-'; i++)
+		*parms[i] = atoi(myargv[p]);
+
+	netsend = SimPacketSend;
+	netget = SimPacketGet;
+	simseed = 0x9e3779b9u ^ DOOMPORT;   // repeatable per node
+
+	printf ("simulating %i+-%i ms latency, %i%% loss, %i%% reorder\n",
+		simlatency, simjitter, simloss, simreorder);
+}
+
 void I_QuitNetwork (void)
 {
+	while (simqueue)
+	{
+		simpacket_t *sp = simqueue;
+		simqueue = sp->next;
+		free(sp);
+	}
+
 	if (packet)
 	{
 		SDLNet_FreePacket(packet);
@@ -202,6 +447,50 @@ void I_QuitNetwork (void)
 	SDLNet_Quit();
 }
 
+static void I_CheckPortParm (void)
+{
+	int p = M_CheckParm ("-port");
+	if (p && p<myargc-1)
+	{
+		DOOMPORT = atoll (myargv[p+1]);
+		printf ("using alternative port %i\n", DOOMPORT);
+	}
+}
+
+static void I_OpenSocket (int port)
+{
+	SDLNet_Init();
+
+	atexit(I_QuitNetwork);
+
+	udpsocket = SDLNet_UDP_Open(port);
+	if (!udpsocket)
+		I_Error("Unable to open UDP port %i: %s", port, SDLNet_GetError());
+
+	packet = SDLNet_AllocPacket(5000);
+
+	I_InitNetSim();
+}
+
+// Resolves "host" or "host:port"
+static void I_ResolveHost (IPaddress *address, const char *name)
+{
+	char host[256];
+	const char *colon = strrchr(name, ':');
+	int port = DOOMPORT;
+
+	strncpy(host, name, sizeof host - 1);
+	host[sizeof host - 1] = 0;
+	if (colon && colon - name < sizeof host)
+	{
+		host[colon - name] = 0;
+		port = atoi(colon + 1);
+	}
+
+	if (SDLNet_ResolveHost(address, host, port))
+		I_Error("Unable to resolve %s", name);
+}
+
 //
 // I_InitNetwork
 //
@@ -230,17 +519,16 @@ void I_InitNetwork (void)
 	else
 		doomcom-> extratics = 0;
 
-	p = M_CheckParm ("-port");
-	if (p && p<myargc-1)
-	{
-		DOOMPORT = atoll (myargv[p+1]);
-		printf ("using alternative port %i\n", DOOMPORT);
-	}
+	I_CheckPortParm ();
 
 	// parse network game options,
-	//  -net <consoleplayer> <host> <host> ...
+	//  -net <consoleplayer> <host[:port]> <host[:port]> ...
+	//  -connect <server[:port]>
 	i = M_CheckParm ("-net");
-	if (!i)
+	p = M_CheckParm ("-connect");
+	if (p >= myargc-1)
+		p = 0;
+	if (!i && !p)
 	{
 		// single player game
 		netgame = false;
@@ -255,29 +543,71 @@ void I_InitNetwork (void)
 	netget = PacketGet;
 	netgame = true;
 
-	doomcom->consoleplayer = myargv[i+1][0]-'1';
+	doomcom->id = DOOMCOM_ID;
 
-	doomcom->numnodes = 1;
+	if (p)
+	{
+		// all traffic goes through a dedicated server, which is node 1
+		// and assigns our player number in D_ArbitrateNetStart
+		I_ResolveHost(&sendaddress[1], myargv[p+1]);
 
-	SDLNet_Init();
+		doomcom->relay = 1;
+		doomcom->numnodes = 2;
+		doomcom->numplayers = 1;
 
-	atexit(I_QuitNetwork);
+		// any local port, so several clients can share a host
+		I_OpenSocket(0);
+		return;
+	}
+
+	doomcom->consoleplayer = myargv[i+1][0]-'1';
+
+	doomcom->numnodes = 1;
 
 	i++;
 	while (++i < myargc && myargv[i][0] != '-')
 	{
-		if (SDLNet_ResolveHost(&sendaddress[doomcom->numnodes], myargv[i], DOOMPORT))
-			I_Error("Unable to resolve %s", myargv[i]);
+		I_ResolveHost(&sendaddress[doomcom->numnodes], myargv[i]);
 
 		doomcom->numnodes++;
 	}
 
-	doomcom->id = DOOMCOM_ID;
 	doomcom->numplayers = doomcom->numnodes;
 
-	udpsocket = SDLNet_UDP_Open(DOOMPORT);
+	I_OpenSocket(DOOMPORT);
+}
 
-	packet = SDLNet_AllocPacket(5000);
+//
+// I_InitNetServer
+// Sets up doomcom for the dedicated server, which starts out as the
+// only node and learns its clients from the packets they send.
+//
+void I_InitNetServer (void)
+{
+    doomcom = malloc (sizeof (*doomcom));
+    memset (doomcom, 0, sizeof(*doomcom));
+
+	I_CheckPortParm ();
+
+	netsend = PacketSend;
+	netget = PacketGet;
+	netgame = true;
+
+	doomcom->id = DOOMCOM_ID;
+	doomcom->ticdup = 1;
+	doomcom->numnodes = 1;
+
+	I_OpenSocket(DOOMPORT);
+}
+
+//
+// I_NetAcceptNodes
+// Lets packets from unknown addresses join as new nodes until there
+// are maxnodes of them; 0 stops accepting.
+//
+void I_NetAcceptNodes (int maxnodes)
+{
+	acceptnodes = maxnodes < MAXNETNODES ? maxnodes : MAXNETNODES;
 }
 
 
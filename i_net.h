@@ -33,4 +33,8 @@
 void I_InitNetwork (void);
 void I_NetCmd (void);
 
+// Dedicated server transport (d_server.c)
+void I_InitNetServer (void);
+void I_NetAcceptNodes (int maxnodes);
+
 #endif
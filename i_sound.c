@@ -40,20 +40,30 @@
 #endif
 
 #include <math.h>
+#include <limits.h>
 
 #include "z_zone.h"
 #include "doomstat.h"
 #include "mmus2mid.h"   //jff 1/16/98 declarations for MUS->MIDI converter
 #include "i_sound.h"
+#include "i_system.h"
 #include "w_wad.h"
 #include "g_game.h"     //jff 1/21/98 added to use dprintf in I_RegisterSong
 #include "d_main.h"
+#include "m_argv.h"
+
+#ifdef WINDOWS
+#include "win_fopen.h"
+#endif
 
 // Needed for calling the actual sound output.
 int SAMPLECOUNT = 512;
 
-// haleyjd
-#define MAX_CHANNELS 32
+// Voices mixed by I_MixVoices; S_StartSound's channels map onto these
+#define MAX_CHANNELS 128
+
+// Frames mixed per pass of the accumulation buffer
+#define MIXFRAMES 1024
 
 extern int fullscreen;
 
@@ -77,20 +87,170 @@ int detect_voices; //jff 3/4/98 enables voice detection prior to install_sound
 // haleyjd 10/28/05: updated for Julian's music code, need full quality now
 int snd_samplerate = 44100;
 
+//
+// Pitch-shifted samples
+//
+// Random pitch gives every sound a few dozen possible pitch steps, and
+// converting the lump for each shot of a rapid-fire weapon added up.
+// Converted buffers are kept in an LRU cache keyed by (sfx, pitch),
+// bounded in entries and bytes. Buffers no channel is playing are
+// PU_CACHE, so the zone may reclaim them under memory pressure.
+//
+
+#define PITCHCACHE_SIZE   256
+#define PITCHCACHE_BYTES  (16*1024*1024)
+
+typedef struct {
+  sfxinfo_t *sfx;
+  int pitch;
+  void *data;           // zone block, NULL if evicted or purged
+  unsigned int alen;    // bytes of data
+  unsigned int lastused;
+  int users;            // channels playing this buffer
+} pitchcache_t;
+
+static pitchcache_t pitchcache[PITCHCACHE_SIZE];
+static size_t pitchcachebytes;
+static unsigned int pitchcacheclock;
+
+//
+// Voices are mixed by our own SDL_mixer post-mix callback rather than
+// one SDL_mixer channel each, so their number is not bound by the
+// mixer's channel setup and volume and pan changes cost a store. The
+// fields the callback reads are only written under voicelock.
+//
 typedef struct {
   // SFX id of the playing sound effect.
   // Used to catch duplicates (like chainsaw).
   sfxinfo_t *id;
   // The channel data pointer.
   unsigned char* data;
-  // [FG] let SDL_Mixer do the actual sound mixing
-  Mix_Chunk chunk;
   // haleyjd 06/16/08: unique id number
   int idnum;
+  // pitch-shifted buffer this channel plays, if any
+  pitchcache_t *pitched;
+  // S_StartSound priority; larger numbers matter less
+  int priority;
+
+  // mixer state, guarded by voicelock
+  const Sint16 *samples;        // mono, at snd_samplerate
+  unsigned int length;          // in samples
+  unsigned int position;
+  int leftvol, rightvol;        // 0-255
+  boolean playing;              // cleared by the mixer at the end
 } channel_info_t;
 
 channel_info_t channelinfo[MAX_CHANNELS];
 
+static i_mutex_t *voicelock;
+
+//
+// I_PitchCacheFind
+//
+// Returns the cached conversion of sfx at pitch, or NULL. Entries whose
+// data the zone purged are dropped along the way.
+//
+static pitchcache_t *I_PitchCacheFind(sfxinfo_t *sfx, int pitch)
+{
+   pitchcache_t *pc, *found = NULL;
+
+   for(pc = pitchcache; pc < pitchcache + PITCHCACHE_SIZE; ++pc)
+   {
+      if(pc->alen && !pc->data)   // purged from PU_CACHE
+      {
+         pitchcachebytes -= pc->alen;
+         pc->alen = 0;
+         pc->sfx = NULL;
+      }
+      else if(pc->sfx == sfx && pc->pitch == pitch && pc->data)
+         found = pc;
+   }
+
+   return found;
+}
+
+//
+// I_PitchCacheAlloc
+//
+// Makes room for a new conversion of size bytes, evicting the least
+// recently used idle buffers first.
+//
+static pitchcache_t *I_PitchCacheAlloc(sfxinfo_t *sfx, int pitch,
+                                       unsigned int size)
+{
+   pitchcache_t *pc, *slot;
+
+   for(;;)
+   {
+      pitchcache_t *lru = NULL;
+
+      slot = NULL;
+      for(pc = pitchcache; pc < pitchcache + PITCHCACHE_SIZE; ++pc)
+      {
+         if(!pc->data)
+         {
+            if(!slot)
+               slot = pc;
+         }
+         else if(!pc->users && (!lru || pc->lastused < lru->lastused))
+            lru = pc;
+      }
+
+      // everything is playing: go over budget rather than fail
+      if((slot && pitchcachebytes + size <= PITCHCACHE_BYTES) || !lru)
+         break;
+
+      Z_Free(lru->data);
+      pitchcachebytes -= lru->alen;
+      lru->alen = 0;
+      lru->sfx = NULL;
+   }
+
+   if(!slot)
+      return NULL;
+
+   slot->sfx = sfx;
+   slot->pitch = pitch;
+   slot->alen = size;
+   slot->users = 0;
+   Z_Malloc(size, PU_STATIC, &slot->data);
+   pitchcachebytes += size;
+
+   return slot;
+}
+
+//
+// I_ResampleSfx
+//
+// Converts 8-bit unsigned samples to 16-bit signed at snd_samplerate
+// with linear interpolation. step is the 16.16 source advance per
+// output sample. The interpolated value never leaves 0..255, so it
+// needs no clamping.
+//
+static void I_ResampleSfx(const byte *src, unsigned int srclen,
+                          Sint16 *dest, unsigned int destlen,
+                          unsigned int step)
+{
+   unsigned int i, j = 0, frac = 0;   // position in src, 16.16
+   Sint16 sample = 0;
+
+   for(i = 0; i < destlen && j < srclen - 1; ++i)
+   {
+      int a = src[j], b = src[j + 1];
+      int d = a + (((b - a) * (int)frac) >> 16);
+
+      // [FG] expand 8->16 bits
+      dest[i] = sample = (d - 128) * 256;
+
+      frac += step;
+      j += frac >> 16;
+      frac &= 0xffff;
+   }
+   // fill remainder (if any) with final sample byte
+   for(; i < destlen; ++i)
+      dest[i] = sample;
+}
+
 // Pitch to stepping lookup, unused.
 int steptable[256];
 
@@ -112,11 +272,18 @@ static void stopchan(int handle)
 
    if(channelinfo[handle].data)
    {
-      Mix_HaltChannel(handle);
-      // [FG] immediately free samples not connected to a sound SFX
-      if (channelinfo[handle].id == NULL)
+      // once the mixer has let go, the data may be released
+      I_LockMutex(voicelock);
+      channelinfo[handle].playing = false;
+      I_UnlockMutex(voicelock);
+
+      // [FG] samples not connected to a sound SFX go back to the cache
+      if (channelinfo[handle].pitched)
       {
-         Z_Free(channelinfo[handle].data);
+         pitchcache_t *pc = channelinfo[handle].pitched;
+         if (!--pc->users)
+            Z_ChangeTag(pc->data, PU_CACHE);
+         channelinfo[handle].pitched = NULL;
       }
       channelinfo[handle].data = NULL;
 
@@ -145,6 +312,272 @@ static void stopchan(int handle)
 
 #define SOUNDHDRSIZE 8
 
+//
+// I_CacheSfxLump
+//
+// Caches the lump of sfx PU_STATIC and checks its header. Returns the
+// lump data, or NULL (with nothing locked) if it is not a valid sound.
+//
+static byte *I_CacheSfxLump(sfxinfo_t *sfx, Uint32 *samplerate,
+                            Uint32 *samplelen)
+{
+   size_t lumplen;
+   int lump;
+   byte *data;
+
+   // haleyjd: Eternity sfxinfo_t does not have a lumpnum field
+   lump = I_GetSfxLumpNum(sfx);
+   
+   // replace missing sounds with a reasonable default
+   if(lump == -1)
+      lump = W_GetNumForName("DSPISTOL");
+   
+   lumplen = W_LumpLength(lump);
+   
+   // haleyjd 10/08/04: do not play zero-length sound lumps
+   if(lumplen <= SOUNDHDRSIZE)
+      return NULL;
+
+   // haleyjd: this should always be called (if lump is already loaded,
+   // W_CacheLumpNum handles that for us).
+   data = (byte *)W_CacheLumpNum(lump, PU_STATIC);
+
+   // Check the header, and ensure this is a valid sound
+   if(data[0] != 0x03 || data[1] != 0x00)
+   {
+      Z_ChangeTag(data, PU_CACHE);
+      return NULL;
+   }
+
+   *samplerate = (data[3] << 8) | data[2];
+   *samplelen  = (data[7] << 24) | (data[6] << 16) | (data[5] << 8) | data[4];
+
+   // don't play sounds that think they're longer than they really are
+   if(*samplelen > lumplen - SOUNDHDRSIZE || !*samplerate)
+   {
+      Z_ChangeTag(data, PU_CACHE);
+      return NULL;
+   }
+
+   return data;
+}
+
+//
+// Background conversion
+//
+// Once a level is set up, S_PrecacheLevelSounds passes in the sounds it
+// can make. Their lumps are read and checked here on the main thread,
+// and a worker thread resamples copies into the mixer format, so neither
+// startup nor the first shot of a fight waits on addsfx. The worker
+// only writes into buffers allocated for it; finished buffers are handed
+// to the sfx by I_UpdateSound, or by addsfx if it gets there first.
+//
+
+enum { SJ_NONE, SJ_QUEUED, SJ_BUSY, SJ_DONE };
+
+typedef struct {
+  int state;            // guarded by sfxjoblock
+  byte *src;            // PU_STATIC copy of the lump's samples
+  Uint32 samplelen;
+  unsigned int step;    // 16.16 source advance per output sample
+  Sint16 *out;          // PU_STATIC, owned by the job until adopted
+  unsigned int outlen;  // in samples
+} sfxjob_t;
+
+static sfxjob_t sfxjobs[NUMSFX];
+static int sfxjobsout;            // jobs not yet adopted or dropped
+static i_thread_t *sfxworker;
+static i_mutex_t *sfxjoblock;
+static volatile boolean sfxcancel;
+
+static int I_SfxWorker(void *unused)
+{
+   int i;
+
+   for(i = 1; i < NUMSFX && !sfxcancel; ++i)
+   {
+      sfxjob_t *job = &sfxjobs[i];
+      boolean mine;
+
+      I_LockMutex(sfxjoblock);
+      if((mine = job->state == SJ_QUEUED))
+         job->state = SJ_BUSY;
+      I_UnlockMutex(sfxjoblock);
+
+      if(!mine)
+         continue;
+
+      I_ResampleSfx(job->src, job->samplelen,
+                    job->out, job->outlen, job->step);
+
+      I_LockMutex(sfxjoblock);
+      job->state = SJ_DONE;
+      I_UnlockMutex(sfxjoblock);
+   }
+
+   return 0;
+}
+
+//
+// I_FinishSfxJob
+//
+// Gives the converted samples to sfx, unless the job was dropped or sfx
+// got samples of its own in the meantime.
+//
+static void I_FinishSfxJob(sfxinfo_t *sfx, sfxjob_t *job, boolean done)
+{
+   if(done && !sfx->data)
+   {
+      Z_ChangeUser(job->out, &sfx->data);
+      sfx->alen = 2 * job->outlen;
+      if(!precache_sounds)
+         Z_ChangeTag(sfx->data, PU_CACHE);
+   }
+   else
+      Z_Free(job->out);
+
+   Z_Free(job->src);
+   job->out = NULL;
+   I_LockMutex(sfxjoblock);
+   job->state = SJ_NONE;
+   I_UnlockMutex(sfxjoblock);
+   sfxjobsout--;
+}
+
+//
+// I_TakeSfxJob
+//
+// Called by addsfx for a sound without data. A job the worker has not
+// reached yet is converted right here; one it is working on is waited
+// for, which is never long.
+//
+static void I_TakeSfxJob(sfxinfo_t *sfx)
+{
+   sfxjob_t *job = &sfxjobs[sfx - S_sfx];
+   int state;
+
+   if(job->state == SJ_NONE)    // only the main thread sets SJ_NONE
+      return;
+
+   for(;;)
+   {
+      I_LockMutex(sfxjoblock);
+      if((state = job->state) == SJ_QUEUED)
+         job->state = SJ_BUSY;
+      I_UnlockMutex(sfxjoblock);
+
+      if(state != SJ_BUSY)
+         break;
+      I_Sleep(0);
+   }
+
+   if(state == SJ_QUEUED)   // now marked busy, so the worker skips it
+   {
+      I_ResampleSfx(job->src, job->samplelen,
+                    job->out, job->outlen, job->step);
+   }
+
+   I_FinishSfxJob(sfx, job, true);
+}
+
+//
+// I_UpdateSfxJobs
+//
+// Adopts whatever the worker has finished, and reaps it once the last
+// job is in. With wait set, cancels the rest and drops them.
+//
+static void I_UpdateSfxJobs(boolean wait)
+{
+   int i;
+
+   if(!sfxworker)
+      return;
+
+   if(wait)
+   {
+      sfxcancel = true;
+      I_WaitThread(sfxworker);
+   }
+
+   for(i = 1; i < NUMSFX && sfxjobsout; ++i)
+   {
+      sfxjob_t *job = &sfxjobs[i];
+      int state;
+
+      if(job->state == SJ_NONE)
+         continue;
+
+      I_LockMutex(sfxjoblock);
+      state = job->state;
+      I_UnlockMutex(sfxjoblock);
+
+      if(state == SJ_DONE || wait)
+         I_FinishSfxJob(&S_sfx[i], job, state == SJ_DONE);
+   }
+
+   if(!wait && !sfxjobsout)
+      I_WaitThread(sfxworker);
+   if(wait || !sfxjobsout)
+   {
+      sfxworker = NULL;
+      sfxcancel = false;
+   }
+}
+
+//
+// I_PrecacheSounds
+//
+// Starts converting every sound flagged in needed[] that has no data
+// yet. Conversions still running from the last level are dropped.
+//
+void I_PrecacheSounds(const boolean *needed)
+{
+   int i;
+
+   if(!snd_init)
+      return;
+
+   I_UpdateSfxJobs(true);
+
+   // let the lumps load in parallel while they are waited for in turn
+   for(i = 1; i < NUMSFX; ++i)
+      if(needed[i] && !S_sfx[i].link && !S_sfx[i].data)
+      {
+         int lump = I_GetSfxLumpNum(&S_sfx[i]);
+         if(lump != -1)
+            W_PrefetchLump(lump);
+      }
+
+   for(i = 1; i < NUMSFX; ++i)
+   {
+      sfxinfo_t *sfx = &S_sfx[i];
+      sfxjob_t *job = &sfxjobs[i];
+      Uint32 samplerate;
+      byte *data;
+
+      if(!needed[i] || sfx->link || sfx->data)
+         continue;
+
+      if(!(data = I_CacheSfxLump(sfx, &samplerate, &job->samplelen)))
+         continue;
+
+      // the lump itself may be shared and purged, so the worker
+      // reads from a copy
+      Z_Malloc(job->samplelen, PU_STATIC, (void **)&job->src);
+      memcpy(job->src, data + SOUNDHDRSIZE, job->samplelen);
+      Z_ChangeTag(data, PU_CACHE);
+
+      job->outlen = (Uint32)(((ULong64)job->samplelen * snd_samplerate) / samplerate);
+      job->step = (samplerate << 16) / snd_samplerate;
+      Z_Malloc(2 * job->outlen, PU_STATIC, (void **)&job->out);
+      job->state = SJ_QUEUED;
+      sfxjobsout++;
+   }
+
+   if(sfxjobsout)
+      sfxworker = I_CreateThread(I_SfxWorker, NULL);
+}
+
 //
 // addsfx
 //
@@ -159,11 +592,8 @@ static void stopchan(int handle)
 //
 static boolean addsfx(sfxinfo_t *sfx, int channel, int pitch)
 {
-   size_t lumplen;
-   int lump;
    // [FG] do not connect pitch-shifted samples to a sound SFX
-   unsigned int sfx_alen;
-   void *sfx_data;
+   pitchcache_t *pc = NULL;
 
 #ifdef RANGECHECK
    if(channel < 0 || channel >= MAX_CHANNELS)
@@ -179,52 +609,33 @@ static boolean addsfx(sfxinfo_t *sfx, int channel, int pitch)
    // We will handle the new SFX.
    // Set pointer to raw data.
 
-   // haleyjd: Eternity sfxinfo_t does not have a lumpnum field
-   lump = I_GetSfxLumpNum(sfx);
-   
-   // replace missing sounds with a reasonable default
-   if(lump == -1)
-      lump = W_GetNumForName("DSPISTOL");
-   
-   lumplen = W_LumpLength(lump);
-   
-   // haleyjd 10/08/04: do not play zero-length sound lumps
-   if(lumplen <= SOUNDHDRSIZE)
-      return false;
+   // a background conversion may already have it ready
+   if(sfx->data == NULL && pitch == NORM_PITCH)
+      I_TakeSfxJob(sfx);
 
+   if(pitch != NORM_PITCH && (pc = I_PitchCacheFind(sfx, pitch)))
+   {
+      if(!pc->users)
+         Z_ChangeTag(pc->data, PU_STATIC);
+   }
+   else
    // haleyjd 06/03/06: rewrote again to make sound data properly freeable
    if(sfx->data == NULL || pitch != NORM_PITCH)
    {   
+      unsigned int sfx_alen;
+      void *sfx_data;
       byte *data;
       Uint32 samplerate, samplelen;
 
-      // haleyjd: this should always be called (if lump is already loaded,
-      // W_CacheLumpNum handles that for us).
-      data = (byte *)W_CacheLumpNum(lump, PU_STATIC);
-
-      // Check the header, and ensure this is a valid sound
-      if(data[0] != 0x03 || data[1] != 0x00)
-      {
-         Z_ChangeTag(data, PU_CACHE);
-         return false;
-      }
-
-      samplerate = (data[3] << 8) | data[2];
-      samplelen  = (data[7] << 24) | (data[6] << 16) | (data[5] << 8) | data[4];
-
-      // don't play sounds that think they're longer than they really are
-      if(samplelen > lumplen - SOUNDHDRSIZE)
-      {
-         Z_ChangeTag(data, PU_CACHE);
+      if(!(data = I_CacheSfxLump(sfx, &samplerate, &samplelen)))
          return false;
-      }
 
       // [FG] do not connect pitch-shifted samples to a sound SFX
       if (pitch == NORM_PITCH)
       {
          sfx_alen = (Uint32)(((ULong64)samplelen * snd_samplerate) / samplerate);
-         // [FG] double up twice: 8 -> 16 bit and mono -> stereo
-         sfx->alen = 4 * sfx_alen;
+         // [FG] double up: 8 -> 16 bit
+         sfx->alen = 2 * sfx_alen;
          sfx->data = precache_sounds ? (malloc)(sfx->alen) : Z_Malloc(sfx->alen, PU_STATIC, &sfx->data);
          sfx_data = sfx->data;
       }
@@ -233,47 +644,19 @@ static boolean addsfx(sfxinfo_t *sfx, int channel, int pitch)
          // [FG] spoof sound samplerate if using randomly pitched sounds
          samplerate = (Uint32)(((ULong64)samplerate * steptable[pitch]) >> 16);
          sfx_alen = (Uint32)(((ULong64)samplelen * snd_samplerate) / samplerate);
-         // [FG] double up twice: 8 -> 16 bit and mono -> stereo
-         channelinfo[channel].data = Z_Malloc(4 * sfx_alen, PU_STATIC, (void **)&channelinfo[channel].data);
-         sfx_data = channelinfo[channel].data;
-      }
-
-      // haleyjd 04/23/08: Convert sound to target samplerate
-      {  
-         unsigned int i;
-         Sint16 sample = 0;
-         Sint16 *dest = (Sint16 *)sfx_data;
-         byte *src  = data + SOUNDHDRSIZE;
-         
-         unsigned int step = (samplerate << 16) / snd_samplerate;
-         unsigned int stepremainder = 0, j = 0;
-
-         // do linear filtering operation
-         for(i = 0; i < sfx_alen && j < samplelen - 1; ++i)
+         // [FG] double up: 8 -> 16 bit
+         pc = I_PitchCacheAlloc(sfx, pitch, 2 * sfx_alen);
+         if(!pc)
          {
-            int d = (((unsigned int)src[j  ] * (0x10000 - stepremainder)) +
-                     ((unsigned int)src[j+1] * stepremainder)) >> 16;
-
-            if(d > 255)
-               d = 255;
-            else if(d < 0)
-               d = 0;
-
-            // [FG] expand 8->16 bits, mono->stereo
-            sample = (d-128)*256;
-            dest[2*i] = dest[2*i+1] = sample;
-
-            stepremainder += step;
-            j += (stepremainder >> 16);
-
-            stepremainder &= 0xffff;
+            Z_ChangeTag(data, PU_CACHE);
+            return false;
          }
-         // fill remainder (if any) with final sample byte
-         for(; i < sfx_alen; ++i)
-            dest[2*i] = dest[2*i+1] = sample;
+         sfx_data = pc->data;
       }
-      // [FG] double up twice: 8 -> 16 bit and mono -> stereo
-      sfx_alen *= 4;
+
+      // haleyjd 04/23/08: Convert sound to target samplerate
+      I_ResampleSfx(data + SOUNDHDRSIZE, samplelen, sfx_data, sfx_alen,
+                    (samplerate << 16) / snd_samplerate);
 
       // haleyjd 06/03/06: don't need original lump data any more
       Z_ChangeTag(data, PU_CACHE);
@@ -282,25 +665,29 @@ static boolean addsfx(sfxinfo_t *sfx, int channel, int pitch)
    if (!precache_sounds)
       Z_ChangeTag(sfx->data, PU_STATIC); // reset to static cache level
 
-   // [FG] let SDL_Mixer do the actual sound mixing
-   channelinfo[channel].chunk.allocated = 1;
-   channelinfo[channel].chunk.volume = MIX_MAX_VOLUME;
+   // the voice is stopped, so the mixer is not looking at it
 
    // [FG] do not connect pitch-shifted samples to a sound SFX
    if (pitch == NORM_PITCH)
    {
       channelinfo[channel].data = sfx->data;
 
-      channelinfo[channel].chunk.abuf = sfx->data;
-      channelinfo[channel].chunk.alen = sfx->alen;
+      channelinfo[channel].samples = sfx->data;
+      channelinfo[channel].length = sfx->alen / 2;
 
       // Preserve sound SFX id
       channelinfo[channel].id = sfx;
    }
    else
    {
-      channelinfo[channel].chunk.abuf = sfx_data;
-      channelinfo[channel].chunk.alen = sfx_alen;
+      pc->users++;
+      pc->lastused = ++pitchcacheclock;
+
+      channelinfo[channel].data = pc->data;
+      channelinfo[channel].pitched = pc;
+
+      channelinfo[channel].samples = pc->data;
+      channelinfo[channel].length = pc->alen / 2;
 
       channelinfo[channel].id = NULL;
    }
@@ -342,7 +729,10 @@ static void updateSoundParams(int handle, int volume, int separation, int pitch)
    if (rightvol < 0) rightvol = 0;
    else if (rightvol > 255) rightvol = 255;
 
-   Mix_SetPanning(handle, leftvol, rightvol);
+   I_LockMutex(voicelock);
+   channelinfo[handle].leftvol = leftvol;
+   channelinfo[handle].rightvol = rightvol;
+   I_UnlockMutex(voicelock);
 }
 
 //
@@ -450,22 +840,39 @@ int I_StartSound(sfxinfo_t *sound, int cnum, int vol, int sep, int pitch, int pr
    */
 
    // haleyjd 06/03/06: look for an unused hardware channel
+   // A voice that finished but was not reaped yet is as good as free.
+   I_LockMutex(voicelock);
    for(handle = 0; handle < MAX_CHANNELS; ++handle)
    {
-      if(channelinfo[handle].data == NULL)
+      if(!channelinfo[handle].playing)
          break;
    }
+   I_UnlockMutex(voicelock);
 
-   // all used? don't play the sound. It's preferable to miss a sound
-   // than it is to cut off one already playing, which sounds weird.
+   // All used? Cutting off a sound sounds weird, so only steal the
+   // least important voice, and only if it matters less than this one.
    if(handle == MAX_CHANNELS)
-      return -1;
+   {
+      int i;
+
+      for(handle = 0, i = 1; i < MAX_CHANNELS; ++i)
+         if(channelinfo[i].priority > channelinfo[handle].priority)
+            handle = i;
+
+      if(channelinfo[handle].priority <= pri)
+         return -1;
+   }
 
    if(addsfx(sound, handle, pitch))
    {
       channelinfo[handle].idnum = id++; // give the sound a unique id
-      Mix_PlayChannel(handle, &channelinfo[handle].chunk, 0);
+      channelinfo[handle].priority = pri;
       updateSoundParams(handle, vol, sep, pitch);
+
+      I_LockMutex(voicelock);
+      channelinfo[handle].position = 0;
+      channelinfo[handle].playing = true;
+      I_UnlockMutex(voicelock);
    }
    else
       handle = -1;
@@ -507,7 +914,7 @@ int I_SoundIsPlaying(int handle)
       I_Error("I_SoundIsPlaying: handle out of range");
 #endif
  
-   return Mix_Playing(handle);
+   return channelinfo[handle].playing;
 }
 
 //
@@ -541,12 +948,81 @@ int I_SoundID(int handle)
 //  contents of the mixbuffer to the (two)
 //  hardware channels (left and right, that is).
 //
-//  allegro does this now
+// Runs on the audio thread as SDL_mixer's post-mix hook, on top of
+// the music. Voices are summed in 32-bit fixed point and clamped once
+// per output sample; the inner loops are plain multiply-adds over
+// arrays, which the compiler vectorizes.
+//
+static void I_MixVoices(void *udata, Uint8 *stream, int len)
+{
+   static int mixbuffer[MIXFRAMES * 2];
+   Sint16 *out = (Sint16 *)stream;
+   int frames = len / 4;
+
+   I_LockMutex(voicelock);
+
+   while(frames > 0)
+   {
+      int n = frames < MIXFRAMES ? frames : MIXFRAMES;
+      boolean active = false;
+      channel_info_t *v;
+      int i;
+
+      for(v = channelinfo; v < channelinfo + MAX_CHANNELS; ++v)
+      {
+         const Sint16 *src;
+         int count, lv, rv, *mix;
+
+         if(!v->playing)
+            continue;
+
+         if(!active)
+         {
+            memset(mixbuffer, 0, n * 2 * sizeof *mixbuffer);
+            active = true;
+         }
+
+         src = v->samples + v->position;
+         count = v->length - v->position;
+         if(count > n)
+            count = n;
+         lv = v->leftvol;
+         rv = v->rightvol;
+
+         for(i = 0, mix = mixbuffer; i < count; ++i, mix += 2)
+         {
+            mix[0] += src[i] * lv;
+            mix[1] += src[i] * rv;
+         }
+
+         if((v->position += count) >= v->length)
+            v->playing = false;
+      }
+
+      if(active)
+         for(i = 0; i < n * 2; ++i)
+         {
+            int sample = out[i] + (mixbuffer[i] >> 8);
+
+            out[i] = sample > 32767 ? 32767 : sample < -32768 ? -32768 : sample;
+         }
+
+      out += n * 2;
+      frames -= n;
+   }
+
+   I_UnlockMutex(voicelock);
+}
+
+static void I_UpdateMusic(void);
 
 void I_UpdateSound(void)
 {
     int i;
 
+    I_UpdateSfxJobs(false);
+    I_UpdateMusic();
+
     // Check all channels to see if a sound has finished
 
     for (i=0; i<MAX_CHANNELS; ++i)
@@ -582,6 +1058,8 @@ void I_ShutdownSound(void)
 {
    if(snd_init)
    {
+      I_UpdateSfxJobs(true);
+      Mix_SetPostMix(NULL, NULL);
       Mix_CloseAudio();
       snd_init = 0;
    }
@@ -620,27 +1098,45 @@ void I_InitSound(void)
          return;
       }
 
+      // the device may not run at the rate we asked for, and
+      // I_MixVoices only handles 16-bit stereo
+      {
+         int freq, channels;
+         Uint16 format;
+
+         Mix_QuerySpec(&freq, &format, &channels);
+         if(format != AUDIO_S16SYS || channels != 2)
+         {
+            printf("Audio device is not 16-bit stereo.\n");
+            Mix_CloseAudio();
+            snd_card = 0;
+            mus_card = 0;
+            return;
+         }
+         snd_samplerate = freq;
+      }
+
       SAMPLECOUNT = audio_buffers;
-      // [FG] let SDL_Mixer do the actual sound mixing
-      Mix_AllocateChannels(MAX_CHANNELS);
+      // sound effects are mixed by I_MixVoices, not SDL_mixer channels
+      Mix_AllocateChannels(0);
+      voicelock = I_CreateMutex();
+      sfxjoblock = I_CreateMutex();
+      Mix_SetPostMix(I_MixVoices, NULL);
       printf("Configured audio device with %d samples/slice.\n", SAMPLECOUNT);
 
       atexit(I_ShutdownSound);
 
       snd_init = true;
 
-      // [FG] precache all sound effects
+      // [FG] precache all sound effects, in the background
       if (precache_sounds)
       {
+         static boolean all[NUMSFX];
          int i;
 
-         printf("Precaching all sound effects...");
          for (i = 1; i < NUMSFX; i++)
-         {
-            addsfx(&S_sfx[i], 0, NORM_PITCH);
-         }
-         stopchan(0);
-         printf("done.\n");
+            all[i] = true;
+         I_PrecacheSounds(all);
       }
 
       // haleyjd 04/11/03: don't use music if sfx aren't init'd
@@ -666,14 +1162,317 @@ static Mix_Music *music = NULL;
 // we need to free them in the end
 static SDL_RWops *rw = NULL;
 
-// Same goes for buffers that were allocated to convert music;
-// since this concerns mus, we could do otherwise but this 
-// approach is better for consistency
-static void *music_block = NULL;
-
 // Macro to make code more readable
 #define CHECK_MUSIC(h) ((h) && music != NULL)
 
+//
+// Converted music
+//
+// MUS lumps are converted to MIDI on a worker thread, so S_ChangeMusic
+// never waits on mmus2mid. Conversions are kept in memory across level
+// changes, keyed by a hash of the lump and its length, and written to
+// the muscache directory so later runs only read them back. Until its
+// conversion is in, a registered song is pending: play, pause and stop
+// requests are remembered and applied once it loads.
+//
+
+#define MUS_MAGIC      "MUS\x1a"
+#define MUSCACHE_SIZE  32
+#define MUSCACHE_BYTES (8*1024*1024)
+
+typedef struct {
+  ULong64 hash;
+  int size;             // of the MUS lump
+  byte *mid;            // C library heap, NULL if the slot is free
+  int midlen;
+  unsigned int lastused;
+} muscache_t;
+
+static muscache_t muscache[MUSCACHE_SIZE];
+static muscache_t *musloaded;           // entry SDL_mixer is reading from
+static unsigned int muscacheclock;
+
+typedef struct {
+  ULong64 hash;
+  int size;
+  byte *mus;            // private copy of the lump, NULL if no job
+  byte *mid;            // result, NULL if the conversion failed
+  int midlen;
+} musjob_t;
+
+static musjob_t musjob, musnext;         // converting, and waiting behind it
+static i_thread_t *musworker;
+static i_mutex_t *muslock;              // guards musdone
+static boolean musdone;
+static char muscachedir[PATH_MAX+1];    // empty if there is no disk cache
+
+static struct {
+  boolean waiting, play, looping, paused;
+  ULong64 hash;
+  int size;
+} muspending;
+
+static muscache_t *I_MusCacheFind(ULong64 hash, int size)
+{
+   muscache_t *mc;
+
+   for(mc = muscache; mc < muscache + MUSCACHE_SIZE; ++mc)
+      if(mc->mid && mc->hash == hash && mc->size == size)
+      {
+         mc->lastused = ++muscacheclock;
+         return mc;
+      }
+   return NULL;
+}
+
+//
+// I_MusCacheAdd
+//
+// Takes over a finished conversion, evicting the least recently used
+// ones other than the song loaded right now to stay within budget.
+//
+static void I_MusCacheAdd(musjob_t *job)
+{
+   muscache_t *mc, *slot;
+   size_t bytes;
+
+   for(;;)
+   {
+      muscache_t *lru = NULL;
+
+      slot = NULL;
+      bytes = job->midlen;
+      for(mc = muscache; mc < muscache + MUSCACHE_SIZE; ++mc)
+      {
+         if(!mc->mid)
+         {
+            if(!slot)
+               slot = mc;
+            continue;
+         }
+         bytes += mc->midlen;
+         if(mc != musloaded && (!lru || mc->lastused < lru->lastused))
+            lru = mc;
+      }
+
+      if((slot && bytes <= MUSCACHE_BYTES) || !lru)
+         break;
+
+      (free)(lru->mid);
+      lru->mid = NULL;
+   }
+
+   if(!slot)
+   {
+      (free)(job->mid);
+      return;
+   }
+
+   slot->hash = job->hash;
+   slot->size = job->size;
+   slot->mid = job->mid;
+   slot->midlen = job->midlen;
+   slot->lastused = ++muscacheclock;
+}
+
+static void I_MusCacheName(char *name, const musjob_t *job)
+{
+   sprintf(name, "%s/%08x%08x-%d.mid", muscachedir,
+           (unsigned int)(job->hash >> 32), (unsigned int) job->hash,
+           job->size);
+}
+
+//
+// I_ReadMusCache
+//
+// Reads a conversion back from the disk cache. Worker thread.
+//
+static boolean I_ReadMusCache(musjob_t *job)
+{
+   char name[PATH_MAX+32];
+   FILE *fp;
+   long len;
+
+   I_MusCacheName(name, job);
+   if(!(fp = fopen(name, "rb")))
+      return false;
+
+   if(!fseek(fp, 0, SEEK_END) && (len = ftell(fp)) > 14 && len < INT_MAX &&
+      !fseek(fp, 0, SEEK_SET) && (job->mid = (malloc)(len)))
+   {
+      if(fread(job->mid, 1, len, fp) == (size_t) len &&
+         !memcmp(job->mid, "MThd", 4))
+         job->midlen = len;
+      else
+      {
+         (free)(job->mid);
+         job->mid = NULL;
+      }
+   }
+
+   fclose(fp);
+   return job->mid != NULL;
+}
+
+static boolean I_WriteMusData(FILE *fp, void *data)
+{
+   const musjob_t *job = data;
+
+   return fwrite(job->mid, 1, job->midlen, fp) == (size_t) job->midlen;
+}
+
+//
+// I_WriteMusCache
+//
+// Worker thread.
+//
+static void I_WriteMusCache(musjob_t *job)
+{
+   char name[PATH_MAX+32];
+
+   I_MusCacheName(name, job);
+   M_WriteFileAtomic(name, I_WriteMusData, job);
+}
+
+// Worker thread body. Must not touch the zone heap or game state.
+
+static int I_MusConverter(void *unused)
+{
+   musjob_t *job = &musjob;
+
+   if(!*muscachedir || !I_ReadMusCache(job))
+   {
+      if(mus2midi(job->mus, 89, &job->mid, &job->midlen))
+         job->mid = NULL;
+      else
+         if(*muscachedir)
+            I_WriteMusCache(job);
+   }
+
+   I_LockMutex(muslock);
+   musdone = true;
+   I_UnlockMutex(muslock);
+   return 0;
+}
+
+static void I_StartMusConversion(void)
+{
+   musdone = false;
+   musworker = I_CreateThread(I_MusConverter, NULL);
+}
+
+//
+// I_QueueMusConversion
+//
+// Only one conversion runs at a time; a song asked for while another
+// is converting waits behind it, replacing any song waiting already.
+//
+static void I_QueueMusConversion(const byte *data, int size, ULong64 hash)
+{
+   musjob_t *job = musworker ? &musnext : &musjob;
+
+   if(musworker && musjob.hash == hash && musjob.size == size)
+   {
+      (free)(musnext.mus);      // back to the song already converting
+      musnext.mus = NULL;
+      return;
+   }
+
+   (free)(job->mus);
+   if(!(job->mus = (malloc)(size)))
+   {
+      muspending.waiting = false;
+      return;
+   }
+   memcpy(job->mus, data, size);
+   job->hash = hash;
+   job->size = size;
+   job->mid = NULL;
+
+   if(!musworker)
+      I_StartMusConversion();
+}
+
+//
+// I_LoadSong
+//
+// Hands a cached conversion to SDL_mixer, which reads straight from it.
+//
+static int I_LoadSong(muscache_t *mc)
+{
+   rw    = SDL_RWFromMem(mc->mid, mc->midlen);
+   music = Mix_LoadMUS_RW(rw, false);
+
+   if(music == NULL)
+   {
+      SDL_FreeRW(rw);
+      rw = NULL;
+      return 0;
+   }
+
+   musloaded = mc;
+   return 1;
+}
+
+//
+// I_UpdateMusic
+//
+// Picks up a finished conversion and starts the pending song, if it
+// was the one converted.
+//
+static void I_UpdateMusic(void)
+{
+   boolean done;
+
+   if(musworker)
+   {
+      I_LockMutex(muslock);
+      done = musdone;
+      I_UnlockMutex(muslock);
+
+      if(!done)
+         return;
+
+      I_WaitThread(musworker);
+      musworker = NULL;
+      (free)(musjob.mus);
+      musjob.mus = NULL;
+
+      if(musjob.mid)
+         I_MusCacheAdd(&musjob);
+      else
+         if(muspending.waiting && muspending.hash == musjob.hash &&
+            muspending.size == musjob.size)
+         {
+            doom_printf("Error loading music");
+            muspending.waiting = false;
+         }
+
+      if(musnext.mus)
+      {
+         musjob = musnext;
+         musnext.mus = NULL;
+         I_StartMusConversion();
+      }
+   }
+
+   if(muspending.waiting)
+   {
+      muscache_t *mc = I_MusCacheFind(muspending.hash, muspending.size);
+
+      if(mc)
+      {
+         muspending.waiting = false;
+         if(I_LoadSong(mc) && muspending.play)
+         {
+            I_PlaySong(1, muspending.looping);
+            if(muspending.paused)
+               I_PauseSong(1);
+         }
+      }
+   }
+}
+
 //
 // I_ShutdownMusic
 //
@@ -682,6 +1481,9 @@ static void *music_block = NULL;
 void I_ShutdownMusic(void)
 {
    I_UnRegisterSong(1);
+   if(musworker)
+      I_WaitThread(musworker);
+   musworker = NULL;
 }
 
 //
@@ -699,6 +1501,13 @@ void I_InitMusic(void)
       printf("I_InitMusic: Music is disabled.\n");
       break;
    }
+
+   muslock = I_CreateMutex();
+
+   if(!M_CheckParm("-nomuscache"))
+   {
+      M_CacheDir(muscachedir, "muscache");
+   }
    
    atexit(I_ShutdownMusic);
 }
@@ -710,6 +1519,13 @@ void I_PlaySong(int handle, int looping)
    if(!mus_init)
       return;
 
+   if(handle && muspending.waiting)
+   {
+      muspending.play = true;
+      muspending.looping = looping;
+      return;
+   }
+
    if(CHECK_MUSIC(handle) && Mix_PlayMusic(music, looping ? -1 : 0) == -1)
    {
       doom_printf("I_PlaySong: Mix_PlayMusic failed\n");
@@ -736,6 +1552,9 @@ static int paused_midi_volume;
 //
 void I_PauseSong(int handle)
 {
+   if(handle && muspending.waiting)
+      muspending.paused = true;
+   else
    if(CHECK_MUSIC(handle))
    {
       // Not for mids
@@ -755,6 +1574,9 @@ void I_PauseSong(int handle)
 //
 void I_ResumeSong(int handle)
 {
+   if(handle && muspending.waiting)
+      muspending.paused = false;
+   else
    if(CHECK_MUSIC(handle))
    {
       // Not for mids
@@ -770,6 +1592,9 @@ void I_ResumeSong(int handle)
 //
 void I_StopSong(int handle)
 {
+   if(handle && muspending.waiting)
+      muspending.play = false;
+   else
    if(CHECK_MUSIC(handle))
       Mix_HaltMusic();
 }
@@ -779,6 +1604,9 @@ void I_StopSong(int handle)
 //
 void I_UnRegisterSong(int handle)
 {
+   if(handle)
+      muspending.waiting = false;
+
    if(CHECK_MUSIC(handle))
    {   
       // Stop and free song
@@ -789,14 +1617,10 @@ void I_UnRegisterSong(int handle)
       if(rw != NULL)
          SDL_FreeRW(rw);
       
-      // Free music block
-      if(music_block != NULL)
-         free(music_block);
-      
-      // Reinitialize all this
+      // Reinitialize all this; the cache keeps the converted song
       music = NULL;
       rw = NULL;
-      music_block = NULL;
+      musloaded = NULL;
    }
 }
 
@@ -805,50 +1629,34 @@ void I_UnRegisterSong(int handle)
 //
 int I_RegisterSong(void *data, int size)
 {
-   if(music != NULL)
+   if(music != NULL || muspending.waiting)
       I_UnRegisterSong(1);
-   
+
+   // a mus is converted in the background, unless it was already
+   if(size >= 4 && !memcmp(data, MUS_MAGIC, 4))
+   {
+      ULong64 hash = M_Hash64(M_HASHINIT, data, size);
+      muscache_t *mc = I_MusCacheFind(hash, size);
+
+      if(mc)
+         return I_LoadSong(mc);
+
+      muspending.waiting = true;
+      muspending.play = muspending.paused = false;
+      muspending.hash = hash;
+      muspending.size = size;
+      I_QueueMusConversion(data, size, hash);
+      return 1;
+   }
+
    rw    = SDL_RWFromMem(data, size);
    music = Mix_LoadMUS_RW(rw, false);
    
-   // It's not recognized by SDL_mixer, is it a mus?
    if(music == NULL)
-   {      
-      int err;
-      MIDI mididata;
-      UBYTE *mid;
-      int midlen;
-      
+   {
       SDL_FreeRW(rw);
       rw = NULL;
-
-      memset(&mididata, 0, sizeof(MIDI));
-      
-      if((err = mmus2mid((byte *)data, &mididata, 89, 0))) 
-      {         
-         // Nope, not a mus.
-         doom_printf("Error loading music: %d", err);
-         return 0;
-      }
-
-      // Hurrah! Let's make it a mid and give it to SDL_mixer
-      MIDIToMidi(&mididata, &mid, &midlen);
-      rw    = SDL_RWFromMem(mid, midlen);
-      music = Mix_LoadMUS_RW(rw, false);
-
-      if(music == NULL) 
-      {   
-         // Conversion failed, free everything
-         SDL_FreeRW(rw);
-         rw = NULL;
-         free(mid);         
-      } 
-      else 
-      {   
-         // Conversion succeeded
-         // -> save memory block to free when unregistering
-         music_block = mid;
-      }
+      doom_printf("Error loading music");
    }
    
    // the handle is a simple boolean
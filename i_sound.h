@@ -65,6 +65,9 @@ void I_SetChannels(void);
 // Get raw data lump index for sound descriptor.
 int I_GetSfxLumpNum(sfxinfo_t *sfxinfo);
 
+// Converts the flagged sounds in the background, ahead of their use.
+void I_PrecacheSounds(const boolean *needed);
+
 // Starts a sound in a particular sound channel.
 int I_StartSound(sfxinfo_t *sound, int cnum, int vol, int sep, int pitch, 
                  int pri);
@@ -65,6 +65,24 @@ void I_WaitVBL(int count)
    SDL_Delay((count*500)/TICRATE);
 }
 
+void I_Sleep(int ms)
+{
+   SDL_Delay(ms);
+}
+
+Long64 I_GetTimeUS(void)
+{
+   static Uint64 base;
+   Uint64 now = SDL_GetPerformanceCounter(), freq = SDL_GetPerformanceFrequency();
+
+   if (!base)
+      base = now;
+   now -= base;
+
+   // split up, so the multiplication cannot overflow
+   return (Long64)(now / freq * 1000000 + now % freq * 1000000 / freq);
+}
+
 // Most of the following has been rewritten by Lee Killough
 //
 // I_GetTime
@@ -260,6 +278,184 @@ void I_Init(void)
    }
 }
 
+//
+// Worker threads
+//
+// Thin wrappers so that game code need not include SDL headers.
+//
+
+i_thread_t *I_CreateThread(int (*func)(void *), void *data)
+{
+  SDL_Thread *thread = SDL_CreateThread(func, "reboom worker", data);
+
+  if (!thread)
+    I_Error("I_CreateThread: %s", SDL_GetError());
+  return (i_thread_t *) thread;
+}
+
+int I_WaitThread(i_thread_t *thread)
+{
+  int status = 0;
+  SDL_WaitThread((SDL_Thread *) thread, &status);
+  return status;
+}
+
+i_mutex_t *I_CreateMutex(void)
+{
+  SDL_mutex *mutex = SDL_CreateMutex();
+
+  if (!mutex)
+    I_Error("I_CreateMutex: %s", SDL_GetError());
+  return (i_mutex_t *) mutex;
+}
+
+void I_LockMutex(i_mutex_t *mutex)
+{
+  SDL_LockMutex((SDL_mutex *) mutex);
+}
+
+void I_UnlockMutex(i_mutex_t *mutex)
+{
+  SDL_UnlockMutex((SDL_mutex *) mutex);
+}
+
+//
+// Task pool
+//
+// Workers are started as tasks are queued, up to one less than the
+// number of CPUs, and exit again once there is nothing left to do.
+// There is room for a full lump prefetch queue (w_wad.c) on top of the
+// startup jobs.
+//
+
+#define MAXTASKS        1040
+#define MAXTASKTHREADS  4
+
+enum { TASK_FREE, TASK_QUEUED, TASK_BUSY, TASK_DONE };
+
+struct i_task_s {
+  int state;                  // guarded by tasklock
+  void (*func)(void *);
+  void *data;
+};
+
+static struct i_task_s tasks[MAXTASKS];
+static i_mutex_t *tasklock;
+static SDL_cond *taskdone;    // signalled as each task is done
+
+static struct {
+  i_thread_t *thread;
+  boolean running;            // guarded by tasklock
+} taskthreads[MAXTASKTHREADS];
+
+static int I_TaskWorker(void *index)
+{
+  for (;;)
+    {
+      i_task_t *task;
+
+      I_LockMutex(tasklock);
+      for (task = tasks; task < tasks + MAXTASKS; task++)
+        if (task->state == TASK_QUEUED)
+          break;
+      if (task == tasks + MAXTASKS)
+        {
+          taskthreads[(intptr_t) index].running = false;
+          I_UnlockMutex(tasklock);
+          return 0;
+        }
+      task->state = TASK_BUSY;
+      I_UnlockMutex(tasklock);
+
+      task->func(task->data);
+
+      I_LockMutex(tasklock);
+      task->state = TASK_DONE;
+      SDL_CondBroadcast(taskdone);
+      I_UnlockMutex(tasklock);
+    }
+}
+
+i_task_t *I_StartTask(void (*func)(void *), void *data)
+{
+  int i, numthreads = SDL_GetCPUCount() - 1;
+  i_task_t *task;
+
+  if (numthreads > MAXTASKTHREADS)
+    numthreads = MAXTASKTHREADS;
+
+  if (!tasklock)
+    {
+      tasklock = I_CreateMutex();
+      if (!(taskdone = SDL_CreateCond()))
+        I_Error("I_StartTask: %s", SDL_GetError());
+    }
+
+  I_LockMutex(tasklock);
+  for (task = tasks; task < tasks + MAXTASKS; task++)
+    if (task->state == TASK_FREE)
+      break;
+  if (task == tasks + MAXTASKS || numthreads < 1)
+    {
+      I_UnlockMutex(tasklock);
+      func(data);             // nowhere to put it, so do it now
+      return NULL;
+    }
+
+  task->func = func;
+  task->data = data;
+  task->state = TASK_QUEUED;
+
+  for (i = 0; i < numthreads; i++)
+    if (!taskthreads[i].running)
+      {
+        // reap a worker which ran out of work before starting it again
+        if (taskthreads[i].thread)
+          I_WaitThread(taskthreads[i].thread);
+        taskthreads[i].running = true;
+        taskthreads[i].thread =
+          I_CreateThread(I_TaskWorker, (void *)(intptr_t) i);
+      }
+  I_UnlockMutex(tasklock);
+
+  return task;
+}
+
+boolean I_TaskDone(i_task_t *task)
+{
+  int state;
+
+  if (!task)
+    return true;
+
+  I_LockMutex(tasklock);
+  state = task->state;
+  I_UnlockMutex(tasklock);
+  return state == TASK_DONE;
+}
+
+void I_FinishTask(i_task_t *task)
+{
+  int state;
+
+  if (!task)                  // already done by I_StartTask
+    return;
+
+  I_LockMutex(tasklock);
+  while ((state = task->state) == TASK_BUSY)
+    SDL_CondWait(taskdone, (SDL_mutex *) tasklock);
+  if (state == TASK_QUEUED)
+    task->state = TASK_BUSY;
+  I_UnlockMutex(tasklock);
+
+  if (state == TASK_QUEUED)   // now marked busy, so the workers skip it
+    task->func(task->data);
+
+  I_LockMutex(tasklock);
+  task->state = TASK_FREE;
+  I_UnlockMutex(tasklock);
+}
+
 int waitAtExit;
 
 //
@@ -281,6 +477,7 @@ void I_Quit (void)
 
    if (demorecording)
       G_CheckDemoStatus();
+   G_WaitSaveGame();
    M_SaveDefaults();
 }
 
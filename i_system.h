@@ -45,6 +45,12 @@ void I_Init(void);
 extern int (*I_GetTime)();           // killough
 int I_GetTime_RealTime();     // killough
 int I_GetTime_Adaptive(void); // killough 4/10/98
+
+// Gives up the CPU for at least ms milliseconds
+void I_Sleep(int ms);
+
+// Microseconds since the first call, for profiling
+Long64 I_GetTimeUS(void);
 extern int GetTime_Scale;
 
 //
@@ -94,6 +100,30 @@ extern int mousepresent;                // killough
 
 void I_EndDoom(byte *data);
 
+// Worker threads for background I/O and conversion jobs. Thread bodies
+// must not touch the zone heap, so they allocate with (malloc)/(free).
+
+typedef struct i_thread_s i_thread_t;
+typedef struct i_mutex_s i_mutex_t;
+
+i_thread_t *I_CreateThread(int (*func)(void *), void *data);
+int I_WaitThread(i_thread_t *thread);
+i_mutex_t *I_CreateMutex(void);
+void I_LockMutex(i_mutex_t *mutex);
+void I_UnlockMutex(i_mutex_t *mutex);
+
+// A pool of workers for independent jobs, such as the parts of startup
+// which do not depend on each other, and lump prefetches. I_FinishTask
+// waits for a task, running it right there if no worker has got to it
+// yet, and must be called for every task started. I_TaskDone tells
+// whether it would have to wait.
+
+typedef struct i_task_s i_task_t;
+
+i_task_t *I_StartTask(void (*func)(void *), void *data);
+boolean I_TaskDone(i_task_t *task);
+void I_FinishTask(i_task_t *task);
+
 // killough 3/21/98: keyboard queue
 
 #define KQSIZE 256
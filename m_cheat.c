@@ -74,6 +74,8 @@ static void cheat_ammo();
 static void cheat_ammox();
 static void cheat_smart();
 static void cheat_pitch();
+static void cheat_zone();
+static void cheat_memsites();
 static void legend();
 
 //-----------------------------------------------------------------------------
@@ -227,6 +229,12 @@ struct cheat_s cheat[] = {
   {"legend",      NULL,          not_net | not_demo,
    legend      },
 
+  {"zone",    NULL,                   always,
+   cheat_zone  },     // zone instrumentation toggle
+
+  {"memsites", NULL,                  always,
+   cheat_memsites },  // zone memory by allocation site
+
   {NULL}                 // end-of-list marker
 };
 
@@ -607,6 +615,36 @@ static void cheat_pitch()
     "Pitch Effects Disabled";
 }
 
+// Turns the zone instrumentation on and off, sampling as -zonedebug did
+static void cheat_zone()
+{
+#ifdef INSTRUMENTED
+  static int rate = 1;
+
+  if (zone_instrument)
+    rate = zone_instrument, zone_instrument = 0;
+  else
+    zone_instrument = rate;
+  plyr->message = zone_instrument ? "Zone Instrumentation On" :
+    "Zone Instrumentation Off";
+#else
+  plyr->message = "Zone Instrumentation Not Built In";
+#endif
+}
+
+// Shows the zone memory of the largest allocation sites
+static void cheat_memsites()
+{
+#ifdef INSTRUMENTED
+  extern int hud_memsites;
+  plyr->message = (hud_memsites = !hud_memsites) ?
+    zone_instrument ? "Memory Sites On" : "Memory Sites On (Zone Instrumentation Off)" :
+    "Memory Sites Off";
+#else
+  plyr->message = "Zone Instrumentation Not Built In";
+#endif
+}
+
 // Adam - you're a legend!
 static void legend()
 {
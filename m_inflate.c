@@ -0,0 +1,380 @@
+// Emacs style mode select   -*- C++ -*-
+//-----------------------------------------------------------------------------
+//
+//  This program is free software; you can redistribute it and/or
+//  modify it under the terms of the GNU General Public License
+//  as published by the Free Software Foundation; either version 2
+//  of the License, or (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+//  02111-1307, USA.
+//
+// DESCRIPTION:
+//      Raw DEFLATE (RFC 1951) decompression.
+//
+// Huffman codes are decoded through a table indexed by the next few
+// input bits, which resolves nearly every literal and length in one
+// lookup; the rare longer codes fall back to a canonical search over
+// the code lengths. The whole stream is decompressed in one call into
+// a buffer of known size, which is all zip entries need, so there is
+// no sliding window or resumable state.
+//
+//-----------------------------------------------------------------------------
+
+#include <string.h>
+
+#include "m_inflate.h"
+
+#define INF_FASTBITS  9
+#define INF_FASTMASK  ((1 << INF_FASTBITS) - 1)
+#define INF_MAXBITS   15
+#define INF_MAXSYMS   288
+
+typedef struct
+{
+  unsigned short fast[1 << INF_FASTBITS];  // length << 9 | symbol, or 0
+  unsigned short firstcode[INF_MAXBITS + 1];
+  unsigned short firstsym[INF_MAXBITS + 1];
+  int maxcode[INF_MAXBITS + 2];            // bit-reversed limits per length
+  unsigned short symbols[INF_MAXSYMS];     // in canonical code order
+} huffman_t;
+
+typedef struct
+{
+  const byte *src;
+  size_t pos, n;        // pos runs past n as zero padding is fed in
+  unsigned bitbuf;
+  int bitcnt;
+  byte *out, *outstart, *outend;
+} inflate_t;
+
+static const unsigned short lenbase[29] = {
+  3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+  35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+};
+
+static const byte lenextra[29] = {
+  0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+  3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+};
+
+static const unsigned short distbase[30] = {
+  1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+  257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145,
+  8193, 12289, 16385, 24577
+};
+
+static const byte distextra[30] = {
+  0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+  7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+};
+
+// order in which code length code lengths are sent
+static const byte codeorder[19] = {
+  16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15
+};
+
+static unsigned INF_Reverse16(unsigned n)
+{
+  n = (n & 0xaaaa) >> 1 | (n & 0x5555) << 1;
+  n = (n & 0xcccc) >> 2 | (n & 0x3333) << 2;
+  n = (n & 0xf0f0) >> 4 | (n & 0x0f0f) << 4;
+  return (n & 0xff00) >> 8 | (n & 0x00ff) << 8;
+}
+
+// Keeps at least 25 bits buffered. Past the end of the input zeros are
+// fed in; M_Inflate checks afterwards that none of them were used.
+
+static void INF_Fill(inflate_t *s)
+{
+  while (s->bitcnt <= 24)
+    {
+      if (s->pos < s->n)
+        s->bitbuf |= (unsigned) s->src[s->pos] << s->bitcnt;
+      s->pos++;
+      s->bitcnt += 8;
+    }
+}
+
+static int INF_Bits(inflate_t *s, int count)
+{
+  int v;
+
+  INF_Fill(s);
+  v = s->bitbuf & ((1u << count) - 1);
+  s->bitbuf >>= count;
+  s->bitcnt -= count;
+  return v;
+}
+
+//
+// INF_Build
+// Builds the decoding tables for a canonical code from its code lengths.
+// Returns false for oversubscribed codes; incomplete ones are allowed,
+// and unused codes fail when decoded.
+//
+
+static boolean INF_Build(huffman_t *h, const byte *lengths, int num)
+{
+  int count[INF_MAXBITS + 1], next[INF_MAXBITS + 1];
+  int i, code = 0, k = 0;
+
+  memset(count, 0, sizeof count);
+  memset(h->fast, 0, sizeof h->fast);
+
+  for (i = 0; i < num; i++)
+    count[lengths[i]]++;
+
+  for (i = 1; i <= INF_MAXBITS; i++)
+    {
+      next[i] = h->firstcode[i] = code;
+      h->firstsym[i] = k;
+      code += count[i];
+      if (count[i] && code - 1 >= 1 << i)
+        return false;
+      h->maxcode[i] = code << (16 - i);
+      code <<= 1;
+      k += count[i];
+    }
+  h->maxcode[INF_MAXBITS + 1] = 0x10000;  // stops the search
+
+  for (i = 0; i < num; i++)
+    {
+      int len = lengths[i];
+
+      if (len)
+        {
+          h->symbols[next[len] - h->firstcode[len] + h->firstsym[len]] = i;
+
+          if (len <= INF_FASTBITS)
+            {
+              int j = INF_Reverse16(next[len]) >> (16 - len);
+
+              for (; j < 1 << INF_FASTBITS; j += 1 << len)
+                h->fast[j] = len << 9 | i;
+            }
+          next[len]++;
+        }
+    }
+
+  return true;
+}
+
+//
+// INF_Decode
+// Returns the next symbol, or -1 for a code not in the table.
+//
+
+static int INF_Decode(inflate_t *s, const huffman_t *h)
+{
+  int b, k, len;
+
+  INF_Fill(s);
+
+  if ((b = h->fast[s->bitbuf & INF_FASTMASK]))
+    {
+      len = b >> 9;
+      s->bitbuf >>= len;
+      s->bitcnt -= len;
+      return b & 511;
+    }
+
+  k = INF_Reverse16(s->bitbuf & 0xffff);
+  for (len = INF_FASTBITS + 1; k >= h->maxcode[len]; len++)
+    ;
+  if (len > INF_MAXBITS)
+    return -1;
+
+  s->bitbuf >>= len;
+  s->bitcnt -= len;
+  return h->symbols[(k >> (16 - len)) - h->firstcode[len] + h->firstsym[len]];
+}
+
+//
+// INF_Codes
+// Decodes the literals and matches of one compressed block.
+//
+
+static boolean INF_Codes(inflate_t *s, const huffman_t *lit,
+                         const huffman_t *dist)
+{
+  for (;;)
+    {
+      int sym = INF_Decode(s, lit);
+
+      if (sym < 256)
+        {
+          if (sym < 0 || s->out == s->outend)
+            return false;
+          *s->out++ = sym;
+        }
+      else
+        if (sym == 256)
+          return true;
+        else
+          {
+            const byte *from;
+            int len, d;
+
+            if ((sym -= 257) >= 29)
+              return false;
+            len = lenbase[sym] + INF_Bits(s, lenextra[sym]);
+
+            if ((d = INF_Decode(s, dist)) < 0 || d >= 30)
+              return false;
+            d = distbase[d] + INF_Bits(s, distextra[d]);
+
+            if (d > s->out - s->outstart || len > s->outend - s->out)
+              return false;
+
+            for (from = s->out - d; len--; )   // may overlap: byte by byte
+              *s->out++ = *from++;
+          }
+    }
+}
+
+static boolean INF_Stored(inflate_t *s)
+{
+  const byte *p;
+  unsigned len;
+
+  // drop to a byte boundary, and give back the whole bytes buffered
+  s->pos -= s->bitcnt >> 3;
+  s->bitbuf = s->bitcnt = 0;
+
+  if (s->pos + 4 > s->n)
+    return false;
+  p = s->src + s->pos;
+  len = p[0] | p[1] << 8;
+  if (len != (~(p[2] | p[3] << 8) & 0xffff))
+    return false;
+  s->pos += 4;
+
+  if (len > s->n - s->pos || len > (size_t)(s->outend - s->out))
+    return false;
+  memcpy(s->out, s->src + s->pos, len);
+  s->out += len;
+  s->pos += len;
+  return true;
+}
+
+static boolean INF_Fixed(inflate_t *s)
+{
+  huffman_t lit, dist;
+  byte lengths[INF_MAXSYMS];
+
+  memset(lengths, 8, 144);
+  memset(lengths + 144, 9, 256 - 144);
+  memset(lengths + 256, 7, 280 - 256);
+  memset(lengths + 280, 8, INF_MAXSYMS - 280);
+  INF_Build(&lit, lengths, INF_MAXSYMS);
+
+  memset(lengths, 5, 30);
+  INF_Build(&dist, lengths, 30);
+
+  return INF_Codes(s, &lit, &dist);
+}
+
+static boolean INF_Dynamic(inflate_t *s)
+{
+  huffman_t lit, dist;
+  byte lengths[286 + 30];
+  int nlen, ndist, ncode, i;
+
+  nlen = INF_Bits(s, 5) + 257;
+  ndist = INF_Bits(s, 5) + 1;
+  ncode = INF_Bits(s, 4) + 4;
+  if (nlen > 286 || ndist > 30)
+    return false;
+
+  // the code lengths are themselves Huffman coded
+  memset(lengths, 0, 19);
+  for (i = 0; i < ncode; i++)
+    lengths[codeorder[i]] = INF_Bits(s, 3);
+  if (!INF_Build(&lit, lengths, 19))
+    return false;
+
+  for (i = 0; i < nlen + ndist; )
+    {
+      int sym = INF_Decode(s, &lit), rep, val = 0;
+
+      if (sym < 0)
+        return false;
+      if (sym < 16)
+        {
+          lengths[i++] = sym;
+          continue;
+        }
+
+      if (sym == 16)
+        {
+          if (!i)
+            return false;
+          val = lengths[i - 1];
+          rep = 3 + INF_Bits(s, 2);
+        }
+      else
+        rep = sym == 17 ? 3 + INF_Bits(s, 3) : 11 + INF_Bits(s, 7);
+
+      if (rep > nlen + ndist - i)
+        return false;
+      while (rep--)
+        lengths[i++] = val;
+    }
+
+  if (!lengths[256])        // no end of block code
+    return false;
+
+  return INF_Build(&lit, lengths, nlen) &&
+    INF_Build(&dist, lengths + nlen, ndist) &&
+    INF_Codes(s, &lit, &dist);
+}
+
+size_t M_Inflate(const byte *src, size_t n, byte *dst, size_t dstsize)
+{
+  inflate_t s;
+  int last;
+
+  s.src = src;
+  s.pos = 0;
+  s.n = n;
+  s.bitbuf = s.bitcnt = 0;
+  s.out = s.outstart = dst;
+  s.outend = dst + dstsize;
+
+  do
+    {
+      boolean ok;
+
+      last = INF_Bits(&s, 1);
+      switch (INF_Bits(&s, 2))
+        {
+        case 0:
+          ok = INF_Stored(&s);
+          break;
+        case 1:
+          ok = INF_Fixed(&s);
+          break;
+        case 2:
+          ok = INF_Dynamic(&s);
+          break;
+        default:
+          ok = false;
+        }
+      if (!ok)
+        return 0;
+    }
+  while (!last);
+
+  if (s.pos - (s.bitcnt >> 3) > n)    // decoded padding past the end
+    return 0;
+
+  return s.out - dst;
+}
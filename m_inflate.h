@@ -0,0 +1,36 @@
+// Emacs style mode select   -*- C++ -*-
+//-----------------------------------------------------------------------------
+//
+//  This program is free software; you can redistribute it and/or
+//  modify it under the terms of the GNU General Public License
+//  as published by the Free Software Foundation; either version 2
+//  of the License, or (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+//  02111-1307, USA.
+//
+// DESCRIPTION:
+//      Raw DEFLATE (RFC 1951) decompression, as used by zip files.
+//
+//-----------------------------------------------------------------------------
+
+#ifndef __M_INFLATE__
+#define __M_INFLATE__
+
+#include <stddef.h>
+#include "doomtype.h"
+
+// Decompresses a raw deflate stream of n bytes into dst, which holds at
+// most dstsize bytes. Returns the decompressed size, or 0 if the stream
+// is corrupt or does not fit. Touches no global state, so it is safe to
+// call from worker threads.
+size_t M_Inflate(const byte *src, size_t n, byte *dst, size_t dstsize);
+
+#endif
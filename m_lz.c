@@ -0,0 +1,190 @@
+// Emacs style mode select   -*- C++ -*-
+//-----------------------------------------------------------------------------
+//
+//  This program is free software; you can redistribute it and/or
+//  modify it under the terms of the GNU General Public License
+//  as published by the Free Software Foundation; either version 2
+//  of the License, or (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+//  02111-1307, USA.
+//
+// DESCRIPTION:
+//      Fast LZ77 block compression.
+//
+// The stream layout is that of an LZ4 block: a token byte holding the
+// literal and match lengths in its high and low nibbles, the literals,
+// a 16-bit little-endian match offset and extra length bytes whenever a
+// nibble saturates. Compression uses a single-probe hash of the next four
+// bytes, which trades some ratio for speed; savegames are dominated by
+// repeated mobj_t images and compress well regardless.
+//
+//-----------------------------------------------------------------------------
+
+#include <string.h>
+
+#include "m_lz.h"
+
+#define LZ_HASHBITS     12
+#define LZ_MINMATCH     4
+#define LZ_LASTLITERALS 5     // last bytes of a block are always literals
+#define LZ_MFLIMIT      12    // no match may start closer than this to end
+#define LZ_MAXOFFSET    65535
+#define LZ_SKIPSHIFT    6     // speed up over incompressible data
+
+static unsigned LZ_Read32(const byte *p)
+{
+  unsigned v;
+  memcpy(&v, p, sizeof v);
+  return v;
+}
+
+static unsigned LZ_Hash(unsigned v)
+{
+  return (v * 2654435761u) >> (32 - LZ_HASHBITS);
+}
+
+static byte *LZ_PutLength(byte *op, size_t len)
+{
+  for (; len >= 255; len -= 255)
+    *op++ = 255;
+  *op++ = (byte) len;
+  return op;
+}
+
+static byte *LZ_PutLiterals(byte *op, const byte *anchor, size_t lit)
+{
+  *op++ = (byte)((lit >= 15 ? 15 : lit) << 4);
+  if (lit >= 15)
+    op = LZ_PutLength(op, lit - 15);
+  memcpy(op, anchor, lit);
+  return op + lit;
+}
+
+size_t M_LZCompress(const byte *src, size_t n, byte *dst)
+{
+  unsigned table[1 << LZ_HASHBITS];   // offsets into src, 0 when unused
+  const byte *ip = src, *anchor = src, *const end = src + n;
+  const byte *const mflimit = n > LZ_MFLIMIT ? end - LZ_MFLIMIT : src;
+  byte *op = dst;
+
+  memset(table, 0, sizeof table);
+
+  while (ip < mflimit)
+    {
+      unsigned h = LZ_Hash(LZ_Read32(ip));
+      const byte *ref = src + table[h];
+
+      table[h] = (unsigned)(ip - src);
+
+      if (ref >= ip || ip - ref > LZ_MAXOFFSET ||
+          LZ_Read32(ref) != LZ_Read32(ip))
+        {
+          ip += 1 + ((ip - anchor) >> LZ_SKIPSHIFT);
+          continue;
+        }
+
+      {
+        const byte *const mlimit = end - LZ_LASTLITERALS;
+        const byte *mp = ip + LZ_MINMATCH, *rp = ref + LZ_MINMATCH;
+        size_t mlen;
+        byte *token = op;
+
+        while (mp < mlimit && *mp == *rp)
+          mp++, rp++;
+        mlen = mp - ip - LZ_MINMATCH;
+
+        op = LZ_PutLiterals(op, anchor, ip - anchor);
+        *op++ = (byte)(ip - ref);
+        *op++ = (byte)((ip - ref) >> 8);
+        *token |= mlen >= 15 ? 15 : mlen;
+        if (mlen >= 15)
+          op = LZ_PutLength(op, mlen - 15);
+
+        ip = anchor = mp;
+      }
+    }
+
+  // the final sequence carries only literals
+  op = LZ_PutLiterals(op, anchor, end - anchor);
+
+  return op - dst;
+}
+
+size_t M_LZDecompress(const byte *src, size_t n, byte *dst, size_t dstsize)
+{
+  const byte *ip = src, *const iend = src + n;
+  byte *op = dst, *const oend = dst + dstsize;
+
+  while (ip < iend)
+    {
+      unsigned token = *ip++;
+      size_t len = token >> 4;
+
+      if (len == 15)
+        {
+          byte b;
+          do
+            {
+              if (ip >= iend)
+                return 0;
+              len += b = *ip++;
+            }
+          while (b == 255);
+        }
+
+      if (len > (size_t)(iend - ip) || len > (size_t)(oend - op))
+        return 0;
+      memcpy(op, ip, len);
+      op += len;
+      ip += len;
+
+      if (ip >= iend)      // last sequence has no match part
+        break;
+
+      {
+        const byte *ref;
+        size_t offset;
+
+        if (iend - ip < 2)
+          return 0;
+        offset = ip[0] | ip[1] << 8;
+        ip += 2;
+        if (!offset || offset > (size_t)(op - dst))
+          return 0;
+
+        len = token & 15;
+        if (len == 15)
+          {
+            byte b;
+            do
+              {
+                if (ip >= iend)
+                  return 0;
+                len += b = *ip++;
+              }
+            while (b == 255);
+          }
+        len += LZ_MINMATCH;
+
+        if (len > (size_t)(oend - op))
+          return 0;
+
+        ref = op - offset;
+        if (offset >= len)
+          memcpy(op, ref, len), op += len;
+        else
+          while (len--)      // overlapping copy repeats the pattern
+            *op++ = *ref++;
+      }
+    }
+
+  return op - dst;
+}
@@ -0,0 +1,42 @@
+// Emacs style mode select   -*- C++ -*-
+//-----------------------------------------------------------------------------
+//
+//  This program is free software; you can redistribute it and/or
+//  modify it under the terms of the GNU General Public License
+//  as published by the Free Software Foundation; either version 2
+//  of the License, or (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+//  02111-1307, USA.
+//
+// DESCRIPTION:
+//      Fast LZ77 block compression (LZ4 block layout).
+//
+//-----------------------------------------------------------------------------
+
+#ifndef __M_LZ__
+#define __M_LZ__
+
+#include <stddef.h>
+#include "doomtype.h"
+
+// Worst case size of a compressed block of n bytes
+#define M_LZBound(n) ((n) + (n)/255 + 16)
+
+// Compresses n bytes of src into dst, which must hold M_LZBound(n) bytes.
+// Returns the compressed size. Touches no global state, so it is safe to
+// call from worker threads.
+size_t M_LZCompress(const byte *src, size_t n, byte *dst);
+
+// Decompresses a block of n bytes into dst, which holds at most dstsize
+// bytes. Returns the decompressed size, or 0 if the block is corrupt.
+size_t M_LZDecompress(const byte *src, size_t n, byte *dst, size_t dstsize);
+
+#endif
@@ -234,6 +234,7 @@ extern int key_map_mark;                                            //    ^
 extern int key_map_clear;                                           //    |
 extern int key_map_grid;                                            // phares
 extern int key_screenshot;    // killough 2/22/98
+extern int key_rewind;
 
 // phares 3/30/98
 // externs added for setup menus
@@ -2352,6 +2353,7 @@ setup_menu_t keys_settings2[] =  // Key Binding screen strings
   {"QUICKLOAD"   ,S_KEY       ,m_scrn,KB_X,KB_Y + 16 * 8,{&key_quickload}},
   {"END GAME"    ,S_KEY       ,m_scrn,KB_X,KB_Y + 17 * 8,{&key_endgame}},
   {"QUIT"        ,S_KEY       ,m_scrn,KB_X,KB_Y + 18 * 8,{&key_quit}},
+  {"REWIND"      ,S_KEY       ,m_scrn,KB_X,KB_Y + 19 * 8,{&key_rewind}},
   {"<- PREV", S_SKIP | S_PREV,m_null,KB_PREV,KB_Y + 20 * 8, {keys_settings1}},
   {"NEXT ->", S_SKIP | S_NEXT,m_null,KB_NEXT,KB_Y + 20 * 8, {keys_settings3}},
 
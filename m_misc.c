@@ -29,7 +29,12 @@
 //
 //-----------------------------------------------------------------------------
 
+#ifdef WINDOWS
+#include "win_fopen.h"
+#endif
 #include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
 #include "doomstat.h"
 #include "m_argv.h"
 #include "g_game.h"
@@ -80,6 +85,7 @@ extern int grabmouse;
 extern int cfg_scalefactor; // haleyjd 05/11/09
 extern int cfg_aspectratio; // haleyjd 05/11/09
 extern int disk_icon;
+extern int rewind_depth, rewind_interval;
 extern char *chat_macros[];
 
 //jff 3/3/98 added min, max, and help string to all entries
@@ -187,6 +193,20 @@ default_t defaults[] = {
     "number of dead bodies in view supported (negative value = no limit)"
   },
 
+  {
+    "rewind_depth",
+    (config_t *) &rewind_depth, NULL,
+    {0}, {0,3600}, number, ss_none, wad_no,
+    "number of rewind snapshots kept in memory, 0 disables rewinding"
+  },
+
+  {
+    "rewind_interval",
+    (config_t *) &rewind_interval, NULL,
+    {35}, {1,3500}, number, ss_none, wad_no,
+    "tics between rewind snapshots (35 = one second)"
+  },
+
   { // killough 3/31/98
     "demo_insurance",
     (config_t *) &default_demo_insurance, NULL,
@@ -215,6 +235,13 @@ default_t defaults[] = {
     "1 to enable monsters remembering enemies after killing others"
   },
 
+  {
+    "monster_dormancy",
+    (config_t *) &default_monster_dormancy, (config_t *) &monster_dormancy,
+    {0}, {0,1}, number, ss_none, wad_no,
+    "1 to park idle monsters far from all players until woken (not vanilla)"
+  },
+
   { // no color changes on status bar
     "sts_always_red",
     (config_t *) &sts_always_red, NULL,
@@ -754,6 +781,13 @@ default_t defaults[] = {
     "key to take a screenshot (devparm independent)"
   },
 
+  {
+    "key_rewind",
+    (config_t *) &key_rewind, NULL,
+    {KEYD_INSERT}, {0,255}, number, ss_keys, wad_no,
+    "key to step back to the previous rewind snapshot"
+  },
+
   { // HOME key  // killough 10/98: shortcut to setup menu
     "key_setup",
     (config_t *) &key_setup, NULL,
@@ -1360,6 +1394,20 @@ default_t defaults[] = {
      "1 to precache all sound effects"
    },
 
+  {
+    "zip_cache_size",
+    (config_t *) &zip_cache_size, NULL,
+    {16384}, {0, 1048576}, number, ss_none, wad_no,
+    "KB of decompressed zip/pk3 lumps to keep cached"
+  },
+
+  {
+    "lump_cache_size",
+    (config_t *) &lump_cache_size, NULL,
+    {0}, {0, 4194304}, number, ss_none, wad_no,
+    "KB of lumps to keep cached, least recently used freed first (0 = no limit)"
+  },
+
   {NULL}         // last entry
 };
 
@@ -1847,6 +1895,77 @@ int M_ReadFile(char const *name, byte **buffer)
   return 0;
 }
 
+//
+// Cache files
+//
+// The lump directory, converted music and processed levels are kept
+// between runs in directories under the executable's, each file named
+// after a hash of what it was built from. None of this touches the
+// zone, so worker threads may use it.
+//
+
+// 64-bit FNV-1a
+
+uint64_t M_Hash64(uint64_t hash, const void *data, size_t len)
+{
+  const byte *p = data;
+
+  while (len--)
+    hash = (hash ^ *p++) * 0x100000001b3ull;
+  return hash;
+}
+
+//
+// M_CacheDir
+// Puts the path of the cache directory dir in path, which holds
+// PATH_MAX+1 characters, creating the directory if it is not there.
+//
+
+void M_CacheDir(char *path, const char *dir)
+{
+  sprintf(path, "%.*s/%.15s", PATH_MAX-16, D_DoomExeDir(), dir);
+#ifdef UNIX
+  mkdir(path, S_IRWXU);
+#else
+  mkdir(path);
+#endif
+}
+
+//
+// M_WriteFileAtomic
+// Has write fill in a temporary file, which replaces name only once it
+// is complete, so an interrupted write never leaves a truncated file.
+// Returns false with errno set, and name untouched, if anything failed.
+//
+
+boolean M_WriteFileAtomic(const char *name,
+                          boolean (*write)(FILE *fp, void *data), void *data)
+{
+  char tmpname[PATH_MAX+40];
+  boolean ok;
+  FILE *fp;
+  int err;
+
+  sprintf(tmpname, "%.*s.tmp", PATH_MAX+32, name);
+  if (!(fp = fopen(tmpname, "wb")))
+    return false;
+
+  ok = write(fp, data);
+  if (fclose(fp))
+    ok = false;
+#ifdef WINDOWS
+  if (ok)
+    remove(name);
+#endif
+  if (ok && !rename(tmpname, name))
+    return true;
+
+  err = errno;
+  remove(tmpname);
+  errno = err;
+  return false;
+}
+
 //
 // SCREEN SHOTS
 //
@@ -30,6 +30,7 @@
 #ifndef __M_MISC__
 #define __M_MISC__
 
+#include <stdio.h>
 #include "doomtype.h"
 
 //
@@ -46,6 +47,15 @@ struct default_s *M_LookupDefault(const char *name);     // killough 11/98
 boolean M_ParseOption(const char *name, boolean wad);    // killough 11/98
 void M_LoadOptions(void);                                // killough 11/98
 
+// Cache files under the executable's directory
+
+#define M_HASHINIT 0xcbf29ce484222325ull   // to start M_Hash64 with
+
+uint64_t M_Hash64(uint64_t hash, const void *data, size_t len);
+void M_CacheDir(char *path, const char *dir);
+boolean M_WriteFileAtomic(const char *name,
+                          boolean (*write)(FILE *fp, void *data), void *data);
+
 extern int screenshot_pcx;                               // killough 10/98
 
 // phares 4/21/98:
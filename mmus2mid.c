@@ -33,9 +33,10 @@
 #include "mmus2mid.h"
 
 //#define STANDALONE  /* uncomment this to make MMUS2MID.EXE */
-#ifndef STANDALONE
-#include "z_zone.h"
-#endif
+
+// Conversions run on a worker thread, so everything here is allocated
+// with the C library rather than the zone heap. The track buffers and
+// header templates are static, so only one may run at a time.
 
 // some macros to decode mus event bit fields
 
@@ -714,6 +715,28 @@ int MIDIToMidi(MIDI *mididata,UBYTE **mid,int *midlen)
   return 0;
 }
 
+//
+// mus2midi()
+//
+// Converts a MUS lump in memory straight to a midi 1 format file in memory,
+// freeing the intermediate tracks.
+//
+// Passed a pointer to the MUS lump, the ticks per quarter note, a pointer
+// to a pointer to the midi buffer and a pointer to a length return.
+// Returns 0 if successful, else the error code of the failing step
+//
+int mus2midi(UBYTE *mus, UWORD division, UBYTE **mid, int *midlen)
+{
+  MIDI mididata;
+  int err;
+
+  memset(&mididata, 0, sizeof mididata);
+  if (!(err = mmus2mid(mus, &mididata, division, 0)))
+    err = MIDIToMidi(&mididata, mid, midlen);
+  FreeTracks(&mididata);
+  return err;
+}
+
 #ifdef STANDALONE /* this code unused by BOOM provided for future portability */
                   /* it also provides a MUS to MID file converter*/
 // proff: I moved this down, because I need MIDItoMidi
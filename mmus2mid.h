@@ -63,5 +63,6 @@ typedef struct MIDI                    /* a midi file */
 int mmus2mid(UBYTE *mus,MIDI *mid, UWORD division, int nocomp);
 int MIDIToMidi(MIDI *mididata,UBYTE **mid,int *midlen);
 int MidiToMIDI(UBYTE *mid,MIDI *mididata);
+int mus2midi(UBYTE *mus, UWORD division, UBYTE **mid, int *midlen);
 
 #endif
@@ -101,6 +101,14 @@ void P_RecursiveSound(sector_t* sec, int soundblocks, mobj_t* soundtarget)
     sec->soundtraversed = soundblocks + 1;
     sec->soundtarget = soundtarget;
 
+    if (sec->dormant)       // parked monsters have to hear it too
+    {
+        mobj_t* mo;
+        for (mo = sec->thinglist; mo && sec->dormant; mo = mo->snext)
+            if (mo->dormant)
+                P_WakeMonster(mo);
+    }
+
     for (i = 0; i < sec->linecount; i++)
     {
         sector_t* other;
@@ -135,6 +143,88 @@ void P_NoiseAlert(mobj_t* target, mobj_t* emitter)
     P_RecursiveSound(emitter->subsector->sector, 0, target);
 }
 
+//
+// Dormant monsters
+//
+// With monster_dormancy on, a monster that A_Look leaves idle while far
+// from every player is parked: it moves to the th_dormant thinker class,
+// which P_RunThinkers skips, and P_MobjThinker does nothing for it. A
+// noise reaching its sector or any damage wakes it at once. Once a
+// second the parked monsters are looked over, and those a player has
+// come near, or that a pusher, scroller or sector has set moving, are
+// woken too. Far means out of DORMANT_NEAR, and either out of
+// DORMANT_FAR or unable to see the player according to REJECT.
+//
+// The option is saved with demos and games and sent to the other nodes
+// like monsters_remember, but old demos never use it.
+//
+
+#define DORMANT_NEAR    (2048*FRACUNIT)
+#define DORMANT_FAR     (6144*FRACUNIT)
+#define DORMANT_SWEEP   TICRATE
+
+static boolean P_FarFromPlayers(mobj_t* actor)
+{
+    int i;
+
+    for (i = 0; i < MAXPLAYERS; i++)
+        if (playeringame[i] && players[i].mo)
+        {
+            mobj_t* mo = players[i].mo;
+            fixed_t dist = P_AproxDistance(mo->x - actor->x, mo->y - actor->y);
+            long long pnum = (actor->subsector->sector - sectors) *
+                (long long) numsectors + (mo->subsector->sector - sectors);
+
+            if (dist < DORMANT_NEAR ||
+                (dist < DORMANT_FAR && !(rejectmatrix[pnum>>3] & (1 << (pnum&7)))))
+                return false;
+        }
+    return true;
+}
+
+// Anything moving, or falling, has to be left running
+static boolean P_Settled(mobj_t* actor)
+{
+    return !(actor->momx | actor->momy | actor->momz) &&
+        !(actor->flags & MF_SKULLFLY) &&
+        (actor->z <= actor->floorz || actor->flags & MF_NOGRAVITY);
+}
+
+static void P_ParkMonster(mobj_t* actor)
+{
+    if (actor->player || !P_Settled(actor) || !P_FarFromPlayers(actor))
+        return;
+
+    actor->dormant = true;
+    actor->subsector->sector->dormant++;
+    P_UpdateThinker(&actor->thinker);
+}
+
+void P_WakeMonster(mobj_t* mo)
+{
+    mo->dormant = false;
+    mo->subsector->sector->dormant--;
+    P_UpdateThinker(&mo->thinker);
+}
+
+void P_CheckDormant(void)
+{
+    thinker_t *cap = &thinkerclasscap[th_dormant], *th, *next;
+    boolean on = monster_dormancy && !demo_compatibility;
+
+    if (leveltime % DORMANT_SWEEP)
+        return;
+
+    for (th = cap->cnext; th != cap; th = next)
+    {
+        mobj_t* mo = (mobj_t *) th;
+
+        next = th->cnext;
+        if (!on || !P_Settled(mo) || !P_FarFromPlayers(mo))
+            P_WakeMonster(mo);
+    }
+}
+
 //
 // P_CheckMeleeRange
 //
@@ -527,7 +617,11 @@ void A_Look(mobj_t* actor)
     }
 
     if (!P_LookForPlayers(actor, false))
+    {
+        if (monster_dormancy && !demo_compatibility)
+            P_ParkMonster(actor);
         return;
+    }
 
     // go into chase state
 
@@ -36,6 +36,8 @@
 
 void P_NoiseAlert (mobj_t *target, mobj_t *emmiter);
 void P_SpawnBrainTargets(void); // killough 3/26/98: spawn icon landings
+void P_WakeMonster(mobj_t *mo);
+void P_CheckDormant(void);
 
 extern struct brain_s {         // killough 3/26/98: global state of boss brain
   int easy, targeton;
@@ -71,6 +71,8 @@ result_e T_MovePlane
   fixed_t       destheight; //jff 02/04/98 used to keep floors/ceilings
                             // from moving thru each other
 
+  P_InvalidateSight();      // whatever happens, cached sight may be stale
+
   switch(floorOrCeiling)
   {
     case 0:
@@ -430,7 +432,7 @@ int EV_DoFloor
       
     // new floor thinker
     rtn = 1;
-    floor = Z_Malloc (sizeof(*floor), PU_LEVSPEC, 0);
+    floor = P_AllocThinker(sizeof(*floor));
     P_AddThinker (&floor->thinker);
     sec->floordata = floor; //jff 2/22/98
     floor->thinker.function = T_MoveFloor;
@@ -716,7 +718,7 @@ int EV_BuildStairs
       
     // create new floor thinker for first step
     rtn = 1;
-    floor = Z_Malloc (sizeof(*floor), PU_LEVSPEC, 0);
+    floor = P_AllocThinker(sizeof(*floor));
     P_AddThinker (&floor->thinker);
     sec->floordata = floor;
     floor->thinker.function = T_MoveFloor;
@@ -785,7 +787,7 @@ int EV_BuildStairs
         secnum = newsecnum;
 
         // create and initialize a thinker for the next step
-        floor = Z_Malloc (sizeof(*floor), PU_LEVSPEC, 0);
+        floor = P_AllocThinker(sizeof(*floor));
         P_AddThinker (&floor->thinker);
 
         sec->floordata = floor; //jff 2/22/98
@@ -863,7 +865,7 @@ int EV_DoDonut(line_t*  line)
       s3 = s2->lines[i]->backsector;      // s3 is model sector for changes
         
       //  Spawn rising slime
-      floor = Z_Malloc (sizeof(*floor), PU_LEVSPEC, 0);
+      floor = P_AllocThinker(sizeof(*floor));
       P_AddThinker (&floor->thinker);
       s2->floordata = floor; //jff 2/22/98
       floor->thinker.function = T_MoveFloor;
@@ -877,7 +879,7 @@ int EV_DoDonut(line_t*  line)
       floor->floordestheight = s3->floorheight;
         
       //  Spawn lowering donut-hole pillar
-      floor = Z_Malloc (sizeof(*floor), PU_LEVSPEC, 0);
+      floor = P_AllocThinker(sizeof(*floor));
       P_AddThinker (&floor->thinker);
       s1->floordata = floor; //jff 2/22/98
       floor->thinker.function = T_MoveFloor;
@@ -924,7 +926,7 @@ int EV_DoElevator
       
     // create and initialize new elevator thinker
     rtn = 1;
-    elevator = Z_Malloc (sizeof(*elevator), PU_LEVSPEC, 0);
+    elevator = P_AllocThinker(sizeof(*elevator));
     P_AddThinker (&elevator->thinker);
     sec->floordata = elevator; //jff 2/22/98
     sec->ceilingdata = elevator; //jff 2/22/98
@@ -38,6 +38,7 @@
 #include "d_deh.h"  // Ty 03/22/98 - externalized strings
 
 #include "p_inter.h"
+#include "p_enemy.h"
 
 #define BONUSADD        6
 
@@ -704,6 +705,9 @@ void P_DamageMobj(mobj_t *target,mobj_t *inflictor, mobj_t *source, int damage)
   if (target->health <= 0)
     return;
 
+  if (target->dormant)
+    P_WakeMonster(target);
+
   if (target->flags & MF_SKULLFLY)
     target->momx = target->momy = target->momz = 0;
 
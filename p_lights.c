@@ -177,7 +177,7 @@ void P_SpawnFireFlicker (sector_t*  sector)
   // Nothing special about it during gameplay.
   sector->special &= ~31; //jff 3/14/98 clear non-generalized sector type
 
-  flick = Z_Malloc ( sizeof(*flick), PU_LEVSPEC, 0);
+  flick = P_AllocThinker(sizeof(*flick));
 
   P_AddThinker (&flick->thinker);
 
@@ -203,7 +203,7 @@ void P_SpawnLightFlash (sector_t* sector)
   // nothing special about it during gameplay
   sector->special &= ~31; //jff 3/14/98 clear non-generalized sector type
 
-  flash = Z_Malloc ( sizeof(*flash), PU_LEVSPEC, 0);
+  flash = P_AllocThinker(sizeof(*flash));
 
   P_AddThinker (&flash->thinker);
 
@@ -231,7 +231,7 @@ void P_SpawnStrobeFlash(sector_t* sector, int fastOrSlow, int inSync)
 {
   strobe_t* flash;
 
-  flash = Z_Malloc ( sizeof(*flash), PU_LEVSPEC, 0);
+  flash = P_AllocThinker(sizeof(*flash));
 
   P_AddThinker (&flash->thinker);
 
@@ -266,7 +266,7 @@ void P_SpawnGlowingLight(sector_t*  sector)
 {
   glow_t* g;
 
-  g = Z_Malloc( sizeof(*g), PU_LEVSPEC, 0);
+  g = P_AllocThinker(sizeof(*g));
 
   P_AddThinker(&g->thinker);
 
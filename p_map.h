@@ -47,6 +47,7 @@ boolean P_TryMove(mobj_t *thing, fixed_t x, fixed_t y, boolean dropoff);
 boolean P_TeleportMove(mobj_t *thing, fixed_t x, fixed_t y);
 void    P_SlideMove(mobj_t *mo);
 boolean P_CheckSight(mobj_t *t1, mobj_t *t2);
+void    P_InvalidateSight(void);        // sector heights have changed
 void    P_UseLines(player_t *player);
 
 fixed_t P_AimLineAttack(mobj_t *t1, angle_t angle, fixed_t distance);
@@ -41,6 +41,7 @@
 #include "info.h"
 #include "g_game.h"
 #include "p_inter.h"
+#include "p_enemy.h"
 
 extern int P_GetFriction(const mobj_t *mo, int *frictionfactor);
 
@@ -474,6 +475,9 @@ void P_NightmareRespawn(mobj_t* mobj)
 
 void P_MobjThinker (mobj_t* mobj)
 {
+  if (mobj->dormant)   // parked, see p_enemy.c
+    return;
+
   // killough 4/25/98:
   //
   // If a mobj thinker's target points to a thinker about to be deleted,
@@ -544,7 +548,7 @@ void P_MobjThinker (mobj_t* mobj)
 
 mobj_t *P_SpawnMobj(fixed_t x, fixed_t y, fixed_t z, mobjtype_t type)
 {
-  mobj_t *mobj = Z_Malloc(sizeof *mobj, PU_LEVEL, NULL);
+  mobj_t *mobj = P_AllocThinker(sizeof *mobj);
   mobjinfo_t *info = &mobjinfo[type];
   state_t    *st;
 
@@ -607,6 +611,9 @@ int iquehead, iquetail;
 
 void P_RemoveMobj (mobj_t* mobj)
   {
+  if (mobj->dormant)
+    P_WakeMonster(mobj);
+
   if ((mobj->flags & MF_SPECIAL)
       && !(mobj->flags & MF_DROPPED)
       && (mobj->type != MT_INV)
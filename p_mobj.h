@@ -293,6 +293,10 @@ typedef struct mobj_s
     // Player number last looked for.
     short               lastlook;       
 
+    // Idle monster parked far from the players (monster_dormancy).
+    // Not a flag, so that DEH patches cannot set it.
+    boolean             dormant;
+
     // For nightmare respawn.
     mapthing_t          spawnpoint;     
 
@@ -214,7 +214,7 @@ int EV_DoPlat
       
     // Create a thinker
     rtn = 1;
-    plat = Z_Malloc( sizeof(*plat), PU_LEVSPEC, 0);
+    plat = P_AllocThinker(sizeof(*plat));
     P_AddThinker(&plat->thinker);
               
     plat->type = type;
@@ -0,0 +1,414 @@
+// Emacs style mode select   -*- C++ -*-
+//-----------------------------------------------------------------------------
+//
+//  This program is free software; you can redistribute it and/or
+//  modify it under the terms of the GNU General Public License
+//  as published by the Free Software Foundation; either version 2
+//  of the License, or (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+//  02111-1307, USA.
+//
+// DESCRIPTION:
+//      Building a REJECT matrix for maps which come without a usable one.
+//
+// Heights are left out entirely: doors open, lifts lower and floors
+// rise, so a pair of sectors is only rejected if no straight line in
+// the map crosses from one to the other, whatever the heights. Each
+// two-sided line between different sectors is a portal. From every
+// portal out of a sector, the portals beyond are followed depth first,
+// each clipped to the part a straight line through all the portals so
+// far could still pass: in front of the last portal, and inside the
+// separating planes between the first and the last. Portals are
+// widened and clipped with some slack, so rounding only ever lets more
+// through. Anything the flow cannot settle cheaply -- sectors which
+// are not closed, sectors which touch at a vertex, searches which run
+// too long or too deep -- counts as visible.
+//
+// Sectors are split between the task pool.
+//
+//-----------------------------------------------------------------------------
+
+#include <math.h>
+#include <string.h>
+#include "doomstat.h"
+#include "r_state.h"
+#include "i_system.h"
+#include "p_reject.h"
+
+#define REJECT_TASKS    8
+#define PORTAL_EXT      4.0     // portals are widened this much at each end
+#define CLIP_EPS        2.0     // and clipped this loosely
+#define FLOW_DEPTH      512
+#define FLOW_BUDGET     250000  // portals tried per sector before giving up
+
+typedef struct {
+  double x1, y1, x2, y2;
+} window_t;
+
+typedef struct {
+  window_t w;           // the far sector is on the left going from 1 to 2
+  int to, line;
+} portal_t;
+
+typedef struct {
+  int first;            // sectors first, first+REJECT_TASKS, ...
+  byte *used;           // lines crossed on the current path
+  byte *row;
+  int budget;
+} flow_t;
+
+typedef struct {
+  fixed_t x, y;
+  int sector;
+} corner_t;
+
+static portal_t *portals;
+static int *firstportal;        // portals of sector s start here
+static byte *opensector;        // not closed, so sees and is seen by all
+static byte *vis;               // a row of bits per sector
+static int rowbytes;
+
+#define SETVIS(row, s) ((row)[(s) >> 3] |= 1 << ((s) & 7))
+#define GETVIS(row, s) ((row)[(s) >> 3] & 1 << ((s) & 7))
+
+//
+// P_ClipWindow
+// Keeps the part of w on the left of the line from a to b, give or take
+// CLIP_EPS. Returns false if nothing is left.
+//
+
+static boolean P_ClipWindow(window_t *w, double ax, double ay,
+                            double bx, double by)
+{
+  double dx = bx - ax, dy = by - ay, len = sqrt(dx*dx + dy*dy), d1, d2, t;
+
+  if (len < 1e-6)
+    return true;
+
+  d1 = (dx*(w->y1 - ay) - dy*(w->x1 - ax)) / len + CLIP_EPS;
+  d2 = (dx*(w->y2 - ay) - dy*(w->x2 - ax)) / len + CLIP_EPS;
+
+  if (d1 < 0 && d2 < 0)
+    return false;
+
+  if (d1 < 0)
+    {
+      t = d1 / (d1 - d2);
+      w->x1 += (w->x2 - w->x1) * t;
+      w->y1 += (w->y2 - w->y1) * t;
+    }
+  else
+    if (d2 < 0)
+      {
+        t = d2 / (d2 - d1);
+        w->x2 += (w->x1 - w->x2) * t;
+        w->y2 += (w->y1 - w->y2) * t;
+      }
+
+  return true;
+}
+
+//
+// P_ClipSeparators
+// A line through both src and pass must stay between the lines joining
+// an end of one to the opposite end of the other. Each such line which
+// has the two windows on opposite sides bounds where w can be seen.
+//
+
+static boolean P_ClipSeparators(window_t *w, const window_t *src,
+                                const window_t *pass)
+{
+  int i, j;
+
+  for (i = 0; i < 2; i++)
+    for (j = 0; j < 2; j++)
+      {
+        double ax = i ? src->x2 : src->x1, ay = i ? src->y2 : src->y1;
+        double oax = i ? src->x1 : src->x2, oay = i ? src->y1 : src->y2;
+        double bx = j ? pass->x2 : pass->x1, by = j ? pass->y2 : pass->y1;
+        double obx = j ? pass->x1 : pass->x2, oby = j ? pass->y1 : pass->y2;
+        double dx = bx - ax, dy = by - ay;
+        double sa = dx*(oay - ay) - dy*(oax - ax);
+        double sb = dx*(oby - ay) - dy*(obx - ax);
+
+        if (sa * sb >= 0)       // not a separator, or too close to call
+          continue;
+
+        // keep w on the side of the rest of pass
+        if (sb > 0 ? !P_ClipWindow(w, ax, ay, bx, by) :
+            !P_ClipWindow(w, bx, by, ax, ay))
+          return false;
+      }
+
+  return true;
+}
+
+//
+// P_Flow
+// Marks the sectors seen through pass, which leads into sector.
+//
+
+static void P_Flow(flow_t *f, const window_t *src, const window_t *pass,
+                   int sector, int depth)
+{
+  int i;
+
+  for (i = firstportal[sector]; i < firstportal[sector+1]; i++)
+    {
+      const portal_t *p = &portals[i];
+      window_t w;
+
+      if (f->used[p->line])
+        continue;
+
+      if (--f->budget <= 0)
+        return;
+
+      w = p->w;
+      if (!P_ClipWindow(&w, pass->x1, pass->y1, pass->x2, pass->y2) ||
+          (pass != src && !P_ClipSeparators(&w, src, pass)))
+        continue;
+
+      SETVIS(f->row, p->to);
+
+      if (depth >= FLOW_DEPTH)
+        {
+          f->budget = 0;
+          return;
+        }
+
+      f->used[p->line] = 1;
+      P_Flow(f, src, &w, p->to, depth+1);
+      f->used[p->line] = 0;
+
+      if (f->budget <= 0)
+        return;
+    }
+}
+
+static void P_SectorVis(flow_t *f, int s)
+{
+  int i;
+
+  f->row = vis + s * rowbytes;
+  f->budget = FLOW_BUDGET;
+
+  SETVIS(f->row, s);
+
+  if (!opensector[s])
+    for (i = firstportal[s]; i < firstportal[s+1] && f->budget > 0; i++)
+      {
+        const portal_t *p = &portals[i];
+
+        SETVIS(f->row, p->to);
+        f->used[p->line] = 1;
+        P_Flow(f, &p->w, &p->w, p->to, 1);
+        f->used[p->line] = 0;
+      }
+
+  if (opensector[s] || f->budget <= 0)
+    memset(f->row, 0xff, rowbytes);
+}
+
+static void P_RejectTask(void *data)
+{
+  flow_t *f = data;
+  int s;
+
+  for (s = f->first; s < numsectors; s += REJECT_TASKS)
+    P_SectorVis(f, s);
+}
+
+//
+// P_InitPortals
+// Gathers the portals out of each sector.
+//
+
+static void P_InitPortals(void)
+{
+  int i, n = 0;
+
+  firstportal = calloc(numsectors + 1, sizeof *firstportal);
+
+  for (i = 0; i < numlines; i++)
+    {
+      const line_t *l = &lines[i];
+
+      if (l->flags & ML_TWOSIDED && l->frontsector && l->backsector &&
+          l->frontsector != l->backsector)
+        {
+          firstportal[l->frontsector - sectors + 1]++;
+          firstportal[l->backsector - sectors + 1]++;
+          n += 2;
+        }
+    }
+
+  for (i = 0; i < numsectors; i++)
+    firstportal[i+1] += firstportal[i];
+
+  portals = malloc(n * sizeof *portals + 1);
+
+  {
+    int *next = malloc(numsectors * sizeof *next + 1);
+
+    memcpy(next, firstportal, numsectors * sizeof *next);
+
+    for (i = 0; i < numlines; i++)
+      {
+        const line_t *l = &lines[i];
+        double x1, y1, x2, y2, dx, dy, len;
+        portal_t *p;
+
+        if (!(l->flags & ML_TWOSIDED && l->frontsector && l->backsector &&
+              l->frontsector != l->backsector))
+          continue;
+
+        x1 = l->v1->x / (double) FRACUNIT;
+        y1 = l->v1->y / (double) FRACUNIT;
+        x2 = l->v2->x / (double) FRACUNIT;
+        y2 = l->v2->y / (double) FRACUNIT;
+        dx = x2 - x1;
+        dy = y2 - y1;
+        if ((len = sqrt(dx*dx + dy*dy)) > 0)
+          {
+            dx *= PORTAL_EXT / len;
+            dy *= PORTAL_EXT / len;
+            x1 -= dx, y1 -= dy;
+            x2 += dx, y2 += dy;
+          }
+
+        // the back sector is on the left of v1 -> v2
+        p = &portals[next[l->frontsector - sectors]++];
+        p->w.x1 = x1, p->w.y1 = y1, p->w.x2 = x2, p->w.y2 = y2;
+        p->to = l->backsector - sectors;
+        p->line = i;
+
+        p = &portals[next[l->backsector - sectors]++];
+        p->w.x1 = x2, p->w.y1 = y2, p->w.x2 = x1, p->w.y2 = y1;
+        p->to = l->frontsector - sectors;
+        p->line = i;
+      }
+
+    free(next);
+  }
+}
+
+static int P_CompareCorners(const void *a, const void *b)
+{
+  const corner_t *c = a, *d = b;
+  return c->x != d->x ? (c->x < d->x ? -1 : 1) :
+    c->y != d->y ? (c->y < d->y ? -1 : 1) :
+    c->sector - d->sector;
+}
+
+//
+// P_CheckCorners
+// A sector is closed if each of its vertexes is the end of an even
+// number of its lines. Sectors meeting at a vertex are made visible to
+// each other, since a line of sight may slip through the vertex itself.
+//
+
+static void P_CheckCorners(void)
+{
+  corner_t *c = malloc(numlines * 4 * sizeof *c + 1);
+  int i, j, k, n = 0;
+
+  for (i = 0; i < numlines; i++)
+    {
+      const line_t *l = &lines[i];
+      const sector_t *sec[2] = {l->frontsector, l->backsector};
+
+      for (j = 0; j < 2; j++)
+        if (sec[j])
+          {
+            c[n].x = l->v1->x, c[n].y = l->v1->y;
+            c[n++].sector = sec[j] - sectors;
+            c[n].x = l->v2->x, c[n].y = l->v2->y;
+            c[n++].sector = sec[j] - sectors;
+          }
+    }
+
+  qsort(c, n, sizeof *c, P_CompareCorners);
+
+  for (i = 0; i < n; i = j)
+    {
+      for (j = i; j < n && c[j].x == c[i].x && c[j].y == c[i].y; j++)
+        ;
+
+      // c[i..j) share a vertex, grouped by sector
+      for (k = i; k < j; )
+        {
+          int s = c[k].sector, count = 0, m;
+
+          for (; k < j && c[k].sector == s; k++)
+            count++;
+          if (count & 1)
+            opensector[s] = 1;
+
+          for (m = k; m < j; m++)
+            if (c[m].sector != c[m-1].sector)
+              {
+                SETVIS(vis + s * rowbytes, c[m].sector);
+                SETVIS(vis + c[m].sector * rowbytes, s);
+              }
+        }
+    }
+
+  free(c);
+}
+
+byte *P_BuildReject(void)
+{
+  size_t size = ((long long) numsectors * numsectors + 7) / 8;
+  byte *reject = Z_Malloc(size, PU_LEVEL, 0);
+  flow_t flows[REJECT_TASKS];
+  i_task_t *tasks[REJECT_TASKS];
+  int i, j;
+
+  rowbytes = (numsectors + 7) / 8;
+  vis = calloc((size_t) numsectors * rowbytes + 1, 1);
+  opensector = calloc(numsectors + 1, 1);
+
+  P_InitPortals();
+  P_CheckCorners();
+
+  // the tasks only write their own rows, and allocate nothing
+  for (i = 0; i < REJECT_TASKS; i++)
+    {
+      flows[i].first = i;
+      flows[i].used = calloc(numlines + 1, 1);
+      tasks[i] = I_StartTask(P_RejectTask, &flows[i]);
+    }
+
+  for (i = 0; i < REJECT_TASKS; i++)
+    {
+      I_FinishTask(tasks[i]);
+      free(flows[i].used);
+    }
+
+  // reject a pair only if neither sees the other
+  memset(reject, 0, size);
+  for (i = 0; i < numsectors; i++)
+    for (j = 0; j < numsectors; j++)
+      if (!GETVIS(vis + i * rowbytes, j) && !GETVIS(vis + j * rowbytes, i) &&
+          !opensector[i] && !opensector[j])
+        {
+          long long pnum = (long long) i * numsectors + j;
+          reject[pnum >> 3] |= 1 << (pnum & 7);
+        }
+
+  free(portals);
+  free(firstportal);
+  free(opensector);
+  free(vis);
+
+  return reject;
+}
@@ -0,0 +1,38 @@
+// Emacs style mode select   -*- C++ -*-
+//-----------------------------------------------------------------------------
+//
+//  This program is free software; you can redistribute it and/or
+//  modify it under the terms of the GNU General Public License
+//  as published by the Free Software Foundation; either version 2
+//  of the License, or (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program; if not, write to the Free Software
+//  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+//  02111-1307, USA.
+//
+// DESCRIPTION:
+//      Building a REJECT matrix for maps which come without a usable one.
+//
+//-----------------------------------------------------------------------------
+
+#ifndef __P_REJECT__
+#define __P_REJECT__
+
+#include "doomtype.h"
+
+// Bump when the flow changes its answers, so that levels cached with
+// a built matrix are built again.
+#define REJECT_VERSION  1
+
+// Returns a PU_LEVEL reject matrix for the loaded lines and sectors,
+// which only rejects pairs of sectors that cannot see each other at any
+// floor and ceiling heights.
+byte *P_BuildReject(void);
+
+#endif
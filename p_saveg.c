@@ -30,6 +30,7 @@
 #include "doomstat.h"
 #include "r_main.h"
 #include "p_maputl.h"
+#include "p_map.h"
 #include "p_spec.h"
 #include "p_tick.h"
 #include "p_saveg.h"
@@ -192,6 +193,8 @@ void P_UnArchiveWorld (void)
 
   get = (short *) save_p;
 
+  P_InvalidateSight();       // the heights are about to change
+
   // do sectors
   for (i=0, sec = sectors ; i<numsectors ; i++,sec++)
     {
@@ -402,7 +405,7 @@ void P_UnArchiveThinkers (void)
       if (th->function == P_MobjThinker)
         P_RemoveMobj ((mobj_t *) th);
       else
-        Z_Free (th);
+        P_FreeThinker (th);
       th = next;
     }
   P_InitThinkers ();
@@ -428,7 +431,7 @@ void P_UnArchiveThinkers (void)
   // haleyjd 11/03/06: use idx to save "size" for rangechecking
   for (idx = 1; *save_p++ == tc_mobj; idx++)    // killough 2/14/98
     {
-      mobj_t *mobj = Z_Malloc(sizeof(mobj_t), PU_LEVEL, NULL);
+      mobj_t *mobj = P_AllocThinker(sizeof(mobj_t));
 
       // killough 2/14/98 -- insert pointers to thinkers into table, in order:
       mobj_p[idx] = mobj;
@@ -444,6 +447,9 @@ void P_UnArchiveThinkers (void)
       P_SetThingPosition (mobj);
       mobj->info = &mobjinfo[mobj->type];
 
+      if (mobj->dormant)
+        mobj->subsector->sector->dormant++;
+
       // killough 2/28/98:
       // Fix for falling down into a wall after savegame loaded:
       //      mobj->floorz = mobj->subsector->sector->floorheight;
@@ -756,7 +762,7 @@ void P_UnArchiveSpecials (void)
       case tc_ceiling:
         PADSAVEP();
         {
-          ceiling_t *ceiling = Z_Malloc (sizeof(*ceiling), PU_LEVEL, NULL);
+          ceiling_t *ceiling = P_AllocThinker(sizeof(*ceiling));
           memcpy (ceiling, save_p, sizeof(*ceiling));
           save_p += sizeof(*ceiling);
           ceiling->sector = &sectors[(size_t)ceiling->sector];
@@ -773,7 +779,7 @@ void P_UnArchiveSpecials (void)
       case tc_door:
         PADSAVEP();
         {
-          vldoor_t *door = Z_Malloc (sizeof(*door), PU_LEVEL, NULL);
+          vldoor_t *door = P_AllocThinker(sizeof(*door));
           memcpy (door, save_p, sizeof(*door));
           save_p += sizeof(*door);
           door->sector = &sectors[(size_t)door->sector];
@@ -790,7 +796,7 @@ void P_UnArchiveSpecials (void)
       case tc_floor:
         PADSAVEP();
         {
-          floormove_t *floor = Z_Malloc (sizeof(*floor), PU_LEVEL, NULL);
+          floormove_t *floor = P_AllocThinker(sizeof(*floor));
           memcpy (floor, save_p, sizeof(*floor));
           save_p += sizeof(*floor);
           floor->sector = &sectors[(size_t)floor->sector];
@@ -803,7 +809,7 @@ void P_UnArchiveSpecials (void)
       case tc_plat:
         PADSAVEP();
         {
-          plat_t *plat = Z_Malloc (sizeof(*plat), PU_LEVEL, NULL);
+          plat_t *plat = P_AllocThinker(sizeof(*plat));
           memcpy (plat, save_p, sizeof(*plat));
           save_p += sizeof(*plat);
           plat->sector = &sectors[(size_t)plat->sector];
@@ -820,7 +826,7 @@ void P_UnArchiveSpecials (void)
       case tc_flash:
         PADSAVEP();
         {
-          lightflash_t *flash = Z_Malloc (sizeof(*flash), PU_LEVEL, NULL);
+          lightflash_t *flash = P_AllocThinker(sizeof(*flash));
           memcpy (flash, save_p, sizeof(*flash));
           save_p += sizeof(*flash);
           flash->sector = &sectors[(size_t)flash->sector];
@@ -832,7 +838,7 @@ void P_UnArchiveSpecials (void)
       case tc_strobe:
         PADSAVEP();
         {
-          strobe_t *strobe = Z_Malloc (sizeof(*strobe), PU_LEVEL, NULL);
+          strobe_t *strobe = P_AllocThinker(sizeof(*strobe));
           memcpy (strobe, save_p, sizeof(*strobe));
           save_p += sizeof(*strobe);
           strobe->sector = &sectors[(size_t)strobe->sector];
@@ -844,7 +850,7 @@ void P_UnArchiveSpecials (void)
       case tc_glow:
         PADSAVEP();
         {
-          glow_t *glow = Z_Malloc (sizeof(*glow), PU_LEVEL, NULL);
+          glow_t *glow = P_AllocThinker(sizeof(*glow));
           memcpy (glow, save_p, sizeof(*glow));
           save_p += sizeof(*glow);
           glow->sector = &sectors[(size_t)glow->sector];
@@ -856,7 +862,7 @@ void P_UnArchiveSpecials (void)
       case tc_flicker:           // killough 10/4/98
         PADSAVEP();
         {
-          fireflicker_t *flicker = Z_Malloc (sizeof(*flicker), PU_LEVEL, NULL);
+          fireflicker_t *flicker = P_AllocThinker(sizeof(*flicker));
           memcpy (flicker, save_p, sizeof(*flicker));
           save_p += sizeof(*flicker);
           flicker->sector = &sectors[(size_t)flicker->sector];
@@ -869,7 +875,7 @@ void P_UnArchiveSpecials (void)
       case tc_elevator:
         PADSAVEP();
         {
-          elevator_t *elevator = Z_Malloc (sizeof(*elevator), PU_LEVEL, NULL);
+          elevator_t *elevator = P_AllocThinker(sizeof(*elevator));
           memcpy (elevator, save_p, sizeof(*elevator));
           save_p += sizeof(*elevator);
           elevator->sector = &sectors[(size_t)elevator->sector];
@@ -882,7 +888,7 @@ void P_UnArchiveSpecials (void)
 
       case tc_scroll:       // killough 3/7/98: scroll effect thinkers
         {
-          scroll_t *scroll = Z_Malloc (sizeof(scroll_t), PU_LEVEL, NULL);
+          scroll_t *scroll = P_AllocThinker(sizeof(scroll_t));
           memcpy (scroll, save_p, sizeof(scroll_t));
           save_p += sizeof(scroll_t);
           scroll->thinker.function = T_Scroll;
@@ -892,7 +898,7 @@ void P_UnArchiveSpecials (void)
 
       case tc_pusher:   // phares 3/22/98: new Push/Pull effect thinkers
         {
-          pusher_t *pusher = Z_Malloc (sizeof(pusher_t), PU_LEVEL, NULL);
+          pusher_t *pusher = P_AllocThinker(sizeof(pusher_t));
           memcpy (pusher, save_p, sizeof(pusher_t));
           save_p += sizeof(pusher_t);
           pusher->thinker.function = T_Pusher;
@@ -907,6 +913,80 @@ void P_UnArchiveSpecials (void)
       }
 }
 
+//
+// P_SaveGameSize
+//
+// Returns an upper bound on the output of P_ArchivePlayers() through
+// P_ArchiveMap(). Every thinker is charged as a full mobj_t, the largest
+// thinker there is, plus its class byte and alignment padding.
+//
+
+size_t P_SaveGameSize(void)
+{
+  const thinker_t *th;
+  size_t size, numthinkers = 0;
+  int i;
+
+  for (th = thinkercap.next ; th != &thinkercap ; th=th->next)
+    numthinkers++;
+
+  size = MAXPLAYERS * (sizeof(player_t) + 4);
+
+  size += (sizeof(short)*5 + sizeof(fixed_t)*2) * numsectors +
+    sizeof(short)*3*numlines + 4;
+  for (i=0; i<numlines; i++)
+    size += ((lines[i].sidenum[0] != -1) + (lines[i].sidenum[1] != -1)) *
+      (sizeof(short)*3 + sizeof(fixed_t)*2);
+
+  size += sizeof brain + numthinkers * (sizeof(mobj_t) + 4) + 2 +
+    numsectors * sizeof(mobj_t *);
+
+  size += sizeof rng + sizeof followplayer + sizeof markpointnum +
+    markpointnum * sizeof *markpoints + sizeof automapactive +
+    sizeof viewactive + sizeof automap_grid;
+
+  return size;
+}
+
+//
+// P_ResetLevelState
+//
+// Frees every thinker of the running level and detaches the specials that
+// refer to them, so that the P_UnArchive* routines can rebuild the level
+// in place, without P_SetupLevel(). Used by the rewind ring.
+//
+
+void P_ResetLevelState(void)
+{
+  thinker_t *th;
+  int i;
+
+  for (th = thinkercap.next; th != &thinkercap; )
+    {
+      thinker_t *next = th->next;
+      if (th->function == P_MobjThinker)
+        {
+          // not picked up, so keep it out of the item respawn queue
+          ((mobj_t *) th)->flags &= ~MF_SPECIAL;
+          P_RemoveMobj((mobj_t *) th);  // unlink from the map, stop sounds
+        }
+      P_FreeThinker(th);
+      th = next;
+    }
+  P_InitThinkers();
+
+  P_RemoveAllActivePlats();
+  P_RemoveAllActiveCeilings();
+
+  for (i=0; i<numsectors; i++)
+    {
+      sectors[i].floordata = sectors[i].ceilingdata = NULL;
+      sectors[i].lightingdata = NULL;
+      sectors[i].soundtarget = NULL;    // freed above, restored on unarchive
+      sectors[i].dormant = 0;
+    }
+}
+
 // killough 2/16/98: save/restore random number generator state information
 
 void P_ArchiveRNG(void)
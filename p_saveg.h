@@ -50,6 +50,16 @@ void P_ArchiveMap(void);
 void P_UnArchiveMap(void);
 
 extern byte *save_p;
-void CheckSaveGame(size_t);              // killough
+
+// killough: check for savegame buffer overrun. Buffers are sized up front
+// from P_SaveGameSize(), so this only catches an estimate that fell short.
+void CheckSaveGame(size_t);
+
+// Upper bound on the bytes written by all of the P_Archive* routines,
+// so savegame buffers can be sized once instead of grown piecemeal
+size_t P_SaveGameSize(void);
+
+// Frees the running level's thinkers so it can be unarchived in place
+void P_ResetLevelState(void);
 
 #endif
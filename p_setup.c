@@ -28,16 +28,22 @@
 //
 //-----------------------------------------------------------------------------
 
+#ifdef WINDOWS
+#include "win_fopen.h"
+#endif
+#include <stdint.h>
 #include "doomstat.h"
 #include "m_bbox.h"
 #include "m_argv.h"
 #include "g_game.h"
 #include "w_wad.h"
+#include "m_misc.h"
 #include "r_main.h"
 #include "r_things.h"
 #include "p_maputl.h"
 #include "p_map.h"
 #include "p_setup.h"
+#include "p_reject.h"
 #include "p_spec.h"
 #include "p_tick.h"
 #include "p_enemy.h"
@@ -85,6 +91,7 @@ long long     *blockmap;              // was short -- killough
 
 // offsets in blockmap are from here
 long long     *blockmaplump;          // was short -- killough
+static long long blockmapsize;        // entries in blockmaplump
 
 fixed_t   bmaporgx, bmaporgy;     // origin of block map
 
@@ -655,6 +662,7 @@ static void P_CreateBlockMap(void)
 
       // Allocate blockmap lump with computed count
       blockmaplump = Z_Malloc(sizeof(*blockmaplump) * count, PU_LEVEL, 0);
+      blockmapsize = count;
     }									 
 
     // Now compress the blockmap.
@@ -703,6 +711,7 @@ void P_LoadBlockMap (int lump)
       long long i;
       short *wadblockmaplump = W_CacheLumpNum (lump, PU_LEVEL);
       blockmaplump = Z_Malloc(sizeof(*blockmaplump) * count, PU_LEVEL, 0);
+      blockmapsize = count;
 
       // killough 3/1/98: Expand wad blockmap into larger internal one,
       // by treating all offsets except -1 as unsigned and zero-extending
@@ -735,6 +744,32 @@ void P_LoadBlockMap (int lump)
   blockmap = blockmaplump+4;
 }
 
+//
+// P_LoadReject
+// Maps whose REJECT lump is too short to cover every pair of sectors,
+// or all zeros as many node builders leave it, get one built for them.
+// -buildreject builds one for every map.
+//
+
+static void P_LoadReject(int lump)
+{
+  long long size = ((long long) numsectors * numsectors + 7) / 8, i;
+
+  if (!M_CheckParm("-buildreject") && W_LumpLength(lump) >= size)
+    {
+      rejectmatrix = W_CacheLumpNum(lump, PU_LEVEL);
+
+      for (i = 0; i < size && !rejectmatrix[i]; i++)
+        ;
+      if (i < size)
+        return;
+
+      Z_Free(rejectmatrix);
+    }
+
+  rejectmatrix = P_BuildReject();
+}
+
 //
 // P_GroupLines
 // Builds sector line lists and subsector sector numbers.
@@ -824,6 +859,496 @@ void P_GroupLines (void)
 }
 
 
+//
+// Level cache
+//
+// Everything above comes out the same each time for the same map lumps
+// and the same files loaded, which fix the texture, flat and lump
+// numbers, and takes seconds on the largest maps. So the arrays, the
+// blockmap, the reject matrix and the sectors' line lists are saved in
+// levcache/ under the executable's directory, with the pointers between
+// them stored as indexes, keyed by a hash of the map lumps' contents and
+// wadsignature. Loading one is copying the arrays into the zone and
+// turning the indexes back into pointers. The image last read is kept
+// in the cache, so restarting a level does not even read the file.
+// -nolevcache turns this off.
+//
+
+#define LEVCACHE_MAGIC  "RBLEVL1"
+
+typedef struct {
+  char magic[8];
+  int sizes[8];         // of the structures, so other builds miss
+  int numvertexes, numsectors, numsides, numlines;
+  int numsubsectors, numnodes, numsegs, numlinerefs;
+  int bmapwidth, bmapheight;
+  fixed_t bmaporgx, bmaporgy;
+  long long blockmapsize, rejectsize;
+} levcache_t;
+
+#define LEV_ALIGN(n)    (((n) + 7) & ~(size_t) 7)
+
+// pointers are stored as index + 1, with 0 for NULL
+#define LEV_INDEX(p, base) ((void *)(intptr_t)((p) ? (p) - (base) + 1 : 0))
+#define LEV_LINK(p, base, n) \
+  ((p) = P_LevelLink((p), (base), (n), sizeof *(base), &ok))
+
+static void *levimage;                  // PU_CACHE when not in use
+static int levimagelump = -1;
+static char levcachename[PATH_MAX+32];
+
+static void P_LevelSizes(int *sizes)
+{
+  sizes[0] = sizeof(vertex_t);
+  sizes[1] = sizeof(sector_t);
+  sizes[2] = sizeof(side_t);
+  sizes[3] = sizeof(line_t);
+  sizes[4] = sizeof(subsector_t);
+  sizes[5] = sizeof(node_t);
+  sizes[6] = sizeof(seg_t);
+  sizes[7] = sizeof(void *);
+}
+
+//
+// P_LevelCacheName
+// Names the cache file after a hash of wadsignature, the switches which
+// change what gets built, and the lumps after THINGS.
+//
+
+static void P_LevelCacheName(char *name, int lumpnum)
+{
+  uint64_t hash = M_HASHINIT;
+  int opts[3], lump;
+
+  opts[0] = !!M_CheckParm("-blockmap");
+  opts[1] = !!M_CheckParm("-buildreject");
+  opts[2] = REJECT_VERSION;
+
+  hash = M_Hash64(hash, &wadsignature, sizeof wadsignature);
+  hash = M_Hash64(hash, opts, sizeof opts);
+
+  for (lump = lumpnum+ML_LINEDEFS; lump <= lumpnum+ML_BLOCKMAP; lump++)
+    {
+      int len = W_LumpLength(lump);
+
+      hash = M_Hash64(hash, &len, sizeof len);
+      hash = M_Hash64(hash, W_CacheLumpNum(lump, PU_CACHE), len);
+    }
+
+  M_CacheDir(name, "levcache");
+  sprintf(name + strlen(name), "/%016llx.lvl", (unsigned long long) hash);
+}
+
+static void *P_LevelLink(void *p, void *base, int n, size_t size,
+                         boolean *ok)
+{
+  intptr_t i = (intptr_t) p;
+
+  if (i < 0 || i > n)
+    {
+      *ok = false;
+      return NULL;
+    }
+  return i ? (byte *) base + (i - 1) * size : NULL;
+}
+
+static void *P_LevelArray(const byte **p, size_t size)
+{
+  void *data = Z_Malloc(size, PU_LEVEL, 0);
+
+  if (size)
+    memcpy(data, *p, size);
+  *p += LEV_ALIGN(size);
+  return data;
+}
+
+//
+// P_ReadLevelImage
+// Reads the cache file into levimage, and checks that its header
+// matches its size. Returns the size, or 0 for no usable file.
+//
+
+static size_t P_ReadLevelImage(const char *name)
+{
+  const levcache_t *h;
+  int sizes[8];
+  size_t size;
+  long len;
+  FILE *fp;
+
+  if (!(fp = fopen(name, "rb")))
+    return 0;
+
+  if (fseek(fp, 0, SEEK_END) || (len = ftell(fp)) < (long) sizeof *h ||
+      fseek(fp, 0, SEEK_SET))
+    {
+      fclose(fp);
+      return 0;
+    }
+
+  size = len;
+  Z_Malloc(size, PU_STATIC, &levimage);
+  if (fread(levimage, 1, size, fp) != size)
+    {
+      fclose(fp);
+      Z_Free(levimage);
+      return 0;
+    }
+  fclose(fp);
+
+  h = levimage;
+  P_LevelSizes(sizes);
+
+  if (memcmp(h->magic, LEVCACHE_MAGIC, 8) || memcmp(h->sizes, sizes,
+      sizeof sizes) || h->numvertexes < 0 || h->numsectors < 0 ||
+      h->numsides < 0 || h->numlines < 0 || h->numsubsectors < 0 ||
+      h->numnodes < 0 || h->numsegs < 0 || h->numlinerefs < 0 ||
+      h->blockmapsize < 4 || h->rejectsize < 0 ||
+      h->rejectsize != ((long long) h->numsectors * h->numsectors + 7) / 8 ||
+      size != sizeof *h +
+      LEV_ALIGN((size_t) h->numvertexes * sizeof(vertex_t)) +
+      LEV_ALIGN((size_t) h->numsectors * sizeof(sector_t)) +
+      LEV_ALIGN((size_t) h->numsides * sizeof(side_t)) +
+      LEV_ALIGN((size_t) h->numlines * sizeof(line_t)) +
+      LEV_ALIGN((size_t) h->numsubsectors * sizeof(subsector_t)) +
+      LEV_ALIGN((size_t) h->numnodes * sizeof(node_t)) +
+      LEV_ALIGN((size_t) h->numsegs * sizeof(seg_t)) +
+      LEV_ALIGN((size_t) h->numlinerefs * sizeof(int)) +
+      LEV_ALIGN((size_t) h->blockmapsize * sizeof(*blockmaplump)) +
+      LEV_ALIGN((size_t) h->rejectsize))
+    {
+      Z_Free(levimage);
+      return 0;
+    }
+
+  return size;
+}
+
+//
+// P_LevelBlockmapOk
+// Whether every cell's list of the loaded blockmap lies inside it, ends
+// with -1 and holds only line numbers, as P_BlockLinesIterator expects.
+//
+
+static boolean P_LevelBlockmapOk(const levcache_t *h)
+{
+  long long cells = (long long) h->bmapwidth * h->bmapheight, i, j;
+
+  if (h->bmapwidth <= 0 || h->bmapheight <= 0 || 4 + cells > h->blockmapsize)
+    return false;
+
+  for (i = 0; i < cells; i++)
+    for (j = blockmaplump[4+i]; ; j++)
+      if (j < 0 || j >= h->blockmapsize ||
+          blockmaplump[j] < -1 || blockmaplump[j] >= numlines)
+        return false;
+      else
+        if (blockmaplump[j] == -1)
+          break;
+
+  return true;
+}
+
+//
+// P_LoadLevelCache
+// Returns false if there is no usable cache, with nothing loaded.
+//
+
+static boolean P_LoadLevelCache(int lumpnum)
+{
+  const levcache_t *h;
+  const byte *p;
+  const int *linerefs;
+  line_t **linebuffer;
+  boolean ok = true;
+  int i, j;
+
+  if (M_CheckParm("-nolevcache"))
+    return false;
+
+  // a restart finds the image still in the cache
+  if (levimage && levimagelump == lumpnum)
+    Z_ChangeTag(levimage, PU_STATIC);
+  else
+    {
+      if (levimage)
+        Z_Free(levimage);
+      levimagelump = -1;
+      P_LevelCacheName(levcachename, lumpnum);
+      if (!P_ReadLevelImage(levcachename))
+        return false;
+      levimagelump = lumpnum;
+    }
+
+  h = levimage;
+  p = (const byte *)(h + 1);
+
+  numvertexes = h->numvertexes;
+  numsectors = h->numsectors;
+  numsides = h->numsides;
+  numlines = h->numlines;
+  numsubsectors = h->numsubsectors;
+  numnodes = h->numnodes;
+  numsegs = h->numsegs;
+
+  vertexes = P_LevelArray(&p, numvertexes * sizeof *vertexes);
+  sectors = P_LevelArray(&p, numsectors * sizeof *sectors);
+  sides = P_LevelArray(&p, numsides * sizeof *sides);
+  lines = P_LevelArray(&p, numlines * sizeof *lines);
+  subsectors = P_LevelArray(&p, numsubsectors * sizeof *subsectors);
+  nodes = P_LevelArray(&p, numnodes * sizeof *nodes);
+  segs = P_LevelArray(&p, numsegs * sizeof *segs);
+  linerefs = (const int *) p;
+  p += LEV_ALIGN(h->numlinerefs * sizeof *linerefs);
+  blockmaplump = P_LevelArray(&p, h->blockmapsize * sizeof *blockmaplump);
+  rejectmatrix = P_LevelArray(&p, h->rejectsize);
+
+  linebuffer = Z_Malloc(h->numlinerefs * sizeof *linebuffer, PU_LEVEL, 0);
+  for (i = 0; i < h->numlinerefs; i++)
+    if ((unsigned) linerefs[i] < (unsigned) numlines)
+      linebuffer[i] = lines + linerefs[i];
+    else
+      ok = false;
+
+  for (i = 0; i < numsectors; i++)
+    {
+      sector_t *sec = sectors + i;
+      intptr_t first = (intptr_t) sec->lines;
+
+      if (first < 0 || sec->linecount < 0 ||
+          first + sec->linecount > h->numlinerefs)
+        ok = false;
+      else
+        sec->lines = linebuffer + first;
+    }
+
+  for (i = 0; i < numsides; i++)
+    LEV_LINK(sides[i].sector, sectors, numsectors);
+
+  for (i = 0; i < numlines; i++)
+    {
+      line_t *ld = lines + i;
+
+      LEV_LINK(ld->v1, vertexes, numvertexes);
+      LEV_LINK(ld->v2, vertexes, numvertexes);
+      LEV_LINK(ld->frontsector, sectors, numsectors);
+      LEV_LINK(ld->backsector, sectors, numsectors);
+    }
+
+  for (i = 0; i < numsubsectors; i++)
+    {
+      subsector_t *ss = subsectors + i;
+
+      LEV_LINK(ss->sector, sectors, numsectors);
+      if (ss->firstline < 0 || ss->numlines < 0 ||
+          ss->firstline + ss->numlines > numsegs)
+        ok = false;
+    }
+
+  // the renderer starts from subsector 0 if there are no nodes
+  if (!numsubsectors)
+    ok = false;
+
+  for (i = 0; i < numnodes; i++)
+    for (j = 0; j < 2; j++)
+      {
+        int child = nodes[i].children[j];
+
+        if (child & NF_SUBSECTOR ? (child & ~NF_SUBSECTOR) >= numsubsectors :
+            child >= numnodes)
+          ok = false;
+      }
+
+  if (!P_LevelBlockmapOk(h))
+    ok = false;
+
+  for (i = 0; i < numsegs; i++)
+    {
+      seg_t *li = segs + i;
+
+      LEV_LINK(li->v1, vertexes, numvertexes);
+      LEV_LINK(li->v2, vertexes, numvertexes);
+      LEV_LINK(li->sidedef, sides, numsides);
+      LEV_LINK(li->linedef, lines, numlines);
+      LEV_LINK(li->frontsector, sectors, numsectors);
+      LEV_LINK(li->backsector, sectors, numsectors);
+    }
+
+  if (!ok)
+    {
+      Z_Free(vertexes);
+      Z_Free(sectors);
+      Z_Free(sides);
+      Z_Free(lines);
+      Z_Free(subsectors);
+      Z_Free(nodes);
+      Z_Free(segs);
+      Z_Free(blockmaplump);
+      Z_Free(rejectmatrix);
+      Z_Free(linebuffer);
+      Z_Free(levimage);
+      levimagelump = -1;      // so it gets written again
+      return false;
+    }
+
+  bmapwidth = h->bmapwidth;
+  bmapheight = h->bmapheight;
+  bmaporgx = h->bmaporgx;
+  bmaporgy = h->bmaporgy;
+  blockmapsize = h->blockmapsize;
+  blockmap = blockmaplump+4;
+
+  i = sizeof(*blocklinks) * bmapwidth * bmapheight;
+  blocklinks = Z_Malloc(i, PU_LEVEL, 0);
+  memset(blocklinks, 0, i);
+
+  Z_ChangeTag(levimage, PU_CACHE);
+  return true;
+}
+
+//
+// P_WriteLevelArray
+// Writes a copy of size bytes at data, with fix applied to each of the
+// count elements, padded out to 8 bytes.
+//
+
+static boolean P_WriteLevelArray(FILE *fp, const void *data, size_t size,
+                                 int count, void (*fix)(void *))
+{
+  static const byte pad[8];
+  size_t padlen = LEV_ALIGN(size) - size;
+  byte *copy = malloc(size + 1);
+  boolean ok;
+  int i;
+
+  if (size)
+    memcpy(copy, data, size);
+  if (fix)
+    for (i = 0; i < count; i++)
+      fix(copy + i * (size / count));
+
+  ok = fwrite(copy, 1, size, fp) == size && fwrite(pad, 1, padlen, fp) == padlen;
+  free(copy);
+  return ok;
+}
+
+static void P_FixSector(void *p)
+{
+  sector_t *sec = p;
+
+  sec->soundtarget = sec->thinglist = NULL;
+  sec->floordata = sec->ceilingdata = sec->lightingdata = NULL;
+  sec->touching_thinglist = NULL;
+  memset(&sec->soundorg.thinker, 0, sizeof sec->soundorg.thinker);
+  sec->lines = (void *)(intptr_t)(sec->lines - sectors->lines);
+}
+
+static void P_FixSide(void *p)
+{
+  side_t *sd = p;
+  sd->sector = LEV_INDEX(sd->sector, sectors);
+}
+
+static void P_FixLine(void *p)
+{
+  line_t *ld = p;
+
+  ld->v1 = LEV_INDEX(ld->v1, vertexes);
+  ld->v2 = LEV_INDEX(ld->v2, vertexes);
+  ld->frontsector = LEV_INDEX(ld->frontsector, sectors);
+  ld->backsector = LEV_INDEX(ld->backsector, sectors);
+  ld->specialdata = NULL;
+}
+
+static void P_FixSubsector(void *p)
+{
+  subsector_t *ss = p;
+  ss->sector = LEV_INDEX(ss->sector, sectors);
+}
+
+static void P_FixSeg(void *p)
+{
+  seg_t *li = p;
+
+  li->v1 = LEV_INDEX(li->v1, vertexes);
+  li->v2 = LEV_INDEX(li->v2, vertexes);
+  li->sidedef = LEV_INDEX(li->sidedef, sides);
+  li->linedef = LEV_INDEX(li->linedef, lines);
+  li->frontsector = LEV_INDEX(li->frontsector, sectors);
+  li->backsector = LEV_INDEX(li->backsector, sectors);
+}
+
+//
+// P_WriteLevelCache
+// Writes the level after the header in data.
+//
+
+static boolean P_WriteLevelCache(FILE *fp, void *data)
+{
+  const levcache_t *header = data;
+  int *linerefs = malloc(header->numlinerefs * sizeof *linerefs + 1);
+  boolean ok;
+  int i;
+
+  for (i = 0; i < header->numlinerefs; i++)
+    linerefs[i] = sectors->lines[i] - lines;
+
+  ok = fwrite(header, sizeof *header, 1, fp) == 1 &&
+    P_WriteLevelArray(fp, vertexes, numvertexes * sizeof *vertexes,
+                      numvertexes, NULL) &&
+    P_WriteLevelArray(fp, sectors, numsectors * sizeof *sectors,
+                      numsectors, P_FixSector) &&
+    P_WriteLevelArray(fp, sides, numsides * sizeof *sides,
+                      numsides, P_FixSide) &&
+    P_WriteLevelArray(fp, lines, numlines * sizeof *lines,
+                      numlines, P_FixLine) &&
+    P_WriteLevelArray(fp, subsectors, numsubsectors * sizeof *subsectors,
+                      numsubsectors, P_FixSubsector) &&
+    P_WriteLevelArray(fp, nodes, numnodes * sizeof *nodes, numnodes, NULL) &&
+    P_WriteLevelArray(fp, segs, numsegs * sizeof *segs, numsegs, P_FixSeg) &&
+    P_WriteLevelArray(fp, linerefs, header->numlinerefs * sizeof *linerefs,
+                      header->numlinerefs, NULL) &&
+    P_WriteLevelArray(fp, blockmaplump, blockmapsize * sizeof *blockmaplump,
+                      blockmapsize, NULL) &&
+    P_WriteLevelArray(fp, rejectmatrix, header->rejectsize, 0, NULL);
+
+  free(linerefs);
+  return ok;
+}
+
+//
+// P_SaveLevelCache
+// Called once P_GroupLines is done, before anything is spawned.
+//
+
+static void P_SaveLevelCache(void)
+{
+  levcache_t header = {LEVCACHE_MAGIC};
+  int i;
+
+  if (M_CheckParm("-nolevcache") || levimagelump != -1)
+    return;
+
+  P_LevelSizes(header.sizes);
+  header.numvertexes = numvertexes;
+  header.numsectors = numsectors;
+  header.numsides = numsides;
+  header.numlines = numlines;
+  header.numsubsectors = numsubsectors;
+  header.numnodes = numnodes;
+  header.numsegs = numsegs;
+  for (i = 0; i < numsectors; i++)
+    header.numlinerefs += sectors[i].linecount;
+  header.bmapwidth = bmapwidth;
+  header.bmapheight = bmapheight;
+  header.bmaporgx = bmaporgx;
+  header.bmaporgy = bmaporgy;
+  header.blockmapsize = blockmapsize;
+  header.rejectsize = ((long long) numsectors * numsectors + 7) / 8;
+
+  M_WriteFileAtomic(levcachename, P_WriteLevelCache, &header);
+}
+
 //
 // P_SetupLevel
 //
@@ -848,7 +1373,9 @@ void P_SetupLevel(int episode, int map, int playermask, skill_t skill)
 
   Z_FreeTags(PU_LEVEL, PU_PURGELEVEL-1);
 
+  P_ClearThinkerPools();
   P_InitThinkers();
+  P_InvalidateSight();
 
   // if working with a devlopment map, reload it
   //    W_Reload ();     killough 1/31/98: W_Reload obsolete
@@ -869,19 +1396,24 @@ void P_SetupLevel(int episode, int map, int playermask, skill_t skill)
   // killough 4/4/98: split load of sidedefs into two parts,
   // to allow texture names to be used in special linedefs
 
-  P_LoadVertexes  (lumpnum+ML_VERTEXES);
-  P_LoadSectors   (lumpnum+ML_SECTORS);
-  P_LoadSideDefs  (lumpnum+ML_SIDEDEFS);             // killough 4/4/98
-  P_LoadLineDefs  (lumpnum+ML_LINEDEFS);             //       |
-  P_LoadSideDefs2 (lumpnum+ML_SIDEDEFS);             //       |
-  P_LoadLineDefs2 (lumpnum+ML_LINEDEFS);             // killough 4/4/98
-  P_LoadBlockMap  (lumpnum+ML_BLOCKMAP);             // killough 3/1/98
-  P_LoadSubsectors(lumpnum+ML_SSECTORS);
-  P_LoadNodes     (lumpnum+ML_NODES);
-  P_LoadSegs      (lumpnum+ML_SEGS);
-
-  rejectmatrix = W_CacheLumpNum(lumpnum+ML_REJECT,PU_LEVEL);
-  P_GroupLines();
+  if (!P_LoadLevelCache(lumpnum))
+    {
+      P_LoadVertexes  (lumpnum+ML_VERTEXES);
+      P_LoadSectors   (lumpnum+ML_SECTORS);
+      P_LoadSideDefs  (lumpnum+ML_SIDEDEFS);         // killough 4/4/98
+      P_LoadLineDefs  (lumpnum+ML_LINEDEFS);         //       |
+      P_LoadSideDefs2 (lumpnum+ML_SIDEDEFS);         //       |
+      P_LoadLineDefs2 (lumpnum+ML_LINEDEFS);         // killough 4/4/98
+      P_LoadBlockMap  (lumpnum+ML_BLOCKMAP);         // killough 3/1/98
+      P_LoadSubsectors(lumpnum+ML_SSECTORS);
+      P_LoadNodes     (lumpnum+ML_NODES);
+      P_LoadSegs      (lumpnum+ML_SEGS);
+
+      P_LoadReject    (lumpnum+ML_REJECT);
+      P_GroupLines();
+
+      P_SaveLevelCache();
+    }
 
   bodyqueslot = 0;
 
@@ -910,6 +1442,9 @@ void P_SetupLevel(int episode, int map, int playermask, skill_t skill)
   // preload graphics
   if (precache)
     R_PrecacheLevel();
+
+  // convert sounds in the background
+  S_PrecacheLevelSounds();
 }
 
 //
@@ -27,6 +27,7 @@
 //
 //-----------------------------------------------------------------------------
 
+#include "doomstat.h"
 #include "r_main.h"
 #include "p_maputl.h"
 #include "p_setup.h"
@@ -45,6 +46,35 @@ typedef struct {
   fixed_t bbox[4];
 } los_t;
 
+//
+// Sight cache
+//
+// Monsters look at the same player many times in a tic -- A_Chase alone
+// may ask three times -- and the BSP traversal is the expensive part of
+// the answer. Its outcome depends only on the eye position of the
+// looker, the position and height of the target, and the sector
+// heights, so results are kept in a small direct-mapped table keyed by
+// exactly those, good until the next tic or until a floor or ceiling
+// moves. A hit returns what the traversal would have, bit for bit.
+//
+
+#define SIGHT_CACHE 512         /* a power of two */
+
+typedef struct {
+  fixed_t x1, y1, z1, x2, y2, z2, h2;  // eye, then target
+  unsigned stamp;                       // sightstamp when stored
+  boolean result;
+} sightentry_t;
+
+static sightentry_t sightcache[SIGHT_CACHE];
+static unsigned sightstamp = 1;
+static int sighttic = -1;
+
+void P_InvalidateSight(void)
+{
+  sightstamp++;
+}
+
 //
 // P_DivlineSide
 // Returns side 0 (front), 1 (back), or 2 (on).
@@ -218,6 +248,7 @@ boolean P_CheckSight(mobj_t *t1, mobj_t *t2)
   const sector_t *s1 = t1->subsector->sector;
   const sector_t *s2 = t2->subsector->sector;
   long long pnum = (s1-sectors)*numsectors + (s2-sectors);
+  sightentry_t *entry;
   los_t los;
 
   // First check for trivial rejection.
@@ -250,11 +281,27 @@ boolean P_CheckSight(mobj_t *t1, mobj_t *t2)
   // An unobstructed LOS is possible.
   // Now look from eyes of t1 to any part of t2.
 
+  los.sightzstart = t1->z + t1->height - (t1->height>>2);
+
+  if (sighttic != gametic)
+    {
+      sighttic = gametic;
+      sightstamp++;
+    }
+
+  entry = &sightcache[(t1->x * 0x9e3779b1u ^ t1->y * 0x85ebca6bu ^
+                       t2->x * 0xc2b2ae35u ^ t2->y * 0x27d4eb2fu ^
+                       los.sightzstart ^ t2->z) >> 16 & (SIGHT_CACHE-1)];
+
+  if (entry->stamp == sightstamp &&
+      entry->x1 == t1->x && entry->y1 == t1->y &&
+      entry->z1 == los.sightzstart && entry->x2 == t2->x &&
+      entry->y2 == t2->y && entry->z2 == t2->z && entry->h2 == t2->height)
+    return entry->result;
+
   validcount++;
 
-  los.topslope = (los.bottomslope = t2->z - (los.sightzstart =
-                                             t1->z + t1->height -
-                                             (t1->height>>2))) + t2->height;
+  los.topslope = (los.bottomslope = t2->z - los.sightzstart) + t2->height;
   los.strace.dx = (los.t2x = t2->x) - (los.strace.x = t1->x);
   los.strace.dy = (los.t2y = t2->y) - (los.strace.y = t1->y);
 
@@ -269,5 +316,13 @@ boolean P_CheckSight(mobj_t *t1, mobj_t *t2)
     los.bbox[BOXTOP] = t2->y, los.bbox[BOXBOTTOM] = t1->y;
 
   // the head node is the last node output
-  return P_CrossBSPNode(numnodes-1, &los);
+  entry->x1 = t1->x;
+  entry->y1 = t1->y;
+  entry->z1 = los.sightzstart;
+  entry->x2 = t2->x;
+  entry->y2 = t2->y;
+  entry->z2 = t2->z;
+  entry->h2 = t2->height;
+  entry->stamp = sightstamp;
+  return entry->result = P_CrossBSPNode(numnodes-1, &los);
 }
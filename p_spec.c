@@ -2538,7 +2538,7 @@ void T_Scroll(scroll_t *s)
 static void Add_Scroller(int type, fixed_t dx, fixed_t dy,
                          int control, int affectee, int accel)
 {
-  scroll_t *s = Z_Malloc(sizeof *s, PU_LEVSPEC, 0);
+  scroll_t *s = P_AllocThinker(sizeof *s);
   s->thinker.function = T_Scroll;
   s->type = type;
   s->dx = dx;
@@ -2830,7 +2830,7 @@ static void P_SpawnFriction(void)
 static void Add_Pusher(int type, int x_mag, int y_mag,
                        mobj_t *source, int affectee)
 {
-  pusher_t *p = Z_Malloc(sizeof *p, PU_LEVSPEC, 0);
+  pusher_t *p = P_AllocThinker(sizeof *p);
 
   p->thinker.function = T_Pusher;
   p->source = source;
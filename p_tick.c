@@ -31,12 +31,13 @@
 #include "p_user.h"
 #include "p_spec.h"
 #include "p_tick.h"
+#include "p_enemy.h"
 
 int leveltime;
 
 //
 // THINKERS
-// All thinkers should be allocated by Z_Malloc
+// All thinkers should be allocated by P_AllocThinker
 // so they can be operated on uniformly.
 // The actual structures will vary in size,
 // but the first element must be thinker_t.
@@ -50,6 +51,84 @@ thinker_t thinkercap;
 
 thinker_t thinkerclasscap[NUMTHCLASS];
 
+//
+// Thinker pools
+//
+// Thinkers come and go all the time -- puffs, blood and missiles above
+// all -- so they are kept out of the zone. Each is taken from a pool of
+// slots of its size in cache lines, carved from slabs of SLAB_SIZE bytes
+// aligned on that size; the first line of a slab says which pool it
+// feeds, so P_FreeThinker can find it from the address alone. Free slots
+// are chained through their first word, and the latest freed is reused
+// first, while it is still in the cache. Slabs come from PU_LEVEL zone
+// blocks, so they go with the level, and P_ClearThinkerPools forgets
+// them after Z_FreeTags.
+//
+
+#define SLAB_SIZE     16384     /* a power of two */
+#define SLAB_LINE     64        /* cache line */
+#define SLAB_REGION   8         /* slabs per zone block */
+#define THINKER_POOLS 16        /* up to SLAB_LINE*THINKER_POOLS bytes */
+
+static void *thinkerpool[THINKER_POOLS+1];      // indexed by lines
+static byte *slabnext, *slabend;                // unused slabs
+
+void P_ClearThinkerPools(void)
+{
+  memset(thinkerpool, 0, sizeof thinkerpool);
+  slabnext = slabend = NULL;
+}
+
+void *P_AllocThinker(size_t size)
+{
+  int lines = (size + SLAB_LINE - 1) / SLAB_LINE;
+  void **slot;
+
+  if (lines > THINKER_POOLS)
+    I_Error("P_AllocThinker: %lu byte thinker is too large",
+            (unsigned long) size);
+
+  if (!thinkerpool[lines])
+    {
+      byte *slab, *p;
+
+      if (slabnext == slabend)
+        {
+          uintptr_t region = (uintptr_t)
+            Z_Malloc(SLAB_SIZE * (SLAB_REGION+1), PU_LEVEL, NULL);
+          slabnext = (byte *)((region + SLAB_SIZE - 1) & ~(uintptr_t)(SLAB_SIZE-1));
+          slabend = slabnext + SLAB_SIZE * SLAB_REGION;
+        }
+
+      slab = slabnext;
+      slabnext += SLAB_SIZE;
+      *(int *) slab = lines;
+
+      // chain the slots so they are handed out in address order
+      for (p = slab + SLAB_SIZE - lines * SLAB_LINE; p > slab; p -= lines * SLAB_LINE)
+        {
+          *(void **) p = thinkerpool[lines];
+          thinkerpool[lines] = p;
+        }
+    }
+
+  slot = thinkerpool[lines];
+  thinkerpool[lines] = *slot;
+
+  // specials get their function after P_AddThinker sorts them
+  ((thinker_t *) slot)->function = NULL;
+  return slot;
+}
+
+void P_FreeThinker(thinker_t *thinker)
+{
+  byte *slab = (byte *)((uintptr_t) thinker & ~(uintptr_t)(SLAB_SIZE-1));
+  int lines = *(int *) slab;
+
+  *(void **) thinker = thinkerpool[lines];
+  thinkerpool[lines] = thinker;
+}
+
 //
 // P_InitThinkers
 //
@@ -64,12 +143,18 @@ void P_InitThinkers(void)
   thinkercap.prev = thinkercap.next  = &thinkercap;
 }
 
+// The thinker being run by P_RunThinkerClass, stepped back to the one
+// before it when it moves to another class.
+
+static thinker_t *classthinker;
+
 //
 // P_UpdateThinker
 //
 // killough 8/29/98:
 // 
 //
+
 void P_UpdateThinker(thinker_t *thinker)
 {
    thinker_t *th;
@@ -78,12 +163,16 @@ void P_UpdateThinker(thinker_t *thinker)
   
    // haleyjd 07/12/03: don't use "class" as a variable name
    int tclass = thinker->function == P_RemoveThinkerDelayed ? th_delete :
-     thinker->function == P_MobjThinker && 
+     thinker->function != P_MobjThinker ? th_special :
+     ((mobj_t *) thinker)->dormant ? th_dormant :
      ((mobj_t *) thinker)->health > 0 && 
      (((mobj_t *) thinker)->flags & MF_COUNTKILL ||
       ((mobj_t *) thinker)->type == MT_SKULL) ?
       th_enemies : th_misc;
 
+   if (thinker == classthinker)
+      classthinker = thinker->cprev;
+
    // Remove from current thread, if in one -- haleyjd: from PrBoom
    if((th = thinker->cnext) != NULL)
       (th->cprev = thinker->cprev)->cnext = th;
@@ -143,7 +232,7 @@ void P_RemoveThinkerDelayed(thinker_t *thinker)
       // haleyjd 6/17/08: remove from threaded list now
       (thinker->cnext->cprev = thinker->cprev)->cnext = thinker->cnext;
 
-      Z_Free(thinker);
+      P_FreeThinker(thinker);
    }
 }
 
@@ -199,6 +288,33 @@ void P_SetTarget(mobj_t **mop, mobj_t *targ)
     targ->thinker.references++;
 }
 
+//
+// P_RunThinkerClass
+//
+// Thinkers may also be run a class at a time: every mobj, with direct
+// calls to P_MobjThinker, then the specials, then the deletions. Mobjs
+// come from one thinker pool, so this sweeps one stretch of memory and
+// keeps the indirect call out of the busiest loop. It changes the order
+// things happen in, and so the random numbers each one gets, so the
+// whole list is still run in order whenever a demo or another node has
+// to see the same game, or the demo is an old one.
+//
+
+static void P_RunThinkerClass(int tclass)
+{
+  thinker_t *cap = &thinkerclasscap[tclass];
+
+  for (classthinker = cap->cnext; classthinker != cap;
+       classthinker = classthinker->cnext)
+    if (tclass != th_special)
+      P_MobjThinker((mobj_t *) classthinker);
+    else
+      if (classthinker->function)
+        classthinker->function(classthinker);
+
+  classthinker = NULL;
+}
+
 //
 // P_RunThinkers
 //
@@ -224,11 +340,28 @@ void P_SetTarget(mobj_t **mop, mobj_t *targ)
 
 static void P_RunThinkers (void)
 {
-  for (currentthinker = thinkercap.next;
-       currentthinker != &thinkercap;
-       currentthinker = currentthinker->next)
-    if (currentthinker->function)
-      currentthinker->function(currentthinker);
+  if (demo_compatibility || demoplayback || demorecording || netgame)
+    {
+      for (currentthinker = thinkercap.next;
+           currentthinker != &thinkercap;
+           currentthinker = currentthinker->next)
+        if (currentthinker->function)
+          currentthinker->function(currentthinker);
+    }
+  else
+    {
+      thinker_t *cap = &thinkerclasscap[th_delete], *th, *next;
+
+      P_RunThinkerClass(th_enemies);
+      P_RunThinkerClass(th_misc);
+      P_RunThinkerClass(th_special);
+
+      for (th = cap->cnext; th != cap; th = next)
+        {
+          next = th->cnext;
+          P_RemoveThinkerDelayed(th);
+        }
+    }
 }
 
 //
@@ -256,6 +389,7 @@ void P_Ticker (void)
       P_PlayerThink(&players[i]);
 
   P_RunThinkers();
+  P_CheckDormant();
   P_UpdateSpecials();
   P_RespawnSpecials();
   leveltime++;                       // for par times
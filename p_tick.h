@@ -37,6 +37,9 @@ void P_Ticker(void);
 extern thinker_t thinkercap;  // Both the head and tail of the thinker list
 
 void P_InitThinkers(void);
+void *P_AllocThinker(size_t size);
+void P_FreeThinker(thinker_t *thinker);
+void P_ClearThinkerPools(void);              // after freeing the level
 void P_AddThinker(thinker_t *thinker);
 void P_RemoveThinker(thinker_t *thinker);
 void P_RemoveThinkerDelayed(thinker_t *thinker);    // killough 4/25/98
@@ -48,8 +51,10 @@ void P_SetTarget(mobj_t **mo, mobj_t *target);   // killough 11/98
 // killough 8/29/98: threads of thinkers, for more efficient searches
 typedef enum {
    th_delete,  // haleyjd 11/09/06: giant bug fix
-   th_misc,
+   th_misc,    // mobjs other than enemies
    th_enemies,
+   th_special, // sector and line specials: movers, lights, scrollers
+   th_dormant, // parked monsters, not run at all
    NUMTHCLASS
 } th_class;
 
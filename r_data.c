@@ -33,6 +33,8 @@
 #include "r_main.h"
 #include "r_sky.h"
 #include "i_video.h"
+#include "i_system.h"
+#include "d_main.h"
 
 //
 // Graphics.
@@ -760,6 +762,116 @@ int tran_filter_pct = 66;       // filter percent
 
 #define TSC 12        /* number of fixed point digits in filter percent */
 
+// At startup the map is composed by a task, which leaves the console to
+// the main thread and never touches the zone: the palette and the map
+// are set up before it starts, and R_FinishTranMap releases them after.
+
+static unsigned char *tranmap_playpal;
+static char tranmap_fname[PATH_MAX+1];
+static i_task_t *tranmap_task;
+
+// progress is -1 on a worker, where nothing may be shown
+
+static void R_ComposeTranMap(void *data)
+{
+  int progress = (intptr_t) data, phase = D_BeginPhase("R_ComposeTranMap");
+  const unsigned char *playpal = tranmap_playpal;
+  struct {
+    unsigned char pct;
+    unsigned char playpal[256*3];
+  } cache;
+  FILE *cachefp = fopen(tranmap_fname,"r+b");
+
+  // Use cached translucency filter if it's available
+
+  if (!cachefp ? cachefp = fopen(tranmap_fname,"wb") , 1 :
+      fread(&cache, 1, sizeof cache, cachefp) != sizeof cache ||
+      cache.pct != tran_filter_pct ||
+      memcmp(cache.playpal, playpal, sizeof cache.playpal) ||
+      fread(main_tranmap, 256, 256, cachefp) != 256 ) // killough 4/11/98
+    {
+      long long pal[3][256], tot[256], pal_w1[3][256];
+      long long w1 = ((unsigned long) tran_filter_pct<<TSC)/100;
+      long long w2 = (1l<<TSC)-w1;
+
+      // First, convert playpal into long long int type, and transpose array,
+      // for fast inner-loop calculations. Precompute tot array.
+
+      {
+        int i = 255;
+        const unsigned char *p = playpal+255*3;
+        do
+          {
+            long long t,d;
+            pal_w1[0][i] = (pal[0][i] = t = p[0]) * w1;
+            d = t*t;
+            pal_w1[1][i] = (pal[1][i] = t = p[1]) * w1;
+            d += t*t;
+            pal_w1[2][i] = (pal[2][i] = t = p[2]) * w1;
+            d += t*t;
+            p -= 3;
+            tot[i] = d << (TSC-1);
+          }
+        while (--i>=0);
+      }
+
+      // Next, compute all entries using minimum arithmetic.
+
+      {
+        int i,j;
+        byte *tp = main_tranmap;
+        for (i=0;i<256;i++)
+          {
+            long long r1 = pal[0][i] * w2;
+            long long g1 = pal[1][i] * w2;
+            long long b1 = pal[2][i] * w2;
+
+            if (!(i & 31) && progress > 0)
+              putchar('.');
+
+            if (progress >= 0)
+              {
+                if (i & 32)       // killough 10/98: display flashing disk
+                  I_EndRead();
+                else
+                  I_BeginRead();
+              }
+
+            for (j=0;j<256;j++,tp++)
+              {
+                int color = 255;
+                long long err;
+                long long r = pal_w1[0][j] + r1;
+                long long g = pal_w1[1][j] + g1;
+                long long b = pal_w1[2][j] + b1;
+                long long best = LONG_MAX;
+                do
+                  if ((err = tot[color] - pal[0][color]*r
+                      - pal[1][color]*g - pal[2][color]*b) < best)
+                    best = err, *tp = color;
+                while (--color >= 0);
+              }
+          }
+      }
+      if (cachefp)        // write out the cached translucency map
+        {
+          cache.pct = tran_filter_pct;
+          memcpy(cache.playpal, playpal, sizeof cache.playpal);
+          fseek(cachefp, 0, SEEK_SET);
+          fwrite(&cache, 1, sizeof cache, cachefp);
+          fwrite(main_tranmap, 256, 256, cachefp);
+        }
+    }
+  else
+    if (progress > 0)
+      fputs("........",stdout);
+
+  if (cachefp)              // killough 11/98: fix filehandle leak
+    fclose(cachefp);
+
+  D_EndPhase(phase);
+}
+
 void R_InitTranMap(int progress)
 {
   int lump = W_CheckNumForName("TRANMAP");
@@ -770,108 +882,42 @@ void R_InitTranMap(int progress)
     main_tranmap = W_CacheLumpNum(lump, PU_STATIC);   // killough 4/11/98
   else
     {   // Compose a default transparent filter map based on PLAYPAL.
-      unsigned char *playpal = W_CacheLumpName("PLAYPAL", PU_STATIC);
-      char fname[PATH_MAX+1], *D_DoomExeDir(void);
-      struct {
-        unsigned char pct;
-        unsigned char playpal[256*3];
-      } cache;
+      tranmap_playpal = W_CacheLumpName("PLAYPAL", PU_STATIC);
 
       #ifdef UNIX
       char * unix_home_tranmap = getenv("HOME");
-      FILE *cachefp = fopen(strcat(strcpy(fname, unix_home_tranmap),
-                                "/.tranmap.dat"),"r+b");
+      strcat(strcpy(tranmap_fname, unix_home_tranmap), "/.tranmap.dat");
       #else
-      FILE *cachefp = fopen(strcat(strcpy(fname, D_DoomExeDir()),
-                                "/tranmap.dat"),"r+b");
+      strcat(strcpy(tranmap_fname, D_DoomExeDir()), "/tranmap.dat");
       #endif
       main_tranmap = Z_Malloc(256*256, PU_STATIC, 0);  // killough 4/11/98
 
-      // Use cached translucency filter if it's available
-
-      if (!cachefp ? cachefp = fopen(fname,"wb") , 1 :
-          fread(&cache, 1, sizeof cache, cachefp) != sizeof cache ||
-          cache.pct != tran_filter_pct ||
-          memcmp(cache.playpal, playpal, sizeof cache.playpal) ||
-          fread(main_tranmap, 256, 256, cachefp) != 256 ) // killough 4/11/98
+      if (progress)     // at startup, so overlap it with the rest
         {
-          long long pal[3][256], tot[256], pal_w1[3][256];
-          long long w1 = ((unsigned long) tran_filter_pct<<TSC)/100;
-          long long w2 = (1l<<TSC)-w1;
-
-          // First, convert playpal into long long int type, and transpose array,
-          // for fast inner-loop calculations. Precompute tot array.
-
-          {
-            int i = 255;
-            const unsigned char *p = playpal+255*3;
-            do
-              {
-                long long t,d;
-                pal_w1[0][i] = (pal[0][i] = t = p[0]) * w1;
-                d = t*t;
-                pal_w1[1][i] = (pal[1][i] = t = p[1]) * w1;
-                d += t*t;
-                pal_w1[2][i] = (pal[2][i] = t = p[2]) * w1;
-                d += t*t;
-                p -= 3;
-                tot[i] = d << (TSC-1);
-              }
-            while (--i>=0);
-          }
-
-          // Next, compute all entries using minimum arithmetic.
-
-          {
-            int i,j;
-            byte *tp = main_tranmap;
-            for (i=0;i<256;i++)
-              {
-                long long r1 = pal[0][i] * w2;
-                long long g1 = pal[1][i] * w2;
-                long long b1 = pal[2][i] * w2;
-
-                if (!(i & 31) && progress)
-		  putchar('.');
-
-		  if (i & 32)       // killough 10/98: display flashing disk
-		    I_EndRead();
-		  else
-		    I_BeginRead();
-
-                for (j=0;j<256;j++,tp++)
-                  {
-                    int color = 255;
-                    long long err;
-                    long long r = pal_w1[0][j] + r1;
-                    long long g = pal_w1[1][j] + g1;
-                    long long b = pal_w1[2][j] + b1;
-                    long long best = LONG_MAX;
-                    do
-                      if ((err = tot[color] - pal[0][color]*r
-                          - pal[1][color]*g - pal[2][color]*b) < best)
-                        best = err, *tp = color;
-                    while (--color >= 0);
-                  }
-              }
-          }
-          if (cachefp)        // write out the cached translucency map
-            {
-              cache.pct = tran_filter_pct;
-              memcpy(cache.playpal, playpal, sizeof cache.playpal);
-              fseek(cachefp, 0, SEEK_SET);
-              fwrite(&cache, 1, sizeof cache, cachefp);
-              fwrite(main_tranmap, 256, 256, cachefp);
-            }
+          tranmap_task = I_StartTask(R_ComposeTranMap, (void *) -1);
+          fputs("........",stdout);
         }
       else
-	if (progress)
-	  fputs("........",stdout);
+        {
+          R_ComposeTranMap(0);
+          R_FinishTranMap();
+        }
+    }
+}
 
-      if (cachefp)              // killough 11/98: fix filehandle leak
-	fclose(cachefp);
+//
+// R_FinishTranMap
+// Waits for the translucency map to be composed, if it is.
+//
 
-      Z_ChangeTag(playpal, PU_CACHE);
+void R_FinishTranMap(void)
+{
+  if (tranmap_playpal)
+    {
+      I_FinishTask(tranmap_task);
+      tranmap_task = NULL;
+      Z_ChangeTag(tranmap_playpal, PU_CACHE);
+      tranmap_playpal = NULL;
     }
 }
 
@@ -884,9 +930,13 @@ void R_InitTranMap(int progress)
 
 void R_InitData(void)
 {
+  int phase = D_BeginPhase("R_InitTextures");
   R_InitTextures();
+  D_EndPhase(phase);
+  phase = D_BeginPhase("R_InitFlats");
   R_InitFlats();
   R_InitSpriteLumps();
+  D_EndPhase(phase);
   if (general_translucency)             // killough 3/1/98, 10/98
     R_InitTranMap(1);                   // killough 2/21/98, 3/6/98
   R_InitColormaps();                    // killough 3/20/98
@@ -955,6 +1005,9 @@ int R_TextureNumForName(const char *name)  // const added -- killough
 //
 // Totally rewritten by Lee Killough to use less memory,
 // to avoid using alloca(), and to improve performance.
+//
+// The lumps are queued for W_PrefetchLump's workers rather than read
+// here, so the reads overlap the rest of the level setup.
 
 void R_PrecacheLevel(void)
 {
@@ -978,7 +1031,7 @@ void R_PrecacheLevel(void)
 
   for (i = numflats; --i >= 0; )
     if (hitlist[i])
-      W_CacheLumpNum(firstflat + i, PU_CACHE);
+      W_PrefetchLump(firstflat + i);
 
   // Precache textures.
 
@@ -1004,7 +1057,7 @@ void R_PrecacheLevel(void)
         texture_t *texture = textures[i];
         int j = texture->patchcount;
         while (--j >= 0)
-          W_CacheLumpNum(texture->patches[j].patch, PU_CACHE);
+          W_PrefetchLump(texture->patches[j].patch);
       }
 
   // Precache sprites.
@@ -1026,7 +1079,7 @@ void R_PrecacheLevel(void)
             short *sflump = sprites[i].spriteframes[j].lump;
             int k = 7;
             do
-              W_CacheLumpNum(firstspritelump + sflump[k], PU_CACHE);
+              W_PrefetchLump(firstspritelump + sflump[k]);
             while (--k >= 0);
           }
       }
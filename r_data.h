@@ -52,6 +52,7 @@ int R_TextureNumForName (const char *name);    // killough -- const added
 int R_CheckTextureNumForName (const char *name); 
 
 void R_InitTranMap(int);      // killough 3/6/98: translucency initialization
+void R_FinishTranMap(void);
 int R_ColormapNumForName(const char *name);      // killough 4/4/98
 
 void R_InitColormaps(void);   // killough 8/9/98
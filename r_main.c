@@ -38,6 +38,7 @@
 #include "m_bbox.h"
 #include "r_sky.h"
 #include "v_video.h"
+#include "r_data.h"
 
 // Fineangles in the SCREENWIDTH wide window.
 #define FIELDOFVIEW 2048    
@@ -425,6 +426,17 @@ void R_Init (void)
   puts("R_InitTranslationsTables");
 }
 
+//
+// R_FinishInit
+// Waits for the parts of R_Init and R_InitSprites left to tasks.
+//
+
+void R_FinishInit(void)
+{
+  R_FinishTranMap();
+  R_FinishSprites();
+}
+
 //
 // R_PointInSubsector
 //
@@ -106,6 +106,7 @@ subsector_t *R_PointInSubsector(fixed_t x, fixed_t y);
 
 void R_RenderPlayerView(player_t *player);   // Called by G_Drawer.
 void R_Init(void);                           // Called by startup code.
+void R_FinishInit(void);                     // Waits for what R_Init started.
 void R_SetViewSize(int blocks);              // Called by M_Responder.
 
 void R_InitLightTables(void);                // killough 8/9/98
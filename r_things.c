@@ -34,6 +34,8 @@
 #include "r_segs.h"
 #include "r_draw.h"
 #include "r_things.h"
+#include "i_system.h"
+#include "d_main.h"
 
 #define MINZ        (FRACUNIT*4)
 #define BASEYCENTER 100
@@ -79,16 +81,32 @@ int numsprites;
 static spriteframe_t sprtemp[MAX_SPRITE_FRAMES];
 static int maxframe;
 
+// R_InitSpriteDefs runs as a task while the rest of startup goes on.
+// It works on the copy of the names passed to it, fills in the counts
+// of sprites[], which the main thread allocates, and stages the frames
+// outside the zone, which is not safe to use from workers; errors are
+// kept for the main thread to report as well. R_FinishSprites waits
+// for it and moves the frames into the zone.
+
+static char **spritenames;
+static spriteframe_t *spritestage;      // MAX_SPRITE_FRAMES per sprite
+static char spriteerror[80];
+static i_task_t *spritetask;
+
 //
 // R_InstallSpriteLump
 // Local function for R_InitSprites.
 //
 
-static void R_InstallSpriteLump(int lump, unsigned frame,
+static boolean R_InstallSpriteLump(int lump, unsigned frame,
     unsigned rotation, boolean flipped)
 {
     if (frame >= MAX_SPRITE_FRAMES || rotation > 8)
-        I_Error("R_InstallSpriteLump: Bad frame characters in lump %i", lump);
+    {
+        sprintf(spriteerror, "R_InstallSpriteLump: Bad frame characters "
+            "in lump %i", lump);
+        return false;
+    }
 
     if ((int)frame > maxframe)
         maxframe = frame;
@@ -103,7 +121,7 @@ static void R_InstallSpriteLump(int lump, unsigned frame,
                 sprtemp[frame].flip[r] = (byte)flipped;
                 sprtemp[frame].rotate = false; //jff 4/24/98 if any subbed, rotless
             }
-        return;
+        return true;
     }
 
     // the lump is only used for one rotation
@@ -114,6 +132,7 @@ static void R_InstallSpriteLump(int lump, unsigned frame,
         sprtemp[frame].flip[rotation] = (byte)flipped;
         sprtemp[frame].rotate = true; //jff 4/24/98 only change if rot used
     }
+    return true;
 }
 
 //
@@ -142,27 +161,17 @@ static void R_InstallSpriteLump(int lump, unsigned frame,
 
 #define R_SpriteNameHash(s) ((unsigned)((s)[0]-((s)[1]*3-(s)[3]*2-(s)[2])*2))
 
-void R_InitSpriteDefs(char** namelist)
+static void R_InitSpriteDefs(void *unused)
 {
     size_t numentries = lastspritelump - firstspritelump + 1;
     struct { int index, next; } *hash;
-    int i;
-
-    if (!numentries || !*namelist)
-        return;
-
-    // count the number of sprite names
-    for (i = 0; namelist[i]; i++)
-        ;
-
-    numsprites = i;
-
-    sprites = Z_Malloc(numsprites * sizeof(*sprites), PU_STATIC, NULL);
+    char **namelist = spritenames;
+    int i, phase = D_BeginPhase("R_InitSpriteDefs");
 
     // Create hash table based on just the first four letters of each sprite
     // killough 1/31/98
 
-    hash = malloc(sizeof(*hash) * numentries); // allocate hash table
+    hash = (malloc)(sizeof(*hash) * numentries); // allocate hash table
 
     for (i = 0; i < numentries; i++)             // initialize hash table as empty
         hash[i].index = -1;
@@ -177,11 +186,13 @@ void R_InitSpriteDefs(char** namelist)
     // scan all the lump names for each of the names,
     //  noting the highest frame letter.
 
-    for (i = 0; i < numsprites; i++)
+    for (i = 0; i < numsprites && !*spriteerror; i++)
     {
         const char* spritename = namelist[i];
         int j = hash[R_SpriteNameHash(spritename) % numentries].index;
 
+        sprites[i].numframes = 0;
+
         if (j >= 0)
         {
             memset(sprtemp, -1, sizeof(sprtemp));
@@ -198,20 +209,22 @@ void R_InitSpriteDefs(char** namelist)
                     (lump->name[2] ^ spritename[2]) |
                     (lump->name[3] ^ spritename[3])))
                 {
-                    R_InstallSpriteLump(j + firstspritelump,
+                    if (!R_InstallSpriteLump(j + firstspritelump,
                         lump->name[4] - 'A',
                         lump->name[5] - '0',
-                        false);
-                    if (lump->name[6])
-                        R_InstallSpriteLump(j + firstspritelump,
+                        false))
+                        break;
+                    if (lump->name[6] &&
+                        !R_InstallSpriteLump(j + firstspritelump,
                             lump->name[6] - 'A',
                             lump->name[7] - '0',
-                            true);
+                            true))
+                        break;
                 }
             } while ((j = hash[j].next) >= 0);
 
             // check the frames that were found for completeness
-            if ((sprites[i].numframes = ++maxframe))  // killough 1/31/98
+            if (!*spriteerror && (sprites[i].numframes = ++maxframe))  // killough 1/31/98
             {
                 int frame;
                 for (frame = 0; frame < maxframe; frame++)
@@ -219,7 +232,7 @@ void R_InitSpriteDefs(char** namelist)
                     {
                     case -1:
                         // no rotations were found for that frame at all
-                        I_Error("R_InitSprites: No patches found "
+                        sprintf(spriteerror, "R_InitSprites: No patches found "
                             "for %.8s frame %c", namelist[i], frame + 'A');
                         break;
 
@@ -233,21 +246,55 @@ void R_InitSpriteDefs(char** namelist)
                         int rotation;
                         for (rotation = 0; rotation < 8; rotation++)
                             if (sprtemp[frame].lump[rotation] == -1)
-                                I_Error("R_InitSprites: Sprite %.8s frame %c "
-                                    "is missing rotations",
+                            {
+                                sprintf(spriteerror, "R_InitSprites: Sprite "
+                                    "%.8s frame %c is missing rotations",
                                     namelist[i], frame + 'A');
+                                break;
+                            }
                         break;
                     }
                     }
-                // allocate space for the frames present and copy sprtemp to it
-                sprites[i].spriteframes =
-                    Z_Malloc(maxframe * sizeof(spriteframe_t), PU_STATIC, NULL);
-                memcpy(sprites[i].spriteframes, sprtemp,
+                // stage the frames present for R_FinishSprites
+                memcpy(spritestage + i * MAX_SPRITE_FRAMES, sprtemp,
                     maxframe * sizeof(spriteframe_t));
             }
         }
     }
-    free(hash);             // free hash table
+    (free)(hash);             // free hash table
+    D_EndPhase(phase);
+}
+
+//
+// R_FinishSprites
+// Waits for R_InitSpriteDefs, and copies the frames into the zone.
+//
+
+void R_FinishSprites(void)
+{
+    int i;
+
+    if (!spritestage)
+        return;
+
+    I_FinishTask(spritetask);
+    spritetask = NULL;
+
+    if (*spriteerror)
+        I_Error("%s", spriteerror);
+
+    for (i = 0; i < numsprites; i++)
+        if (sprites[i].numframes)
+        {
+            // allocate space for the frames present and copy them to it
+            sprites[i].spriteframes = Z_Malloc(sprites[i].numframes *
+                sizeof(spriteframe_t), PU_STATIC, NULL);
+            memcpy(sprites[i].spriteframes, spritestage + i * MAX_SPRITE_FRAMES,
+                sprites[i].numframes * sizeof(spriteframe_t));
+        }
+
+    (free)(spritestage);
+    spritestage = NULL;
 }
 
 //
@@ -267,7 +314,24 @@ void R_InitSprites(char** namelist)
     int i;
     for (i = 0; i < MAX_SCREENWIDTH; i++)    // killough 2/8/98
         negonearray[i] = -1;
-    R_InitSpriteDefs(namelist);
+
+    if (lastspritelump < firstspritelump || !*namelist)
+        return;
+
+    // count the number of sprite names
+    for (i = 0; namelist[i]; i++)
+        ;
+
+    numsprites = i;
+
+    sprites = Z_Malloc(numsprites * sizeof(*sprites), PU_STATIC, NULL);
+    memset(sprites, 0, numsprites * sizeof(*sprites));
+    spritenames = namelist;
+    spritestage = (malloc)(numsprites * MAX_SPRITE_FRAMES * sizeof(spriteframe_t));
+    if (!spritestage)
+        I_Error("R_InitSprites: out of memory");
+
+    spritetask = I_StartTask(R_InitSpriteDefs, NULL);
 }
 
 //
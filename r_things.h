@@ -50,6 +50,7 @@ void R_AddSprites(sector_t *sec); // killough 9/18/98
 void R_AddPSprites(void);
 void R_DrawSprites(void);
 void R_InitSprites(char **namelist);
+void R_FinishSprites(void);
 void R_ClearSprites(void);
 void R_DrawMasked(void);
 
@@ -36,6 +36,7 @@
 #include "r_main.h"
 #include "m_random.h"
 #include "w_wad.h"
+#include "p_tick.h"
 
 // when to clip out sounds
 // Does not fit the large outdoor areas.
@@ -658,6 +659,73 @@ void S_Start(void)
    S_ChangeMusic(mnum, true);
 }
 
+//
+// S_PrecacheLevelSounds
+//
+// Called once a level is set up. Marks the sounds of the thing types it
+// holds, of every missile, and every sound no thing type refers to (the
+// weapons, doors and pickups), and has them converted ahead of use.
+//
+void S_PrecacheLevelSounds(void)
+{
+   static boolean needed[NUMSFX], referenced[NUMSFX];
+   boolean present[NUMMOBJTYPES];
+   thinker_t *th;
+   int i, j;
+
+   if(!snd_card || nosfxparm)
+      return;
+
+   memset(present, 0, sizeof present);
+   present[MT_PLAYER] = true;
+   for(th = thinkercap.next; th != &thinkercap; th = th->next)
+      if(th->function == P_MobjThinker)
+         present[((mobj_t *) th)->type] = true;
+
+   // things spawned later by the code, not the map
+   if(present[MT_PAIN])
+      present[MT_SKULL] = true;
+   if(present[MT_BOSSBRAIN] || present[MT_BOSSSPIT])
+      for(i = 0; i < NUMMOBJTYPES; i++)
+         if(mobjinfo[i].flags & MF_COUNTKILL)
+            present[i] = true;
+
+   memset(needed, 0, sizeof needed);
+   memset(referenced, 0, sizeof referenced);
+
+   for(i = 0; i < NUMMOBJTYPES; i++)
+   {
+      const mobjinfo_t *info = &mobjinfo[i];
+      const int sounds[] = { info->seesound, info->attacksound,
+                             info->painsound, info->deathsound,
+                             info->activesound };
+      boolean want = present[i] || info->flags & MF_MISSILE;
+
+      for(j = 0; j < (int)(sizeof sounds / sizeof *sounds); j++)
+         if(sounds[j] > 0 && sounds[j] < NUMSFX)
+         {
+            referenced[sounds[j]] = true;
+            needed[sounds[j]] |= want;
+         }
+   }
+
+   for(i = 1; i < NUMSFX; i++)
+   {
+      sfxinfo_t *sfx = &S_sfx[i];
+
+      if(!referenced[i])
+         needed[i] = true;
+      if(needed[i])
+      {
+         while(sfx->link)
+            sfx = sfx->link;
+         needed[sfx - S_sfx] = true;
+      }
+   }
+
+   I_PrecacheSounds(needed);
+}
+
 //
 // Initializes sound stuff, including volume
 // Sets channels, SFX and music volume,
@@ -44,6 +44,9 @@ void S_Init(int sfxVolume, int musicVolume);
 //
 void S_Start(void);
 
+// Converts the sounds the level can make in the background.
+void S_PrecacheLevelSounds(void);
+
 //
 // Start sound for thing at <origin>
 //  using <sound_id> from sounds.h
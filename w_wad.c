@@ -27,18 +27,38 @@
 //
 //-----------------------------------------------------------------------------
 
+#ifndef WINDOWS
+#define _XOPEN_SOURCE 600   // pread, posix_madvise
+#endif
+
 #ifdef WINDOWS
 #include <string.h>
+#include "win_fopen.h"
 #else
 #include <unistd.h>
 #include <string.h>
+#include <sys/mman.h>
 #endif
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h> 
+#include <stdint.h>
 #include "doomstat.h"
+#include "m_argv.h"
 #include "w_wad.h"
+#include "i_system.h"
 #include "i_video.h"
+#include "m_misc.h"
+#include "m_inflate.h"
+
+// Lumps in a mapped file are only handed out in place where the CPU
+// does not mind their being misaligned; elsewhere only aligned ones.
+#if defined(__i386__) || defined(__x86_64__) || defined(_M_IX86) || \
+    defined(_M_X64) || defined(__aarch64__) || defined(_M_ARM64)
+#define W_MAPALIGN 1
+#else
+#define W_MAPALIGN 4
+#endif
 
 //
 // GLOBALS
@@ -48,6 +68,8 @@
 lumpinfo_t *lumpinfo;
 int        numlumps;         // killough
 void       **lumpcache;      // killough
+static short *prefetchslot;  // per lump: prefetch slot + 1, or 0
+uint64_t   wadsignature;     // identifies the files loaded, for caches
 
 // proff 07/04/98: Changed from _WIN32 to _MSC_VER for CYGWIN32 compatibility
 // proff: This is defined in <io.h>
@@ -124,33 +146,414 @@ char *AddDefaultExtension(char *path, const char *ext)
   return strcat(path,ext);
 }
 
+static void W_UnmapFile(const byte *p, size_t length)
+{
+  Z_RemoveMapped(p);
+#ifdef WINDOWS
+  D_munmap((void *) p);
+#else
+  munmap((void *) p, length);
+#endif
+}
+
+//
+// W_MapFile
+//
+// Maps a whole file read-only, so that W_CacheLumpNum can return its
+// lumps in place: no read, no copy and no zone block, and processes
+// with the same WADs share the pages. Returns NULL if the file cannot
+// be mapped, or the zone has no room to note another mapping, or with
+// -nommap; its lumps are then read as before.
+//
+
+static const byte *W_MapFile(int handle, size_t length)
+{
+  void *p;
+
+  if (!length || M_CheckParm("-nommap"))
+    return NULL;
+
+#ifdef WINDOWS
+  p = D_mmap(handle, length);
+#else
+  if ((p = mmap(NULL, length, PROT_READ, MAP_SHARED, handle, 0)) == MAP_FAILED)
+    p = NULL;
+#endif
+
+  // so Z_Free and Z_ChangeTag pass them by
+  if (p && !Z_AddMapped(p, length))
+    {
+      W_UnmapFile(p, length);
+      p = NULL;
+    }
+  return p;
+}
+
+//
+// W_MappedData
+// Where a lump may be used in place in its file's mapping, or NULL.
+//
+
+static const void *W_MappedData(const byte *map, size_t filesize,
+                                const lumpinfo_t *l)
+{
+  if (!map || l->zsize || l->size <= 0 || l->position < 0 ||
+      l->position % W_MAPALIGN ||
+      (size_t) l->position + l->size > filesize)
+    return NULL;
+  return map + l->position;
+}
+
+// Files being loaded, in order
+
+typedef struct {
+  const char *name;
+  int handle, source;
+  size_t size;
+  long long mtime;
+  const byte *map;
+} wadfile_t;
+
+static wadfile_t *openfiles;
+static int numopenfiles;
+
+//
+// W_Pread
+// Reads from a given offset without moving the file pointer, so that
+// several threads may read the same file at once.
+//
+
+static int W_Pread(int handle, void *dest, int count, long long offset)
+{
+#ifdef WINDOWS
+  return D_pread(handle, dest, count, offset);
+#else
+  return pread(handle, dest, count, offset);
+#endif
+}
+
+//
+// Zip (pk3) files
+//
+// Each entry in a known directory becomes a lump named after the file,
+// without its extension. Entries under sprites/, flats/ and colormaps/
+// are bracketed with the usual markers, so W_CoalesceMarkedResource
+// gives them their namespaces as if they came from a wad. Stored
+// entries are read (or mapped) like wad lumps; deflated ones are only
+// decompressed once something asks for them.
+//
+
+#define ZIP_EOCD_SIZE    22
+#define ZIP_CDIR_SIZE    46
+#define ZIP_LOCAL_SIZE   30
+#define ZIP_MAXCOMMENT   65535
+
+static const struct {
+  const char *dir;
+  const char *start, *end;      // markers, if the directory has any
+} zipdirs[] = {
+  { "",          NULL,      NULL      },  // the root
+  { "sprites",   "S_START", "S_END"   },
+  { "flats",     "F_START", "F_END"   },
+  { "colormaps", "C_START", "C_END"   },
+  { "graphics",  NULL,      NULL      },
+  { "patches",   NULL,      NULL      },
+  { "sounds",    NULL,      NULL      },
+  { "music",     NULL,      NULL      },
+};
+
+#define NUMZIPDIRS (sizeof zipdirs / sizeof *zipdirs)
+
+#define ZIP_U16(p) ((p)[0] | (p)[1] << 8)
+#define ZIP_U32(p) ((unsigned)ZIP_U16(p) | (unsigned)ZIP_U16((p) + 2) << 16)
+
+typedef struct {
+  char name[8];
+  int dir;
+  int position, size, zsize;
+} zipentry_t;
+
+//
+// W_ZipEntry
+// Fills in the lump for a central directory entry. Returns false for
+// entries which are not lumps: directories, files in other directories,
+// names too long, and compression methods other than deflate.
+//
+
+static boolean W_ZipEntry(const byte *cd, zipentry_t *e, int handle,
+                          size_t filesize, const byte *map)
+{
+  int method = ZIP_U16(cd + 10), flags = ZIP_U16(cd + 8);
+  unsigned csize = ZIP_U32(cd + 20), usize = ZIP_U32(cd + 24);
+  unsigned local = ZIP_U32(cd + 42);
+  const char *path = (const char *) cd + ZIP_CDIR_SIZE, *base, *p;
+  int pathlen = ZIP_U16(cd + 28), len;
+  byte header[ZIP_LOCAL_SIZE];
+  size_t pos;
+
+  if ((method != 0 && method != 8) || flags & 1 ||   // unknown or encrypted
+      !pathlen || path[pathlen - 1] == '/' || (int) usize < 0)
+    return false;
+
+  // the top directory picks the namespace; the file name, the lump name
+
+  for (base = p = path; p < path + pathlen; p++)
+    if (*p == '/')
+      base = p + 1;
+  for (e->dir = 0; e->dir < NUMZIPDIRS; e->dir++)
+    {
+      len = strlen(zipdirs[e->dir].dir);
+      if (base == path ? !len : len && pathlen > len && path[len] == '/' &&
+#ifdef WINDOWS
+          !_strnicmp(path, zipdirs[e->dir].dir, len))
+#else
+          !strncasecmp(path, zipdirs[e->dir].dir, len))
+#endif
+        break;
+    }
+  if (e->dir == NUMZIPDIRS)
+    return false;
+
+  for (len = 0; base + len < path + pathlen && base[len] != '.'; len++)
+    if (len == 8)
+      return false;
+  if (!len)
+    return false;
+  memset(e->name, 0, 8);
+  for (p = base; p < base + len; p++)
+    e->name[p - base] = toupper(*p);
+
+  // the data follows the local header, whose extra field may differ
+  // from the central directory's
+
+  if (filesize < ZIP_LOCAL_SIZE || local > filesize - ZIP_LOCAL_SIZE)
+    return false;
+  if (map)
+    memcpy(header, map + local, ZIP_LOCAL_SIZE);
+  else
+    if (W_Pread(handle, header, ZIP_LOCAL_SIZE, local) != ZIP_LOCAL_SIZE)
+      return false;
+  if (ZIP_U32(header) != 0x04034b50)
+    return false;
+
+  pos = (size_t) local + ZIP_LOCAL_SIZE + ZIP_U16(header + 26) +
+    ZIP_U16(header + 28);
+  if (pos > INT_MAX || csize > filesize || pos > filesize - csize ||
+      (!method && csize != usize))
+    return false;
+
+  e->position = pos;
+  e->size = usize;
+  e->zsize = method ? csize : 0;
+  return true;
+}
+
+//
+// W_AddZip
+// Adds the lumps of a zip file.
+//
+
+static void W_AddZip(const char *filename, int handle, size_t filesize,
+                    const byte *map, int source)
+{
+  byte *tail, *cdir, *eocd = NULL, *p;
+  zipentry_t *entries;
+  size_t tailsize = filesize < ZIP_EOCD_SIZE + ZIP_MAXCOMMENT ?
+    filesize : ZIP_EOCD_SIZE + ZIP_MAXCOMMENT;
+  unsigned numentries, cdsize, cdofs, i, count = 0;
+  int dir;
+
+  // the end of central directory record is at most a comment away
+  // from the end of the file
+
+  if (tailsize < ZIP_EOCD_SIZE)
+    I_Error("W_AddZip: %s is not a zip file", filename);
+  tail = malloc(tailsize);
+  if (W_Pread(handle, tail, tailsize, filesize - tailsize) != tailsize)
+    I_Error("W_AddZip: error reading %s", filename);
+  for (i = tailsize - ZIP_EOCD_SIZE + 1; i-- > 0; )
+    if (ZIP_U32(tail + i) == 0x06054b50)
+      {
+        eocd = tail + i;
+        break;
+      }
+  if (!eocd)
+    I_Error("W_AddZip: %s is not a zip file", filename);
+
+  numentries = ZIP_U16(eocd + 10);
+  cdsize = ZIP_U32(eocd + 12);
+  cdofs = ZIP_U32(eocd + 16);
+  free(tail);
+
+  if (numentries == 0xffff || cdofs == 0xffffffff)
+    I_Error("W_AddZip: %s is a zip64 file, which is not supported",
+            filename);
+  if (cdofs > filesize || cdsize > filesize - cdofs)
+    I_Error("W_AddZip: %s is corrupt", filename);
+
+  cdir = malloc(cdsize + 1);
+  if (W_Pread(handle, cdir, cdsize, cdofs) != cdsize)
+    I_Error("W_AddZip: error reading %s", filename);
+  entries = malloc((numentries + 1) * sizeof *entries);
+
+  for (i = 0, p = cdir; i < numentries; i++)
+    {
+      if (cdir + cdsize - p < ZIP_CDIR_SIZE || ZIP_U32(p) != 0x02014b50 ||
+          cdir + cdsize - p < ZIP_CDIR_SIZE + ZIP_U16(p + 28))
+        I_Error("W_AddZip: %s has a corrupt directory", filename);
+      if (W_ZipEntry(p, &entries[count], handle, filesize, map))
+        count++;
+      p += ZIP_CDIR_SIZE + ZIP_U16(p + 28) + ZIP_U16(p + 30) +
+        ZIP_U16(p + 32);
+    }
+  free(cdir);
+
+  // add the lumps directory by directory, with markers around those
+  // which have a namespace
+
+  lumpinfo = realloc(lumpinfo, (numlumps + count + NUMZIPDIRS*2) *
+                     sizeof *lumpinfo);
+
+  for (dir = 0; dir < NUMZIPDIRS; dir++)
+    {
+      lumpinfo_t *lump_p;
+      int first = numlumps;
+
+      if (zipdirs[dir].start)
+        numlumps++;
+
+      for (i = 0; i < count; i++)
+        if (entries[i].dir == dir)
+          {
+            const zipentry_t *e = &entries[i];
+
+            lump_p = lumpinfo + numlumps++;
+            memcpy(lump_p->name, e->name, 8);
+            lump_p->handle = handle;
+            lump_p->position = e->position;
+            lump_p->size = e->size;
+            lump_p->zsize = e->zsize;
+            lump_p->data = W_MappedData(map, filesize, lump_p);
+            lump_p->namespace = ns_global;
+            lump_p->source = source;
+          }
+
+      if (!zipdirs[dir].start)
+        continue;
+      if (numlumps == first + 1)    // nothing in there
+        {
+          numlumps = first;
+          continue;
+        }
+
+      // the markers themselves, as W_CoalesceMarkedResource expects them
+      lump_p = lumpinfo + first;
+      memset(lump_p, 0, sizeof *lump_p);
+      strncpy(lump_p->name, zipdirs[dir].start, 8);
+      lump_p->handle = handle;
+      lump_p->source = source;
+
+      lump_p = lumpinfo + numlumps++;
+      *lump_p = lumpinfo[first];
+      strncpy(lump_p->name, zipdirs[dir].end, 8);
+    }
+
+  free(entries);
+}
+
+//
+// Decompressed zip lumps
+//
+// These join the lump cache like anything read from a wad, and so may
+// be purged whenever the zone runs short. Since rereading one means
+// inflating it again, the bytes they hold are also bounded by
+// zip_cache_size: beyond that, the least recently used lumps nobody
+// holds on to any more (tagged PU_CACHE) are freed first.
+//
+
+int zip_cache_size;                 // KB, set from the config
+
+static struct { int prev, next; } *ziplru;    // lump numbers, -1 ends
+static int ziphead = -1, ziptail = -1;
+static size_t zipbytes;             // overestimate: includes purged ones
+
+static void W_ZipUnlink(int lump)
+{
+  if (ziplru[lump].prev >= 0)
+    ziplru[ziplru[lump].prev].next = ziplru[lump].next;
+  else
+    ziphead = ziplru[lump].next;
+  if (ziplru[lump].next >= 0)
+    ziplru[ziplru[lump].next].prev = ziplru[lump].prev;
+  else
+    ziptail = ziplru[lump].prev;
+  ziplru[lump].prev = ziplru[lump].next = -2;   // not in the list
+}
+
+//
+// W_TouchZipLump
+// Moves a decompressed lump to the front of the list, then frees lumps
+// from the back until the cache is back within bounds.
+//
+
+static void W_TouchZipLump(int lump)
+{
+  size_t budget = (size_t) zip_cache_size * 1024;
+  int i;
+
+  if (!ziplru)
+    {
+      ziplru = malloc(numlumps * sizeof *ziplru);
+      for (i = 0; i < numlumps; i++)
+        ziplru[i].prev = ziplru[i].next = -2;
+    }
+
+  if (ziplru[lump].prev != -2)
+    W_ZipUnlink(lump);
+  else
+    zipbytes += lumpinfo[lump].size;
+
+  ziplru[lump].prev = -1;
+  ziplru[lump].next = ziphead;
+  if (ziphead >= 0)
+    ziplru[ziphead].prev = lump;
+  else
+    ziptail = lump;
+  ziphead = lump;
+
+  for (i = ziptail; zipbytes > budget && i >= 0 && i != lump; )
+    {
+      int prev = ziplru[i].prev;
+
+      if (!lumpcache[i] || Z_GetTag(lumpcache[i]) >= PU_PURGELEVEL)
+        {
+          if (lumpcache[i])
+            Z_Free(lumpcache[i]);     // clears lumpcache[i]
+          W_ZipUnlink(i);
+          zipbytes -= lumpinfo[i].size;
+        }
+      i = prev;
+    }
+}
+
 //
 // LUMP BASED ROUTINES.
 //
 
 //
-// W_AddFile
+// W_OpenFile
 // All files are optional, but at least one file must be
 //  found (PWAD, if all required lumps are present).
-// Files with a .wad extension are wadlink files
-//  with multiple lumps.
-// Other files are single lumps with the base filename
-//  for the lump name.
 //
 // Reload hack removed by Lee Killough
 //
 // Ty 08/29/98 - added source parm to indicate iwad, pwad or lmp loaded file
 
-static void W_AddFile(const char *filename,int source) // killough 1/31/98: static, const
+static void W_OpenFile(const char *filename, int source)
 {
-  wadinfo_t   header;
-  lumpinfo_t* lump_p;
-  unsigned    i;
+  struct stat st;
+  wadfile_t   *wf;
   int         handle;
-  int         length;
-  int         startlump;
-  filelump_t  *fileinfo, *fileinfo2free=NULL; //killough
-  filelump_t  singleinfo;
 
   // open the file and add to directory
 #ifdef WINDOWS
@@ -171,7 +574,51 @@ static void W_AddFile(const char *filename,int source) // killough 1/31/98: stat
 
   //jff 8/3/98 use logical output routine
   printf(" adding %s\n",filename);
-  startlump = numlumps;
+
+  openfiles = realloc(openfiles, (numopenfiles + 1) * sizeof *openfiles);
+  wf = &openfiles[numopenfiles++];
+  wf->name = filename;
+  wf->handle = handle;
+  wf->source = source;
+  wf->size = filelength(handle);
+  wf->mtime = fstat(handle, &st) ? 0 : st.st_mtime;
+  wf->map = W_MapFile(handle, wf->size);
+}
+
+//
+// W_AddFile
+// Files with a .wad extension are wadlink files
+//  with multiple lumps.
+// Other files are single lumps with the base filename
+//  for the lump name.
+//
+
+static void W_AddFile(const wadfile_t *wf) // killough 1/31/98: static, const
+{
+  const char  *filename = wf->name;
+  int         handle = wf->handle, source = wf->source;
+  size_t      filesize = wf->size;
+  const byte  *map = wf->map;
+  wadinfo_t   header;
+  lumpinfo_t* lump_p;
+  unsigned    i;
+  int         length;
+  int         startlump = numlumps;
+  filelump_t  *fileinfo, *fileinfo2free=NULL; //killough
+  filelump_t  singleinfo;
+
+  if (strlen(filename) > 4 &&
+#ifdef WINDOWS
+      (!_stricmp(filename+strlen(filename)-4, ".zip") ||
+       !_stricmp(filename+strlen(filename)-4, ".pk3")))
+#else
+      (!strcasecmp(filename + strlen(filename) - 4, ".zip") ||
+       !strcasecmp(filename + strlen(filename) - 4, ".pk3")))
+#endif
+    {
+      W_AddZip(filename, handle, filesize, map, source);
+      return;
+    }
 
   // killough:
 #ifdef WINDOWS
@@ -213,7 +660,8 @@ static void W_AddFile(const char *filename,int source) // killough 1/31/98: stat
         lump_p->handle = handle;                    //  killough 4/25/98
         lump_p->position = LONG(fileinfo->filepos);
         lump_p->size = LONG(fileinfo->size);
-        lump_p->data = NULL;                        // killough 1/31/98
+        lump_p->zsize = 0;
+        lump_p->data = W_MappedData(map, filesize, lump_p); // killough 1/31/98
         lump_p->namespace = ns_global;              // killough 4/17/98
         lump_p->source = source;                    // Ty 08/29/98
         strncpy (lump_p->name, fileinfo->name, 8);
@@ -253,6 +701,7 @@ static void W_CoalesceMarkedResource(const char *start_marker,
       { // If this is the first start marker, add start marker to marked lumps
         if (!num_marked)
           {
+            memset(marked, 0, sizeof *marked);    // no data, no file
             strncpy(marked->name, start_marker, 8);
             marked->size = 0;  // killough 3/20/98: force size to be 0
             marked->namespace = ns_global;        // killough 4/17/98
@@ -284,6 +733,7 @@ static void W_CoalesceMarkedResource(const char *start_marker,
 
   if (mark_end)                                   // add end marker
     {
+      memset(&lumpinfo[numlumps], 0, sizeof *lumpinfo);
       lumpinfo[numlumps].size = 0;  // killough 3/20/98: force size to be 0
       lumpinfo[numlumps].namespace = ns_global;   // killough 4/17/98
       strncpy(lumpinfo[numlumps++].name, end_marker, 8);
@@ -310,6 +760,24 @@ unsigned W_LumpNameHash(const char *s)
   return hash;
 }
 
+//
+// W_LumpNameId
+// Packs up to 8 characters of a lump name into an integer, uppercased and
+// padded with zeros, so names compare equal regardless of case or of
+// garbage after the terminator.
+//
+
+uint64_t W_LumpNameId(const char *s)
+{
+  uint64_t id = 0;
+  int i;
+
+  for (i = 0; i < 8 && s[i]; i++)
+    id |= (uint64_t) toupper((unsigned char) s[i]) << (i * 8);
+
+  return id;
+}
+
 //
 // W_CheckNumForName
 // Returns -1 if name not found.
@@ -318,38 +786,34 @@ unsigned W_LumpNameHash(const char *s)
 // cuts down on time -- increases Doom performance over 300%. This is the
 // single most important optimization of the original Doom sources, because
 // lump name lookup is used so often, and the original Doom used a sequential
-// search. For large wads with > 1000 lumps this meant an average of over
-// 500 were probed during every search. Now the average is under 2 probes per
-// search. There is no significant benefit to packing the names into longwords
-// with this new hashing algorithm, because the work to do the packing is
-// just as much work as simply doing the string comparisons with the new
-// algorithm, which minimizes the expected number of comparisons to under 2.
+// search.
+//
+// The chained table has since been replaced by open addressing over names
+// packed into 64-bit integers. Wad stacks with tens of thousands of lumps
+// made the chains and case-insensitive string compares show up at startup;
+// now a probe is one multiply, and each comparison a single integer test.
 //
 // killough 4/17/98: add namespace parameter to prevent collisions
 // between different resources such as flats, sprites, colormaps
 //
 
-int (W_CheckNumForName)(const char *name, int namespace)
-{
-  // Hash function maps the name to one of possibly numlump chains.
-  // It has been tuned so that the average chain length never exceeds 2.
+static const int *lumphash;     // lump numbers, -1 for empty slots
+static unsigned lumphashmask;
 
-  int i = lumpinfo[W_LumpNameHash(name) % (unsigned) numlumps].index;
+#define W_HashId(id) ((unsigned)(((id) * 0x9E3779B97F4A7C15ull) >> 32))
 
-  // We search along the chain until end, looking for case-insensitive
-  // matches which also match a namespace tag. Separate hash tables are
-  // not used for each namespace, because the performance benefit is not
-  // worth the overhead, considering namespace collisions are rare in
-  // Doom wads.
+int (W_CheckNumForName)(const char *name, int namespace)
+{
+  uint64_t id = W_LumpNameId(name);
+  unsigned j = W_HashId(id);
+  int i;
 
-#ifdef WINDOWS
-  while (i >= 0 && (_strnicmp(lumpinfo[i].name, name, 8) || lumpinfo[i].namespace != namespace))
-#else
-  while (i >= 0 && (strncasecmp(lumpinfo[i].name, name, 8) || lumpinfo[i].namespace != namespace))
-#endif
-    i = lumpinfo[i].next;
+  // Only the last lump of each name and namespace is entered in the
+  // table, so the first match found is the one to return.
 
-  // Return the matching lump, or -1 if none found.
+  while ((i = lumphash[j &= lumphashmask]) >= 0 &&
+         (lumpinfo[i].id != id || lumpinfo[i].namespace != namespace))
+    j++;
 
   return i;
 }
@@ -360,20 +824,36 @@ int (W_CheckNumForName)(const char *name, int namespace)
 
 static void W_InitLumpHash(void)
 {
-  int i;
+  unsigned size = 1;
+  int *table, i;
 
-  for (i=0; i<numlumps; i++)
-    lumpinfo[i].index = -1;                     // mark slots empty
+  // keep the table at most half full, so probe sequences stay short
+
+  while (size < (unsigned) numlumps * 2)
+    size <<= 1;
+
+  lumphash = table = malloc(size * sizeof *table);
+  lumphashmask = size - 1;
 
-  // Insert nodes to the beginning of each chain, in first-to-last
-  // lump order, so that the last lump of a given name appears first
-  // in any chain, observing pwad ordering rules. killough
+  for (i=0; i<(int) size; i++)
+    table[i] = -1;                              // mark slots empty
+
+  // Insert in first-to-last lump order, replacing any earlier lump of
+  // the same name and namespace, so that the last one wins, observing
+  // pwad ordering rules. killough
 
   for (i=0; i<numlumps; i++)
-    {                                           // hash function:
-      int j = W_LumpNameHash(lumpinfo[i].name) % (unsigned) numlumps;
-      lumpinfo[i].next = lumpinfo[j].index;     // Prepend to list
-      lumpinfo[j].index = i;
+    {
+      uint64_t id = lumpinfo[i].id = W_LumpNameId(lumpinfo[i].name);
+      unsigned j = W_HashId(id);
+      int k;
+
+      while ((k = table[j &= lumphashmask]) >= 0 &&
+             (lumpinfo[k].id != id ||
+              lumpinfo[k].namespace != lumpinfo[i].namespace))
+        j++;
+
+      table[j] = i;
     }
 }
 
@@ -392,6 +872,277 @@ int W_GetNumForName (const char* name)     // killough -- const added
   return i;
 }
 
+//
+// Directory cache
+//
+// Putting the directory together -- reading each file's, coalescing the
+// marked resources and hashing the names -- gives the same result each
+// time for the same files, and takes a while with large wad stacks. So
+// the result is saved in dircache/ under the executable's directory,
+// keyed by the names, sizes and modification times of the files, and
+// read back by later runs with the same files. The hash table is used
+// straight from the mapped file; lumpinfo holds handles and pointers,
+// so it is filled in from the records in one pass. -nodircache turns
+// this off.
+//
+
+#define DIRCACHE_MAGIC  "RBDIRC1"
+
+typedef struct {
+  char magic[8];
+  int recordsize;       // sizeof(dirrecord_t), so other builds miss
+  int keylen;
+  int numlumps;
+  int hashsize;
+} dircache_t;
+
+typedef struct {
+  uint64_t id;
+  char name[8];
+  int size, zsize, position;
+  short file;           // index in openfiles, or one of these:
+  byte namespace, source;
+} dirrecord_t;
+
+#define DIR_PREDEFINED  -1      // position is the predefined_lumps index
+#define DIR_NOFILE      -2      // markers
+
+#define DIR_ALIGN(n)    (((n) + 7) & ~7)
+
+//
+// W_DirCacheKey
+// The number of predefined lumps, then each file's name, source, size
+// and modification time. Returns the key and its length.
+//
+
+static byte *W_DirCacheKey(int *keylen)
+{
+  size_t len = sizeof(int);
+  byte *key, *p;
+  int i;
+
+  for (i = 0; i < numopenfiles; i++)
+    len += strlen(openfiles[i].name) + 1 + sizeof(int) + 2*sizeof(long long);
+
+  key = p = malloc(len);
+
+  i = num_predefined_lumps;
+  memcpy(p, &i, sizeof i);
+  p += sizeof i;
+
+  for (i = 0; i < numopenfiles; i++)
+    {
+      const wadfile_t *wf = &openfiles[i];
+      long long size = wf->size;
+
+      strcpy((char *) p, wf->name);
+      p += strlen(wf->name) + 1;
+      memcpy(p, &wf->source, sizeof wf->source);
+      p += sizeof wf->source;
+      memcpy(p, &size, sizeof size);
+      p += sizeof size;
+      memcpy(p, &wf->mtime, sizeof wf->mtime);
+      p += sizeof wf->mtime;
+    }
+
+  *keylen = len;
+  return key;
+}
+
+//
+// W_DirCacheName
+// Names the cache file after wadsignature, the hash of the key.
+//
+
+static void W_DirCacheName(char *name)
+{
+  M_CacheDir(name, "dircache");
+  sprintf(name + strlen(name), "/%016llx.dir",
+          (unsigned long long) wadsignature);
+}
+
+// Gives back the image of a cache which turned out to be unusable.
+
+static boolean W_DropDirCache(const byte *base, size_t size, boolean mapped)
+{
+  if (mapped)
+    W_UnmapFile(base, size);
+  else
+    free((void *) base);
+  return false;
+}
+
+//
+// W_LoadDirCache
+// Returns false if there is no usable cache, leaving lumpinfo alone.
+//
+
+static boolean W_LoadDirCache(const char *name, const byte *key, int keylen)
+{
+  const dircache_t *header;
+  const dirrecord_t *rec;
+  const int *hash;
+  const byte *base;
+  lumpinfo_t *info;
+  size_t size;
+  int handle, i, used;
+  boolean mapped;
+
+#ifdef WINDOWS
+  if ((handle = open(name, O_RDONLY | O_BINARY)) == -1)
+#else
+  if ((handle = open(name, O_RDONLY)) == -1)
+#endif
+    return false;
+
+  size = filelength(handle);
+  if (!(mapped = (base = W_MapFile(handle, size)) != NULL))
+    {
+      byte *buf = malloc(size + 1);         // -nommap: read it all in
+
+      if (W_Pread(handle, buf, size, 0) != size)
+        {
+          free(buf);
+          close(handle);
+          return false;
+        }
+      base = buf;
+    }
+  close(handle);   // a mapping outlives its descriptor
+
+  header = (const dircache_t *) base;
+  if (size < sizeof *header || memcmp(header->magic, DIRCACHE_MAGIC, 8) ||
+      header->recordsize != sizeof *rec || header->keylen != keylen ||
+      header->numlumps <= 0 || header->numlumps > INT_MAX/64 ||
+      header->hashsize < header->numlumps * 2 ||
+      header->hashsize > header->numlumps * 4 ||
+      header->hashsize & (header->hashsize - 1) ||
+      size != sizeof *header + DIR_ALIGN(keylen) +
+      header->numlumps * sizeof *rec + header->hashsize * sizeof *hash ||
+      memcmp(base + sizeof *header, key, keylen))
+    return W_DropDirCache(base, size, mapped);
+
+  rec = (const dirrecord_t *)(base + sizeof *header + DIR_ALIGN(keylen));
+  hash = (const int *)(rec + header->numlumps);
+
+  // no more entries than lumps, so that, with hashsize at least twice
+  // numlumps, every probe sequence reaches an empty slot
+  for (i = used = 0; i < header->hashsize; i++)
+    if (hash[i] < -1 || hash[i] >= header->numlumps ||
+        (hash[i] >= 0 && ++used > header->numlumps))
+      return W_DropDirCache(base, size, mapped);
+
+  info = malloc(header->numlumps * sizeof *info);
+
+  for (i = 0; i < header->numlumps; i++, rec++)
+    {
+      lumpinfo_t *l = &info[i];
+
+      if (rec->file == DIR_PREDEFINED)
+        {
+          if (rec->position < 0 || rec->position >= num_predefined_lumps)
+            break;
+          *l = predefined_lumps[rec->position];
+        }
+      else
+        {
+          const wadfile_t *wf = NULL;
+
+          if (rec->file >= 0 && rec->file < numopenfiles)
+            wf = &openfiles[rec->file];
+          else
+            if (rec->file != DIR_NOFILE)
+              break;
+
+          memset(l, 0, sizeof *l);
+          l->handle = wf ? wf->handle : 0;
+          l->size = rec->size;
+          l->zsize = rec->zsize;
+          l->position = rec->position;
+          l->data = wf ? W_MappedData(wf->map, wf->size, l) : NULL;
+        }
+
+      memcpy(l->name, rec->name, 8);
+      l->id = rec->id;
+      l->position = rec->position;
+      l->namespace = rec->namespace;
+      l->source = rec->source;
+    }
+
+  if (i < header->numlumps)
+    {
+      free(info);
+      return W_DropDirCache(base, size, mapped);
+    }
+
+  free(lumpinfo);
+  lumpinfo = info;
+  numlumps = header->numlumps;
+  lumphash = hash;
+  lumphashmask = header->hashsize - 1;
+  return true;
+}
+
+//
+// W_WriteDirCache
+// Writes the cache for the key in data, a dirkey_t.
+//
+
+typedef struct {
+  const byte *key;
+  int keylen;
+} dirkey_t;
+
+static boolean W_WriteDirCache(FILE *fp, void *data)
+{
+  static const byte pad[8];
+  const byte *key = ((dirkey_t *) data)->key;
+  int keylen = ((dirkey_t *) data)->keylen;
+  dircache_t header = {DIRCACHE_MAGIC};
+  size_t padlen = DIR_ALIGN(keylen) - keylen;
+  boolean ok;
+  int i;
+
+  header.recordsize = sizeof(dirrecord_t);
+  header.keylen = keylen;
+  header.numlumps = numlumps;
+  header.hashsize = lumphashmask + 1;
+
+  ok = fwrite(&header, sizeof header, 1, fp) == 1 &&
+    fwrite(key, 1, keylen, fp) == keylen &&
+    fwrite(pad, 1, padlen, fp) == padlen;
+
+  for (i = 0; ok && i < numlumps; i++)
+    {
+      const lumpinfo_t *l = &lumpinfo[i];
+      dirrecord_t rec;
+      int f;
+
+      memset(&rec, 0, sizeof rec);      // no stray bytes in the padding
+      rec.id = l->id;
+      memcpy(rec.name, l->name, 8);
+      rec.size = l->size;
+      rec.zsize = l->zsize;
+      rec.position = l->position;
+      rec.namespace = l->namespace;
+      rec.source = l->source;
+
+      if (l->source == source_pre)
+        rec.file = DIR_PREDEFINED;
+      else
+        {
+          for (f = 0; f < numopenfiles && openfiles[f].handle != l->handle; f++)
+            ;
+          rec.file = f < numopenfiles ? f : DIR_NOFILE;
+        }
+
+      ok = fwrite(&rec, sizeof rec, 1, fp) == 1;
+    }
+
+  return ok && fwrite(lumphash, sizeof *lumphash, header.hashsize, fp) ==
+    header.hashsize;
+}
+
 //
 // W_InitMultipleFiles
 // Pass a null terminated list of files to use.
@@ -409,6 +1160,10 @@ int W_GetNumForName (const char* name)     // killough -- const added
 void W_InitMultipleFiles(char *const *filenames, int *const pfilesource)
 {
   int *filesource = pfilesource;  // to iterate with
+  boolean dircache = !M_CheckParm("-nodircache");
+  char cachename[PATH_MAX+32];
+  byte *key;
+  int i, keylen;
 
   // killough 1/31/98: add predefined lumps first
 
@@ -419,38 +1174,59 @@ void W_InitMultipleFiles(char *const *filenames, int *const pfilesource)
 
   memcpy(lumpinfo, predefined_lumps, numlumps*sizeof(*lumpinfo));
   // Ty 08/29/98 - add source flag to the predefined lumps
-  {
-    int i;
-    for (i=0;i<numlumps;i++)
+  for (i=0;i<numlumps;i++)
+    {
       lumpinfo[i].source = source_pre;
-  }
+      lumpinfo[i].position = i;     // for the directory cache
+    }
 
-  // open all the files, load headers, and count lumps
+  // open all the files
   while (*filenames)
-    W_AddFile(*filenames++,*filesource++);
+    W_OpenFile(*filenames++,*filesource++);
+
+  key = W_DirCacheKey(&keylen);
+  wadsignature = M_Hash64(M_HASHINIT, key, keylen);
+  if (dircache)
+    W_DirCacheName(cachename);
+
+  if (!dircache || !W_LoadDirCache(cachename, key, keylen))
+    {
+      // load headers, and count lumps
+      for (i = 0; i < numopenfiles; i++)
+        W_AddFile(&openfiles[i]);
+
+      if (!numlumps)
+        I_Error ("W_InitFiles: no files found");
 
-  if (!numlumps)
-    I_Error ("W_InitFiles: no files found");
+      //jff 1/23/98
+      // get all the sprites and flats into one marked block each
+      // killough 1/24/98: change interface to use M_START/M_END explicitly
+      // killough 4/17/98: Add namespace tags to each entry
 
-  //jff 1/23/98
-  // get all the sprites and flats into one marked block each
-  // killough 1/24/98: change interface to use M_START/M_END explicitly
-  // killough 4/17/98: Add namespace tags to each entry
+      W_CoalesceMarkedResource("S_START", "S_END", ns_sprites);
+      W_CoalesceMarkedResource("F_START", "F_END", ns_flats);
 
-  W_CoalesceMarkedResource("S_START", "S_END", ns_sprites);
-  W_CoalesceMarkedResource("F_START", "F_END", ns_flats);
+      // killough 4/4/98: add colormap markers
+      W_CoalesceMarkedResource("C_START", "C_END", ns_colormaps);
 
-  // killough 4/4/98: add colormap markers
-  W_CoalesceMarkedResource("C_START", "C_END", ns_colormaps);
+      // killough 1/31/98: initialize lump hash table
+      W_InitLumpHash();
+
+      if (dircache)
+        {
+          dirkey_t dk = {key, keylen};
+          M_WriteFileAtomic(cachename, W_WriteDirCache, &dk);
+        }
+    }
+
+  free(key);
 
   // set up caching
   lumpcache = calloc(sizeof *lumpcache, numlumps); // killough
+  prefetchslot = calloc(sizeof *prefetchslot, numlumps);
 
-  if (!lumpcache)
+  if (!lumpcache || !prefetchslot)
     I_Error ("Couldn't allocate lumpcache");
-
-  // killough 1/31/98: initialize lump hash table
-  W_InitLumpHash();
 }
 
 //
@@ -464,6 +1240,35 @@ int W_LumpLength (int lump)
   return lumpinfo[lump].size;
 }
 
+//
+// W_ReadLumpData
+// Reads a lump at its file position without moving the file offset,
+// so several threads may read at once. Returns the bytes read.
+//
+
+static int W_ReadLumpData(const lumpinfo_t *l, void *dest)
+{
+  if (l->data)     // killough 1/31/98: predefined lump data
+    {
+      memcpy(dest, l->data, l->size);
+      return l->size;
+    }
+
+  if (l->zsize)    // deflated in a zip
+    {
+      // not the zone: this may run on a prefetch thread
+      byte *z = (malloc)(l->zsize);
+      int c = 0;
+
+      if (z && W_Pread(l->handle, z, l->zsize, l->position) == l->zsize)
+        c = M_Inflate(z, l->zsize, dest, l->size);
+      (free)(z);
+      return c;
+    }
+
+  return W_Pread(l->handle, dest, l->size, l->position);
+}
+
 //
 // W_ReadLump
 // Loads the lump into the given buffer,
@@ -473,27 +1278,139 @@ int W_LumpLength (int lump)
 void W_ReadLump(int lump, void *dest)
 {
   lumpinfo_t *l = lumpinfo + lump;
+  int c;
 
 #ifdef RANGECHECK
   if (lump >= numlumps)
     I_Error ("W_ReadLump: %i >= numlumps",lump);
 #endif
 
-  if (l->data)     // killough 1/31/98: predefined lump data
-    memcpy(dest, l->data, l->size);
-  else
+  // killough 1/31/98: Reload hack (-wart) removed
+
+  I_BeginRead();
+  c = W_ReadLumpData(l, dest);
+  if (c < l->size)
+    I_Error("W_ReadLump: only read %i of %i on lump %i", c, l->size, lump);
+  I_EndRead();
+}
+
+//
+// Lump prefetching
+//
+// W_PrefetchLump queues a lump to be read on the task pool, so a
+// level's graphics and sounds load while the rest of it is set up,
+// and reads on slow or network file systems overlap. The zone is only
+// touched on the main thread: the buffer is allocated when the lump is
+// queued, and joins the lump cache once W_CacheLumpNum asks for the
+// lump or W_UpdatePrefetch finds it read. A lump asked for before a
+// worker gets to it is read right away, as if it had not been queued.
+//
+
+#define PREFETCH_SLOTS   1024
+
+typedef struct {
+  int lump;
+  void *buffer;         // PU_STATIC, owned by the slot until adopted
+  boolean ok;
+  i_task_t *task;
+} prefetch_t;
+
+static prefetch_t prefetch[PREFETCH_SLOTS];
+static int prefetchout;         // slots in use
+
+// Task body. Must not touch the zone heap or game state.
+
+static void W_PrefetchTask(void *data)
+{
+  prefetch_t *pf = data;
+
+  pf->ok = W_ReadLumpData(lumpinfo + pf->lump, pf->buffer) ==
+    lumpinfo[pf->lump].size;
+}
+
+//
+// W_FinishPrefetch
+// Moves a prefetched lump into the lump cache, reading it here first
+// if no worker has yet, or waiting for the worker reading it.
+//
+
+static void W_FinishPrefetch(int lump)
+{
+  prefetch_t *pf = &prefetch[prefetchslot[lump] - 1];
+
+  I_FinishTask(pf->task);
+
+  if (pf->ok)
     {
-      int c;
+      Z_ChangeUser(pf->buffer, &lumpcache[lump]);
+      Z_ChangeTag(lumpcache[lump], PU_CACHE);
+    }
+  else
+    Z_Free(pf->buffer);     // W_ReadLump will report the error
+  pf->buffer = NULL;
+
+  prefetchslot[lump] = 0;
+  prefetchout--;
+}
+
+//
+// W_UpdatePrefetch
+// Moves lumps the workers have read into the lump cache, where they
+// may be purged again. Called once per frame.
+//
+
+void W_UpdatePrefetch(void)
+{
+  prefetch_t *pf;
+
+  for (pf = prefetch; prefetchout && pf < prefetch + PREFETCH_SLOTS; pf++)
+    if (pf->buffer && I_TaskDone(pf->task))
+      W_FinishPrefetch(pf->lump);
+}
 
-      // killough 1/31/98: Reload hack (-wart) removed
+//
+// W_PrefetchLump
+//
+
+void W_PrefetchLump(int lump)
+{
+  const lumpinfo_t *l = lumpinfo + lump;
+  prefetch_t *pf;
+
+  if ((unsigned) lump >= numlumps || l->size <= 0 ||
+      lumpcache[lump] || prefetchslot[lump] || l->source == source_pre)
+    return;
 
-      I_BeginRead();
-      lseek(l->handle, l->position, SEEK_SET);
-      c = read(l->handle, dest, l->size);
-      if (c < l->size)
-        I_Error("W_ReadLump: only read %i of %i on lump %i", c, l->size, lump);
-      I_EndRead();
+  if (l->data)      // mapped: just have the system page it in
+    {
+#ifndef WINDOWS
+      static size_t pagesize;
+      uintptr_t start = (uintptr_t) l->data;
+
+      if (!pagesize)
+        pagesize = sysconf(_SC_PAGESIZE);
+      posix_madvise((void *)(start - start % pagesize),
+                    start % pagesize + l->size, POSIX_MADV_WILLNEED);
+#endif
+      return;
     }
+
+  // a full queue waits for a slot, which is no worse than reading here
+  while (prefetchout == PREFETCH_SLOTS)
+    {
+      W_UpdatePrefetch();
+      if (prefetchout == PREFETCH_SLOTS)
+        I_Sleep(1);
+    }
+
+  for (pf = prefetch; pf->buffer; pf++)
+    ;
+  pf->lump = lump;
+  Z_Malloc(l->size, PU_STATIC, &pf->buffer);
+  prefetchslot[lump] = pf - prefetch + 1;
+  prefetchout++;
+
+  pf->task = I_StartTask(W_PrefetchTask, pf);
 }
 
 //
@@ -508,10 +1425,28 @@ void *W_CacheLumpNum (int lump, int tag)
     I_Error ("W_CacheLumpNum: %i >= numlumps",lump);
 #endif
 
+  // lumps in a mapped file are used in place
+  if (lumpinfo[lump].data && lumpinfo[lump].source != source_pre)
+    return (void *) lumpinfo[lump].data;
+
+  if (lumpcache[lump])
+    cachestats.hits++;
+  else
+    cachestats.misses++;     // even if prefetched
+
+  if (prefetchslot[lump])    // queued to be read in the background
+    W_FinishPrefetch(lump);
+
   if (!lumpcache[lump])      // read the lump in
     W_ReadLump(lump, Z_Malloc(W_LumpLength(lump), tag, &lumpcache[lump]));
   else
-    Z_ChangeTag(lumpcache[lump],tag);
+    {
+      Z_ChangeTag(lumpcache[lump],tag);
+      Z_Touch(lumpcache[lump]);
+    }
+
+  if (lumpinfo[lump].zsize)
+    W_TouchZipLump(lump);
 
   return lumpcache[lump];
 }
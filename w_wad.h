@@ -30,6 +30,8 @@
 #ifndef __W_WAD__
 #define __W_WAD__
 
+#include "doomtype.h"
+
 //
 // TYPES
 //
@@ -67,10 +69,12 @@ typedef struct
 
   char  name[8];
   int   size;
-  const void *data;     // killough 1/31/98: points to predefined lump data
+  const void *data;     // killough 1/31/98: points to predefined lump data,
+                        // or into a mapped file
 
-  // killough 1/31/98: hash table fields, used for ultra-fast hash table lookup
-  int index, next;
+  // name packed into an integer, uppercased and zero-padded, so lookups
+  // compare names in one go (see W_LumpNameId)
+  uint64_t id;
 
   // killough 4/17/98: namespace tags, to prevent conflicts between resources
   enum {
@@ -82,6 +86,7 @@ typedef struct
 
   int handle;
   int position;
+  int zsize;            // compressed size of a deflated zip entry, else 0
   // Ty 08/29/98 - add source field to identify where this lump came from
   enum {
     source_iwad=0, // iwad file load 
@@ -98,6 +103,9 @@ extern const lumpinfo_t predefined_lumps[];
 extern void       **lumpcache;
 extern lumpinfo_t *lumpinfo;
 extern int        numlumps;
+extern uint64_t   wadsignature;   // hash of the names, sizes and dates
+
+extern int zip_cache_size;  // KB of decompressed zip lumps kept around
 
 void W_InitMultipleFiles(char *const*filenames, int *const filesource);
 
@@ -111,12 +119,17 @@ int     W_LumpLength (int lump);
 void    W_ReadLump (int lump, void *dest);
 void*   W_CacheLumpNum (int lump, int tag);
 
+// Queues a lump to be read in the background, ahead of W_CacheLumpNum
+void    W_PrefetchLump(int lump);
+void    W_UpdatePrefetch(void);
+
 #define W_CacheLumpName(name,tag) W_CacheLumpNum (W_GetNumForName(name),(tag))
 
 void NormalizeSlashes(char *);                    // killough 11/98
 char *AddDefaultExtension(char *, const char *);  // killough 1/18/98
 void ExtractFileBase(const char *, char *);       // killough
 unsigned W_LumpNameHash(const char *s);           // killough 1/31/98
+uint64_t W_LumpNameId(const char *s);
 
 // Function to write all predefined lumps to a PWAD if requested
 extern void WritePredefinedLumpWad(const char *filename); // jff 5/6/98
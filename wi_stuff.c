@@ -1967,6 +1967,84 @@ static void WI_loadData(void)
     }
 }
 
+// ====================================================================
+// WI_Prefetch
+// Purpose: Queue the lumps WI_loadData will need for episode epsd, so
+//          they are read in the background while the level is played
+// Args:    epsd -- episode, as in wbstartstruct_t
+// Returns: void
+//
+static void WI_PrefetchName(const char *name)
+{
+  int lump = W_CheckNumForName(name);
+
+  if (lump != -1)
+    W_PrefetchLump(lump);
+}
+
+void WI_Prefetch(int epsd)
+{
+  static const char *const names[] = {
+    "WIMINUS", "WIPCNT", "WIF", "WIENTER", "WIOSTK", "WIOSTS", "WISCRT2",
+    "WIOSTI", "WIFRGS", "WICOLON", "WITIME", "WISUCKS", "WIPAR", "WIKILRS",
+    "WIVCTMS", "WIMSTT", "STFST01", "STFDEAD0", NULL
+  };
+  const char *const *np;
+  char name[40];
+  int i, j;
+
+  if (gamemode == commercial || (gamemode == retail && epsd == 3))
+    WI_PrefetchName("INTERPIC");
+  else
+    {
+      sprintf(name, "WIMAP%d", epsd);
+      WI_PrefetchName(name);
+    }
+
+  if (gamemode == commercial)
+    for (i=0 ; i<32 ; i++)
+      {
+        sprintf(name, "CWILV%2.2d", i);
+        WI_PrefetchName(name);
+      }
+  else
+    {
+      for (i=0 ; i<NUMMAPS ; i++)
+        {
+          sprintf(name, "WILV%d%d", epsd, i);
+          WI_PrefetchName(name);
+        }
+      WI_PrefetchName("WIURH0");
+      WI_PrefetchName("WIURH1");
+      WI_PrefetchName("WISPLAT");
+
+      if (epsd < 3)
+        for (j=0;j<NUMANIMS[epsd];j++)
+          for (i=0;i<anims[epsd][j].nanims;i++)
+            {
+              sprintf(name, "WIA%d%.2d%.2d", epsd, j, i);
+              WI_PrefetchName(name);
+            }
+    }
+
+  for (np = names; *np; np++)
+    WI_PrefetchName(*np);
+
+  for (i=0 ; i<10 ; i++)
+    {
+      sprintf(name, "WINUM%d", i);
+      WI_PrefetchName(name);
+    }
+
+  for (i=0 ; i<MAXPLAYERS ; i++)
+    {
+      sprintf(name, "STPB%d", i);
+      WI_PrefetchName(name);
+      sprintf(name, "WIBP%d", i+1);
+      WI_PrefetchName(name);
+    }
+}
+
 // ====================================================================
 // WI_Drawer
 // Purpose: Call the appropriate stats drawing routine depending on
@@ -57,4 +57,7 @@ void WI_checkForAccelerate(void);      // killough 11/98
 
 void WI_DrawBackground(void);          // killough 11/98
 
+// Queue the intermission's lumps to be read in the background.
+void WI_Prefetch(int epsd);
+
 #endif
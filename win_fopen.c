@@ -137,5 +137,45 @@ int D_mkdir(const char *dirname)
   if (wdir) free(wdir);
   return ret;
 }
+
+// Maps the whole of an open file read-only, like mmap(PROT_READ).
+// Returns NULL on failure.
+
+void *D_mmap(int fd, size_t length)
+{
+  HANDLE map;
+  void *p;
+
+  map = CreateFileMapping((HANDLE) _get_osfhandle(fd), NULL, PAGE_READONLY,
+                          0, 0, NULL);
+  if (!map)
+    return NULL;
+
+  p = MapViewOfFile(map, FILE_MAP_READ, 0, 0, length);
+
+  CloseHandle(map);   // the view keeps the mapping alive
+  return p;
+}
+
+int D_munmap(void *p)
+{
+  return UnmapViewOfFile(p) ? 0 : -1;
+}
+
+// Reads at an offset without using the file offset, like pread(), so
+// several threads may read one file at once.
+
+int D_pread(int fd, void *buf, unsigned int count, long long offset)
+{
+  OVERLAPPED ov = {0};
+  DWORD n;
+
+  ov.Offset = (DWORD) offset;
+  ov.OffsetHigh = (DWORD) (offset >> 32);
+
+  if (!ReadFile((HANDLE) _get_osfhandle(fd), buf, count, &n, &ov))
+    return -1;
+  return n;
+}
 #endif
 #endif
@@ -33,6 +33,9 @@ int D_stat(const char *path, struct stat *buffer);
 int D_open(const char *filename, int oflag);
 int D_access(const char *path, int mode);
 int D_mkdir(const char *dirname);
+void *D_mmap(int fd, size_t length);
+int D_munmap(void *p);
+int D_pread(int fd, void *buf, unsigned int count, long long offset);
 
 #undef  fopen
 #define fopen(n, m) D_fopen(n, m)
@@ -37,10 +37,15 @@
  * memory allocation functions, including malloc() and similar functions.
  * Added line and file numbers, in case of error. Added performance
  * statistics and tunables.
+ *
+ * Level lifetime blocks (PU_LEVEL and PU_LEVSPEC) are carved out of
+ * large arenas instead, see below, so that a level change gives back
+ * whole arenas rather than freeing each block on its own.
  *-----------------------------------------------------------------------------
  */
 
 #include <stdlib.h>
+#include <stddef.h>
 #include <stdio.h>
 
 #include "z_zone.h"
@@ -76,22 +81,33 @@
 // Number of mallocs & frees kept in history buffer (must be a power of 2)
 #define ZONE_HISTORY 4
 
+// Size of the arenas level blocks are carved from
+#define ARENA_SIZE (256*1024)
+
+// Largest level block taken from an arena; bigger ones are malloc'd
+#define ARENA_MAXBLOCK (64*1024)
+
 // End Tunables
 
+struct arena;
+
 typedef struct memblock {
 
 #ifdef ZONEIDCHECK
   unsigned id;
 #endif
 
-  struct memblock *next,*prev;
+  struct memblock *next,*prev;  // NULL if in an arena and unlisted
   size_t size;
   void **user;
+  struct arena *arena;          // arena holding it, NULL if malloc'd
   unsigned char tag;
 
 #ifdef INSTRUMENTED
   const char *file;
   int line;
+  unsigned char sampled;        // tracked by the instrumentation
+  struct zonesite *site;        // accounted to, if instrumented
 #endif
 
 } memblock_t;
@@ -103,21 +119,274 @@ static const size_t HEADER_SIZE = (sizeof(memblock_t)+CHUNK_SIZE-1) & ~(CHUNK_SI
 
 static memblock_t *blockbytag[PU_MAX];
 
+/* Level arenas
+ *
+ * Each level tag has its own chain of arenas, which blocks are bumped
+ * off. A block freed during the level goes on a free list of its tag
+ * and size class: one class for each size up to ARENA_EXACT chunks,
+ * taken without a search, and one for each power of two above, taken
+ * first fit. Z_FreeTags releases the arenas of a tag all at once.
+ *
+ * A block is owned by its arena while it keeps the arena's tag. Owned
+ * blocks are left out of blockbytag unless they have a user, which
+ * must be cleared when the level ends, so the rest are never walked.
+ * A block changed to another tag escapes: it is listed like any other,
+ * and keeps its arena from being released until it is freed.
+ */
+
+#define ARENA_TAGS    (PU_PURGELEVEL - PU_LEVEL)
+#define ARENA_EXACT   32
+#define ARENA_CLASSES (ARENA_EXACT + 7)   /* up to ARENA_MAXBLOCK */
+
+typedef struct arena {
+  struct arena *next;
+  char *top, *end;              // unused part
+  int escaped;                  // blocks changed to another tag
+  unsigned char tag;
+  boolean retired;              // tag freed, waiting for escaped blocks
+} arena_t;
+
+static const size_t ARENA_HEADER = (sizeof(arena_t)+CHUNK_SIZE-1) & ~(CHUNK_SIZE-1);
+
+static arena_t *arenas[ARENA_TAGS], *retired_arenas;
+static memblock_t *freeblocks[ARENA_TAGS][ARENA_CLASSES];
+static size_t arena_bytes[ARENA_TAGS];  // in owned blocks
+
+#define Z_Owned(b) ((b)->arena && (b)->tag == (b)->arena->tag && !(b)->arena->retired)
+
 // 0 means unlimited, any other value is a hard limit
 //static int memory_size = 8192*1024;
 static int memory_size = 0;
 static int free_memory = 0;
 
+/* The lump cache
+ *
+ * PU_CACHE blocks are listed least recently used first: W_CacheLumpNum
+ * moves a lump to the back with Z_Touch whenever it is asked for, and a
+ * block changed back to PU_CACHE goes on the back too. Past
+ * lump_cache_size, or when memory_size or malloc runs short, blocks are
+ * freed from the front one at a time until there is room, so the
+ * textures and sprites in use stay resident.
+ */
+
+int lump_cache_size;            // KB, 0 for no limit; set from the config
+cachestats_t cachestats;
+static size_t cache_memory;     // in PU_CACHE blocks
+
 #ifdef INSTRUMENTED
 
+/* Instrumentation is compiled in, but only runs when asked for, with
+ * -zonedebug [n] or the "zone" cheat: then one allocation in n (every
+ * one by default) is tracked in the history and has its memory
+ * scrambled when allocated and freed, and the statistics are shown
+ * once a tic. Turned off, it costs one test per call.
+ */
+
+int zone_instrument;            // 0 off, else 1 in how many tracked
+static int zone_countdown = 1;  // allocations until the next tracked
+
 // statistics for evaluating performance
 static int active_memory = 0;
 static int purgable_memory = 0;
 
-static void Z_DrawStats(void)            // Print allocation statistics
+/* Per-site accounting
+ *
+ * While instrumented, the memory in use is also added up for each tag
+ * and allocation site, with the number of blocks and the highest either
+ * has reached. The largest are shown by the "memsites" cheat, and
+ * -zonejson <file> [tics] appends them all to a file as a JSON object,
+ * one per line, every so many tics (a minute by default) and on exit.
+ */
+
+#define ZONE_SITES 4096         /* a power of two */
+
+typedef struct zonesite {
+  const char *file;             // NULL if unused
+  int line, tag;
+  size_t bytes, peakbytes;
+  int count, peakcount;
+  unsigned allocs;              // all there have been
+} zonesite_t;
+
+static zonesite_t zonesites[ZONE_SITES];
+static int num_zonesites;
+static boolean zone_accounted;  // some blocks have a site
+
+static const char *const tagnames[PU_MAX] = {
+  "free", "static", "sound", "music", "level", "levspec", "cache"
+};
+
+static const char *zone_jsonfile;
+static int zone_jsontics, zone_lastdump;
+
+// Finds the site of a tag, file and line, adding it if need be. When the
+// table is nearly full, new sites all go into one for their tag.
+
+static zonesite_t *Z_Site(const char *file, int line, int tag)
+{
+  unsigned i = ((unsigned)(uintptr_t) file * 31 + line) * 8 + tag;
+  zonesite_t *site;
+
+  if (num_zonesites >= ZONE_SITES*3/4)
+    file = "(other)", line = 0, i = tag;
+
+  for (;; i++)
+    if (!(site = &zonesites[i & (ZONE_SITES-1)])->file)
+    {
+      site->file = file;
+      site->line = line;
+      site->tag = tag;
+      num_zonesites++;
+      return site;
+    }
+    else
+      if (site->file == file && site->line == line && site->tag == tag)
+        return site;
+}
+
+static void Z_AccountAdd(memblock_t *block, zonesite_t *site)
+{
+  block->site = site;
+  site->allocs++;
+  if ((site->bytes += block->size) > site->peakbytes)
+    site->peakbytes = site->bytes;
+  if (++site->count > site->peakcount)
+    site->peakcount = site->count;
+  zone_accounted = true;
+}
+
+static void Z_AccountRemove(memblock_t *block)
+{
+  block->site->bytes -= block->size;
+  block->site->count--;
+  block->site = NULL;
+}
+
+static int Z_CompareSites(const void *a, const void *b)
+{
+  const zonesite_t *x = *(const zonesite_t *const *) a;
+  const zonesite_t *y = *(const zonesite_t *const *) b;
+  return x->bytes < y->bytes ? 1 : x->bytes > y->bytes ? -1 :
+    x->peakbytes < y->peakbytes ? 1 : x->peakbytes > y->peakbytes ? -1 : 0;
+}
+
+// Strips the directories from __FILE__
+
+static const char *Z_SiteFile(const zonesite_t *site)
+{
+  const char *s = site->file + strlen(site->file);
+  while (s > site->file && s[-1] != '/' && s[-1] != '\\')
+    s--;
+  return s;
+}
+
+//
+// Z_DescribeSites
+// Writes a line for each of the n sites using the most memory, largest
+// first, into lines of width bytes each. Returns how many it wrote.
+//
+
+int Z_DescribeSites(char *lines, int n, int width)
+{
+  zonesite_t *sorted[ZONE_SITES];
+  int i, num = 0;
+
+  for (i = 0; i < ZONE_SITES; i++)
+    if (zonesites[i].file && zonesites[i].count)
+      sorted[num++] = &zonesites[i];
+  qsort(sorted, num, sizeof *sorted, Z_CompareSites);
+
+  if (n > num)
+    n = num;
+  for (i = 0; i < n; i++)
+  {
+    char where[32];
+    sprintf(where, "%.20s:%d", Z_SiteFile(sorted[i]), sorted[i]->line);
+    snprintf(lines + i*width, width, "%-7s %-20s %6luK %6luK %5d",
+             tagnames[sorted[i]->tag], where,
+             (unsigned long)(sorted[i]->bytes >> 10),
+             (unsigned long)(sorted[i]->peakbytes >> 10), sorted[i]->count);
+  }
+  return n;
+}
+
+static void Z_PutJSONString(FILE *fp, const char *s)
+{
+  putc('"', fp);
+  for (; *s; s++)
+  {
+    if (*s == '"' || *s == '\\')
+      putc('\\', fp);
+    putc(*s, fp);
+  }
+  putc('"', fp);
+}
+
+//
+// Z_DumpSites
+// Appends the whole table to the -zonejson file.
+//
+
+void Z_DumpSites(void)
 {
+  FILE *fp;
+  int i, first = 1;
+
+  if (!zone_jsonfile || !(fp = fopen(zone_jsonfile, "a")))
+    return;
+
+  fprintf(fp, "{\"gametic\": %d, \"level\": ", gametic);
   if (gamestate != GS_LEVEL)
+    fputs("null", fp);
+  else
+  {
+    char name[9];
+    if (gamemode == commercial)
+      sprintf(name, "MAP%02d", gamemap);
+    else
+      sprintf(name, "E%dM%d", gameepisode, gamemap);
+    Z_PutJSONString(fp, name);
+  }
+  fprintf(fp, ", \"active\": %d, \"purgable\": %d, \"sites\": [",
+          active_memory, purgable_memory);
+
+  for (i = 0; i < ZONE_SITES; i++)
+    if (zonesites[i].file)
+    {
+      const zonesite_t *site = &zonesites[i];
+      fputs(first ? "{\"file\": " : ", {\"file\": ", fp);
+      Z_PutJSONString(fp, Z_SiteFile(site));
+      fprintf(fp, ", \"line\": %d, \"tag\": \"%s\", \"bytes\": %lu, "
+              "\"count\": %d, \"peak_bytes\": %lu, \"peak_count\": %d, "
+              "\"allocs\": %u}", site->line, tagnames[site->tag],
+              (unsigned long) site->bytes, site->count,
+              (unsigned long) site->peakbytes, site->peakcount, site->allocs);
+      first = 0;
+    }
+
+  fputs("]}\n", fp);
+  fclose(fp);
+  zone_lastdump = gametic;
+}
+
+//
+// Z_Ticker
+// Dumps the accounting every so often, if asked to.
+//
+
+void Z_Ticker(void)
+{
+  if (zone_jsonfile && gametic - zone_lastdump >= zone_jsontics)
+    Z_DumpSites();
+}
+
+static void Z_DrawStats(void)            // Print allocation statistics
+{
+  static int lasttic = -1;
+
+  if (gamestate != GS_LEVEL || gametic == lasttic)
     return;
+  lasttic = gametic;
 
   if (memory_size > 0) {
     unsigned long long total_memory = free_memory + memory_size + active_memory + purgable_memory;
@@ -266,8 +535,39 @@ void Z_Close(void)
 #endif
 }
 
+static void Z_PrintCacheStats(void)
+{
+  unsigned lookups = cachestats.hits + cachestats.misses;
+
+  printf("cachestats: %u lookups, %u hits (%.1f%%), %u misses,"
+         " %u evictions (%lu KB)\n", lookups, cachestats.hits,
+         lookups ? cachestats.hits * 100.0 / lookups : 0.0,
+         cachestats.misses, cachestats.evictions,
+         (unsigned long)(cachestats.evictedbytes / 1024));
+}
+
 void Z_Init(void)
 {
+  if (M_CheckParm("-cachestats"))
+    atexit(Z_PrintCacheStats);
+
+#ifdef INSTRUMENTED
+  int p = M_CheckParm("-zonedebug");
+
+  if (p)
+    zone_instrument = p < myargc-1 && atoi(myargv[p+1]) > 0 ?
+      atoi(myargv[p+1]) : 1;
+
+  if ((p = M_CheckParm("-zonejson")) && p < myargc-1)
+  {
+    zone_jsonfile = myargv[p+1];
+    zone_jsontics = p < myargc-2 && atoi(myargv[p+2]) > 0 ?
+      atoi(myargv[p+2]) : 60*TICRATE;
+    if (!zone_instrument)
+      zone_instrument = 1;
+    atexit(Z_DumpSites);
+  }
+#endif
 #if 0
   size_t size = zone_size*1000;
 
@@ -317,6 +617,245 @@ void Z_Init(void)
 #endif
 }
 
+/* Memory the zone does not own, but which is handed out where zone
+ * blocks are expected: lumps returned straight out of a WAD mapping.
+ * Z_Free, Z_ChangeTag and Z_ChangeUser leave pointers into it alone.
+ * Z_AddMapped returns 0 once the table is full, and the caller
+ * has to do without the mapping.
+ */
+
+#define MAX_MAPPED 64
+
+static struct { const char *start, *end; } mapped[MAX_MAPPED];
+static int num_mapped;
+
+int Z_AddMapped(const void *start, size_t size)
+{
+  if (num_mapped == MAX_MAPPED)
+    return 0;
+  mapped[num_mapped].start = start;
+  mapped[num_mapped++].end = (const char *) start + size;
+  return 1;
+}
+
+void Z_RemoveMapped(const void *start)
+{
+  int i;
+
+  for (i = 0; i < num_mapped; i++)
+    if (mapped[i].start == start)
+    {
+      mapped[i] = mapped[--num_mapped];
+      return;
+    }
+}
+
+static boolean Z_IsMapped(const void *ptr)
+{
+  int i;
+
+  for (i = 0; i < num_mapped; i++)
+    if ((const char *) ptr >= mapped[i].start &&
+        (const char *) ptr < mapped[i].end)
+      return true;
+  return false;
+}
+
+static void Z_Link(memblock_t *block, int tag)
+{
+  if (!blockbytag[tag])
+  {
+    blockbytag[tag] = block;
+    block->next = block->prev = block;
+  }
+  else
+  {
+    blockbytag[tag]->prev->next = block;
+    block->prev = blockbytag[tag]->prev;
+    block->next = blockbytag[tag];
+    blockbytag[tag]->prev = block;
+  }
+}
+
+static void Z_Unlink(memblock_t *block)
+{
+  if (!block->next)             // an unlisted arena block
+    return;
+  if (block == block->next)
+    blockbytag[block->tag] = NULL;
+  else
+    if (blockbytag[block->tag] == block)
+      blockbytag[block->tag] = block->next;
+  block->prev->next = block->next;
+  block->next->prev = block->prev;
+  block->next = block->prev = NULL;
+}
+
+static int Z_SizeClass(size_t size)
+{
+  int c = ARENA_EXACT;
+
+  if (size <= ARENA_EXACT*CHUNK_SIZE)
+    return size/CHUNK_SIZE - 1;
+  for (size /= ARENA_EXACT*CHUNK_SIZE*2; size; size >>= 1)
+    c++;
+  return c;
+}
+
+static void Z_PushFree(memblock_t *block)
+{
+  memblock_t **list = &freeblocks[block->arena->tag - PU_LEVEL]
+                                 [Z_SizeClass(block->size)];
+  block->tag = PU_FREE;
+  block->user = NULL;
+  block->prev = NULL;
+  block->next = *list;
+  *list = block;
+}
+
+/* Z_ArenaAlloc
+ * Returns a level block of at least size bytes, or NULL if no new arena
+ * could be had. The block's size is what it can hold.
+ */
+
+static memblock_t *Z_ArenaAlloc(size_t size, int tag)
+{
+  memblock_t **list = freeblocks[tag - PU_LEVEL], *block, **prev;
+  arena_t *arena = arenas[tag - PU_LEVEL];
+  int c = Z_SizeClass(size);
+
+  if (c < ARENA_EXACT)
+  {
+    if ((block = list[c]))
+    {
+      list[c] = block->next;
+      return block;
+    }
+  }
+  else
+    for (; c < ARENA_CLASSES; c++)
+      for (prev = &list[c]; (block = *prev); prev = &block->next)
+        if (block->size >= size)
+        {
+          *prev = block->next;
+          return block;
+        }
+
+  if (!arena || arena->end - arena->top < (ptrdiff_t)(HEADER_SIZE + size))
+  {
+    if (arena && arena->end - arena->top >= (ptrdiff_t)(HEADER_SIZE + CHUNK_SIZE))
+    {
+      // the rest of the old arena is one more free block
+      block = (memblock_t *) arena->top;
+      block->arena = arena;
+      block->size = (arena->end - arena->top - HEADER_SIZE) & ~(CHUNK_SIZE-1);
+      arena->top += HEADER_SIZE + block->size;  // the blocks stay walkable
+      Z_PushFree(block);
+    }
+
+    if (!(arena = (malloc)(ARENA_SIZE)))
+      return NULL;
+    arena->top = (char *) arena + ARENA_HEADER;
+    arena->end = (char *) arena + ARENA_SIZE;
+    arena->escaped = 0;
+    arena->tag = tag;
+    arena->retired = false;
+    arena->next = arenas[tag - PU_LEVEL];
+    arenas[tag - PU_LEVEL] = arena;
+  }
+
+  block = (memblock_t *) arena->top;
+  arena->top += HEADER_SIZE + size;
+  block->arena = arena;
+  block->size = size;
+  return block;
+}
+
+/* Z_FreeArenas
+ * Gives back every arena of a level tag, once the listed blocks of the
+ * tag have been freed. Arenas with escaped blocks are kept until those
+ * are freed as well.
+ */
+
+static void Z_FreeArenas(int tag)
+{
+  arena_t *arena = arenas[tag - PU_LEVEL];
+
+  while (arena)
+  {
+    arena_t *next = arena->next;
+#ifdef INSTRUMENTED
+    if (zone_accounted)       // take the blocks off their sites
+    {
+      char *p;
+      for (p = (char *) arena + ARENA_HEADER; p < arena->top;
+           p += HEADER_SIZE + ((memblock_t *) p)->size)
+      {
+        memblock_t *block = (memblock_t *) p;
+        if (block->tag == tag && block->site)
+          Z_AccountRemove(block);
+      }
+    }
+#endif
+    if (arena->escaped)
+    {
+      arena->retired = true;
+      arena->next = retired_arenas;
+      retired_arenas = arena;
+    }
+    else
+      (free)(arena);
+    arena = next;
+  }
+
+  free_memory += arena_bytes[tag - PU_LEVEL];
+#ifdef INSTRUMENTED
+  active_memory -= arena_bytes[tag - PU_LEVEL];
+#endif
+  arena_bytes[tag - PU_LEVEL] = 0;
+  arenas[tag - PU_LEVEL] = NULL;
+  memset(freeblocks[tag - PU_LEVEL], 0, sizeof freeblocks[0]);
+}
+
+/* Z_FreeEscaped
+ * Frees a block which has left its arena's tag. Its space is reused if
+ * the arena is still in use, or the arena goes once it holds no more.
+ */
+
+static void Z_FreeEscaped(memblock_t *block)
+{
+  arena_t *arena = block->arena, **prev;
+
+  arena->escaped--;
+  if (!arena->retired)
+    Z_PushFree(block);
+  else
+    if (!arena->escaped)
+    {
+      for (prev = &retired_arenas; *prev != arena; prev = &(*prev)->next)
+        ;
+      *prev = arena->next;
+      (free)(arena);
+    }
+}
+
+/* Z_EvictCache
+ * Frees the least recently used cached block. Returns false if there
+ * are none.
+ */
+
+static boolean Z_EvictCache(DAC(const char *file, int line))
+{
+  memblock_t *block = blockbytag[PU_CACHE];
+
+  if (!block)
+    return false;
+  cachestats.evictions++;
+  cachestats.evictedbytes += block->size;
+  (Z_Free)((char *) block + HEADER_SIZE DA(file, line));
+  return true;
+}
+
 /* Z_Malloc
  * You can pass a NULL user if the tag is < PU_PURGELEVEL.
  *
@@ -336,15 +875,21 @@ void *(Z_Malloc)(size_t size, int tag, void **user
      )
 {
   memblock_t *block = NULL;
-
 #ifdef INSTRUMENTED
+  boolean sampled = false;
+
 #ifdef CHECKHEAP
   Z_CheckHeap();
 #endif
 
-  file_history[malloc_history][history_index[malloc_history]] = file;
-  line_history[malloc_history][history_index[malloc_history]++] = line;
-  history_index[malloc_history] &= ZONE_HISTORY-1;
+  if (zone_instrument && --zone_countdown <= 0)
+  {
+    zone_countdown = zone_instrument;
+    sampled = true;
+    file_history[malloc_history][history_index[malloc_history]] = file;
+    line_history[malloc_history][history_index[malloc_history]++] = line;
+    history_index[malloc_history] &= ZONE_HISTORY-1;
+  }
 #endif
 
 #ifdef ZONEIDCHECK
@@ -361,35 +906,37 @@ void *(Z_Malloc)(size_t size, int tag, void **user
 
   size = (size+CHUNK_SIZE-1) & ~(CHUNK_SIZE-1);  // round to chunk size
 
-  if (memory_size > 0 && ((free_memory + memory_size) < (int)(size + HEADER_SIZE)))
+  // make room, least recently used lumps first
   {
-    memblock_t *end_block;
-    block = blockbytag[PU_CACHE];
-    if (block)
-    {
-      end_block = block->prev;
-      while (1)
-      {
-        memblock_t *next = block->next;
-#ifdef INSTRUMENTED
-        (Z_Free)((char *) block + HEADER_SIZE, file, line);
-#else
-        (Z_Free)((char *) block + HEADER_SIZE);
-#endif
-        if (((free_memory + memory_size) >= (int)(size + HEADER_SIZE)) || (block == end_block))
-          break;
-        block = next;               // Advance to next block
-      }
-    }
-    block = NULL;
+    size_t budget = (size_t) lump_cache_size * 1024;
+    size_t incoming = tag == PU_CACHE ? size : 0;
+
+    while ((budget && cache_memory + incoming > budget) ||
+           (memory_size > 0 &&
+            free_memory + memory_size < (int)(size + HEADER_SIZE)))
+      if (!Z_EvictCache(DAC(file, line)))
+        break;
   }
 
+  for (;;) {
+    if (tag >= PU_LEVEL && tag < PU_PURGELEVEL && size <= ARENA_MAXBLOCK)
+      block = Z_ArenaAlloc(size, tag);
+    else
+    {
 #ifdef HAVE_LIBDMALLOC
-  while (!(block = dmalloc_malloc(file,line,size + HEADER_SIZE,DMALLOC_FUNC_MALLOC,0,0))) {
+      block = dmalloc_malloc(file,line,size + HEADER_SIZE,DMALLOC_FUNC_MALLOC,0,0);
 #else
-  while (!(block = (malloc)(size + HEADER_SIZE))) {
+      block = (malloc)(size + HEADER_SIZE);
 #endif
-    if (!blockbytag[PU_CACHE])
+      if (block)
+      {
+        block->arena = NULL;
+        block->size = size;
+      }
+    }
+    if (block)
+      break;
+    if (!Z_EvictCache(DAC(file, line)))
       I_Error ("Z_Malloc: Failure trying to allocate %lu bytes"
 #ifdef INSTRUMENTED
                "\nSource: %s:%d"
@@ -399,23 +946,17 @@ void *(Z_Malloc)(size_t size, int tag, void **user
                , file, line
 #endif
       );
-    Z_FreeTags(PU_CACHE,PU_CACHE);
   }
 
-  if (!blockbytag[tag])
-  {
-    blockbytag[tag] = block;
-    block->next = block->prev = block;
-  }
+  block->tag = tag;
+  if (!block->arena || user)
+    Z_Link(block, tag);
   else
-  {
-    blockbytag[tag]->prev->next = block;
-    block->prev = blockbytag[tag]->prev;
-    block->next = blockbytag[tag];
-    blockbytag[tag]->prev = block;
-  }
-    
-  block->size = size;
+    block->next = block->prev = NULL;
+  if (block->arena)
+    arena_bytes[tag - PU_LEVEL] += block->size;
+  if (tag == PU_CACHE)
+    cache_memory += block->size;
 
 #ifdef INSTRUMENTED
   if (tag >= PU_PURGELEVEL)
@@ -428,21 +969,27 @@ void *(Z_Malloc)(size_t size, int tag, void **user
 #ifdef INSTRUMENTED
   block->file = file;
   block->line = line;
+  block->sampled = sampled;
+  block->site = NULL;
+  if (zone_instrument)
+    Z_AccountAdd(block, Z_Site(file, line, tag));
 #endif
   
 #ifdef ZONEIDCHECK
   block->id = ZONEID;         // signature required in block header
 #endif
-  block->tag = tag;           // tag
   block->user = user;         // user
   block = (memblock_t *)((char *) block + HEADER_SIZE);
   if (user)                   // if there is a user
     *user = block;            // set user to point to new block
   
 #ifdef INSTRUMENTED
-  Z_DrawStats();           // print memory allocation stats
-  // scramble memory -- weed out any bugs
-  memset(block, gametic & 0xff, size);
+  if (sampled)
+  {
+    Z_DrawStats();           // print memory allocation stats
+    // scramble memory -- weed out any bugs
+    memset(block, gametic & 0xff, size);
+  }
 #endif
 
   return block;
@@ -460,14 +1007,20 @@ void (Z_Free)(void *p
 #ifdef CHECKHEAP
   Z_CheckHeap();
 #endif
-  file_history[free_history][history_index[free_history]] = file;
-  line_history[free_history][history_index[free_history]++] = line;
-  history_index[free_history] &= ZONE_HISTORY-1;
 #endif
 
-  if (!p)
+  if (!p || Z_IsMapped(p))
     return;
 
+#ifdef INSTRUMENTED
+  if (block->sampled)
+  {
+    file_history[free_history][history_index[free_history]] = file;
+    line_history[free_history][history_index[free_history]++] = line;
+    history_index[free_history] &= ZONE_HISTORY-1;
+  }
+#endif
+
 
 #ifdef ZONEIDCHECK
   if (block->id != ZONEID)
@@ -484,32 +1037,44 @@ void (Z_Free)(void *p
   if (block->user)            // Nullify user if one exists
     *block->user = NULL;
 
-  if (block == block->next)
-    blockbytag[block->tag] = NULL;
-  else
-    if (blockbytag[block->tag] == block)
-      blockbytag[block->tag] = block->next;
-  block->prev->next = block->next;
-  block->next->prev = block->prev;
+  Z_Unlink(block);
 
   free_memory += block->size;
+  if (block->tag == PU_CACHE)
+    cache_memory -= block->size;
 #ifdef INSTRUMENTED
   if (block->tag >= PU_PURGELEVEL)
     purgable_memory -= block->size;
   else
     active_memory -= block->size;
 
+  if (block->site)
+    Z_AccountRemove(block);
+
   /* scramble memory -- weed out any bugs */
-  memset(block, gametic & 0xff, block->size + HEADER_SIZE);
+  if (block->sampled)
+    memset((char *) block + HEADER_SIZE, gametic & 0xff, block->size);
 #endif
 
+  if (block->arena)
+  {
+    if (Z_Owned(block))
+    {
+      arena_bytes[block->tag - PU_LEVEL] -= block->size;
+      Z_PushFree(block);
+    }
+    else
+      Z_FreeEscaped(block);
+  }
+  else
 #ifdef HAVE_LIBDMALLOC
   dmalloc_free(file,line,block,DMALLOC_FUNC_MALLOC);
 #else
   (free)(block);
 #endif
 #ifdef INSTRUMENTED
-      Z_DrawStats();           // print memory allocation stats
+  if (zone_instrument)
+    Z_DrawStats();           // print memory allocation stats
 #endif
 }
 
@@ -533,6 +1098,14 @@ void (Z_FreeTags)(int lowtag, int hightag
   {
     memblock_t *block, *end_block;
     block = blockbytag[lowtag];
+    if (lowtag >= PU_LEVEL && lowtag < PU_PURGELEVEL)
+    {
+      // the listed blocks first, then the arenas in one go
+      while ((block = blockbytag[lowtag]))
+        (Z_Free)((char *) block + HEADER_SIZE DA(file, line));
+      Z_FreeArenas(lowtag);
+      continue;
+    }
     if (!block)
       continue;
     end_block = block->prev;
@@ -560,7 +1133,7 @@ void (Z_ChangeTag)(void *ptr, int tag
   memblock_t *block = (memblock_t *)((char *) ptr - HEADER_SIZE);
 
   // proff - added sanity check, this can happen when an empty lump is locked
-  if (!ptr)
+  if (!ptr || Z_IsMapped(ptr))
     return;
 
   // proff - do nothing if tag doesn't differ
@@ -594,25 +1167,21 @@ void (Z_ChangeTag)(void *ptr, int tag
 
 #endif // ZONEIDCHECK
 
-  if (block == block->next)
-    blockbytag[block->tag] = NULL;
-  else
-    if (blockbytag[block->tag] == block)
-      blockbytag[block->tag] = block->next;
-  block->prev->next = block->next;
-  block->next->prev = block->prev;
+  Z_Unlink(block);
 
-  if (!blockbytag[tag])
-  {
-    blockbytag[tag] = block;
-    block->next = block->prev = block;
-  }
-  else
+  if (block->arena)           // may escape from its arena, or return
   {
-    blockbytag[tag]->prev->next = block;
-    block->prev = blockbytag[tag]->prev;
-    block->next = blockbytag[tag];
-    blockbytag[tag]->prev = block;
+    if (Z_Owned(block))
+    {
+      block->arena->escaped++;
+      arena_bytes[block->tag - PU_LEVEL] -= block->size;
+    }
+    else
+      if (tag == block->arena->tag && !block->arena->retired)
+      {
+        block->arena->escaped--;
+        arena_bytes[tag - PU_LEVEL] += block->size;
+      }
   }
 
 #ifdef INSTRUMENTED
@@ -627,9 +1196,89 @@ void (Z_ChangeTag)(void *ptr, int tag
       active_memory += block->size;
       purgable_memory -= block->size;
     }
+
+  if (block->site)
+  {
+    Z_AccountRemove(block);
+    Z_AccountAdd(block, Z_Site(block->file, block->line, tag));
+  }
 #endif
 
+  if (block->tag == PU_CACHE)
+    cache_memory -= block->size;
+  else
+    if (tag == PU_CACHE)
+      cache_memory += block->size;
+
   block->tag = tag;
+  if (!Z_Owned(block) || block->user)
+    Z_Link(block, tag);
+}
+
+/* Z_Touch
+ * Marks a cached block as just used, which puts it last in line to be
+ * evicted. The pointer must come from Z_Malloc.
+ */
+
+void Z_Touch(void *ptr)
+{
+  memblock_t *block = (memblock_t *)((char *) ptr - HEADER_SIZE);
+
+  if (block->tag == PU_CACHE && block->next != blockbytag[PU_CACHE])
+  {
+    Z_Unlink(block);
+    Z_Link(block, PU_CACHE);
+  }
+}
+
+/* Z_ChangeUser
+ * Hands a block over to a new owner pointer, which is set to the block.
+ * The old owner is left alone.
+ */
+
+void Z_ChangeUser(void *ptr, void **user)
+{
+  memblock_t *block = (memblock_t *)((char *) ptr - HEADER_SIZE);
+
+  if (!ptr || Z_IsMapped(ptr))
+    return;
+
+#ifdef ZONEIDCHECK
+  if (block->id != ZONEID)
+    I_Error("Z_ChangeUser: changed a pointer without ZONEID");
+
+  if (block->tag >= PU_PURGELEVEL && !user)
+    I_Error("Z_ChangeUser: an owner is required for purgable blocks");
+#endif
+
+  block->user = user;
+  if (user)
+  {
+    *user = ptr;
+    if (!block->next)         // now it must be cleared with its level
+      Z_Link(block, block->tag);
+  }
+}
+
+//
+// Z_GetTag
+// Returns the tag of a block. Pointers into mapped files read as
+// PU_STATIC, since they are never purged.
+//
+
+int Z_GetTag(const void *ptr)
+{
+  const memblock_t *block = (const memblock_t *)((const char *) ptr - HEADER_SIZE);
+
+  if (Z_IsMapped(ptr))
+    return PU_STATIC;
+
+#ifdef ZONEIDCHECK
+  if (block->id != ZONEID)
+    I_Error("Z_GetTag: a pointer without ZONEID");
+#endif
+
+  return block->tag;
 }
 
 void *(Z_Realloc)(void *ptr, size_t n, int tag, void **user
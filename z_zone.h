@@ -71,6 +71,10 @@ void *(Z_Malloc)(size_t size, int tag, void **ptr DA(const char *, int));
 void (Z_Free)(void *ptr DA(const char *, int));
 void (Z_FreeTags)(int lowtag, int hightag DA(const char *, int));
 void (Z_ChangeTag)(void *ptr, int tag DA(const char *, int));
+void Z_ChangeUser(void *ptr, void **user);
+int Z_GetTag(const void *ptr);
+int Z_AddMapped(const void *start, size_t size);
+void Z_RemoveMapped(const void *start);
 void (Z_Init)(void);
 void Z_Close(void);
 void *(Z_Calloc)(size_t n, size_t n2, int tag, void **user DA(const char *, int));
@@ -78,6 +82,24 @@ void *(Z_Realloc)(void *p, size_t n, int tag, void **user DA(const char *, int))
 char *(Z_Strdup)(const char *s, int tag, void **user DA(const char *, int));
 void (Z_CheckHeap)(DAC(const char *,int));   // killough 3/22/98: add file/line info
 void Z_DumpHistory(char *);
+void Z_Touch(void *ptr);
+
+// Lump cache counters, printed on exit with -cachestats
+typedef struct {
+  unsigned hits, misses, evictions;
+  size_t evictedbytes;
+} cachestats_t;
+
+extern cachestats_t cachestats;
+extern int lump_cache_size;   // KB of PU_CACHE blocks kept, 0 for no limit
+
+#ifdef INSTRUMENTED
+extern int zone_instrument;   // 0 off, else 1 in how many allocations tracked
+
+int Z_DescribeSites(char *lines, int n, int width);
+void Z_DumpSites(void);
+void Z_Ticker(void);
+#endif
 
 #ifdef INSTRUMENTED
 /* cph - save space if not debugging, don't require file 